@@ -389,7 +389,7 @@ void FullPRISMCalcThread::run()
         emit overwriteWarning();
         if (this->parent->overwriteFile())
         {
-            //params.outputFile.flush(H5F_SCOPE_GLOBAL);
+            //params.outputWriter->getFile().flush(H5F_SCOPE_GLOBAL);
             remove(params.meta.filenameOutput.c_str());
             this->thread()->sleep(1);
             this->parent->flipOverwrite(); //flip the check back
@@ -408,7 +408,7 @@ void FullPRISMCalcThread::run()
     QMutexLocker calculationLocker(&this->parent->calculationLock);
 
     Prismatic::configure(meta);
-    params.outputFile = H5::H5File(params.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
+    params.outputWriter = std::make_shared<Prismatic::OutputWriter>(params.meta.filenameOutput, H5F_ACC_TRUNC, params.meta.swmrInterval > 0);
     Prismatic::setupOutputFile(params);
     params.fpFlag = 0;
 
@@ -466,8 +466,9 @@ void FullPRISMCalcThread::run()
     */
     //    emit ScompactCalculated();
 
+    Prismatic::setupDatacubeAccumulator(params);
     Prismatic::PRISM03_calcOutput(params);
-    params.outputFile.close();
+    Prismatic::closeOutputFile(params);
 
     if (params.meta.numFP > 1)
     {
@@ -476,6 +477,9 @@ void FullPRISMCalcThread::run()
         Prismatic::Array4D<PRISMATIC_FLOAT_PRECISION> DPC_CoM_output;
         if (params.meta.saveDPC_CoM)
             DPC_CoM_output = params.DPC_CoM;
+        std::shared_ptr<Prismatic::DatacubeAccumulator> datacubeAccumulator = params.datacubeAccumulator;
+        std::shared_ptr<Prismatic::DatacubeMap> datacubeMap = params.datacubeMap;
+        std::shared_ptr<Prismatic::OutputWriter> outputWriter = params.outputWriter;
 
         for (auto fp_num = 1; fp_num < params.meta.numFP; ++fp_num)
         {
@@ -485,8 +489,12 @@ void FullPRISMCalcThread::run()
             emit signalTitle("PRISM: Frozen Phonon #" + QString::number(1 + fp_num));
             progressbar->resetOutputs();
 
-            params.outputFile = H5::H5File(params.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+            Prismatic::reopenOutputFile(params, outputWriter);
             params.fpFlag = fp_num;
+            params.datacubeAccumulator = datacubeAccumulator;
+            params.datacubeMap = datacubeMap;
+            params.outputSum = &net_output;
+            params.DPC_CoMSum = &DPC_CoM_output;
 
             Prismatic::PRISM01_calcPotential(params);
             this->parent->potentialReceived(params.pot);
@@ -496,7 +504,7 @@ void FullPRISMCalcThread::run()
             net_output += params.output;
             if (meta.saveDPC_CoM)
                 DPC_CoM_output += params.DPC_CoM;
-            params.outputFile.close();
+            Prismatic::closeOutputFile(params);
         }
         // divide to take average
         for (auto &i : net_output)
@@ -530,107 +538,15 @@ void FullPRISMCalcThread::run()
         gatekeeper.unlock();
     }
 
-    params.outputFile = H5::H5File(params.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+    Prismatic::reopenOutputFile(params, params.outputWriter);
+    Prismatic::writeDatacubeAccumulator(params);
 
-    if (params.meta.save3DOutput)
-    {
-        PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-        Prismatic::setupVDOutput(params, params.output.get_diml(), dummy);
-        Prismatic::Array3D<PRISMATIC_FLOAT_PRECISION> output_image = Prismatic::zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{params.output.get_dimj(), params.output.get_dimk(), params.output.get_dimi()}});
-
-        std::stringstream nameString;
-        nameString << "4DSTEM_simulation/data/realslices/virtual_detector_depth" << Prismatic::getDigitString(0);
-        H5::Group dataGroup = params.outputFile.openGroup(nameString.str());
-
-        std::string dataSetName = "realslice";
-        H5::DataSet VD_data = dataGroup.openDataSet(dataSetName);
-        hsize_t mdims[3] = {params.xp.size(), params.yp.size(), params.Ndet};
-
-        for (auto b = 0; b < params.Ndet; b++)
-        {
-            for (auto y = 0; y < params.output.get_dimk(); ++y)
-            {
-                for (auto x = 0; x < params.output.get_dimj(); ++x)
-                {
-                    output_image.at(x, y, b) = params.output.at(0, y, x, b);
-                }
-            }
-        }
-
-        Prismatic::writeDatacube3D(VD_data, &output_image[0], mdims);
-        VD_data.close();
-        dataGroup.close();
-    }
-
-    if (params.meta.save2DOutput)
-    {
-        size_t lower = std::max((size_t)0, (size_t)(params.meta.integrationAngleMin / params.meta.detectorAngleStep));
-        size_t upper = std::min((size_t)params.detectorAngles.size(), (size_t)(params.meta.integrationAngleMax / params.meta.detectorAngleStep));
-        Prismatic::Array2D<PRISMATIC_FLOAT_PRECISION> prism_image;
-        prism_image = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-            {{params.output.get_dimj(), params.output.get_dimk()}});
-        PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-        Prismatic::setup2DOutput(params, params.output.get_diml(), dummy);
-
-        for (auto y = 0; y < params.output.get_dimk(); ++y)
-        {
-            for (auto x = 0; x < params.output.get_dimj(); ++x)
-            {
-                for (auto b = lower; b < upper; ++b)
-                {
-                    prism_image.at(x, y) += params.output.at(0, y, x, b);
-                }
-            }
-        }
-        std::stringstream nameString;
-        nameString << "4DSTEM_simulation/data/realslices/annular_detector_depth" << Prismatic::getDigitString(0);
-        H5::Group dataGroup = params.outputFile.openGroup(nameString.str());
-        H5::DataSet AD_data = dataGroup.openDataSet("realslice");
-        hsize_t mdims[2] = {params.xp.size(), params.yp.size()};
-
-        Prismatic::writeRealSlice(AD_data, &prism_image[0], mdims);
-        AD_data.close();
-        dataGroup.close();
-
-        //std::string image_filename = params.meta.outputFolder + std::string("prism_2Doutput_") + params.meta.filenameOutput;
-        //prism_image.toMRC_f(image_filename.c_str());
-    }
-
-    if (params.meta.saveDPC_CoM)
-    {
-        PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-        Prismatic::setupDPCOutput(params, params.output.get_diml(), dummy);
-
-        //create dummy array to pass to
-        Prismatic::Array3D<PRISMATIC_FLOAT_PRECISION> DPC_slice;
-
-        std::stringstream nameString;
-        nameString << "4DSTEM_simulation/data/realslices/DPC_CoM_depth" << Prismatic::getDigitString(0);
-        H5::Group dataGroup = params.outputFile.openGroup(nameString.str());
-        hsize_t mdims[3] = {params.xp.size(), params.yp.size(), 2};
-        std::string dataSetName = "realslice";
-        H5::DataSet DPC_data = dataGroup.openDataSet(dataSetName);
-
-        DPC_slice = Prismatic::zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{params.DPC_CoM.get_dimj(), params.DPC_CoM.get_dimk(), 2}});
-        for (auto b = 0; b < params.DPC_CoM.get_dimi(); ++b)
-        {
-            for (auto y = 0; y < params.DPC_CoM.get_dimk(); ++y)
-            {
-                for (auto x = 0; x < params.DPC_CoM.get_dimj(); ++x)
-                {
-                    DPC_slice.at(x, y, b) = params.DPC_CoM.at(0, y, x, b);
-                }
-            }
-        }
-
-        Prismatic::writeDatacube3D(DPC_data, &DPC_slice[0], mdims);
-        DPC_data.close();
-        dataGroup.close();
-    }
+    Prismatic::setupRealSliceOutput(params);
+    Prismatic::writeRealSliceOutput(params);
 
     PRISMATIC_FLOAT_PRECISION dummy = 1.0;
     Prismatic::writeMetadata(params, dummy);
-    params.outputFile.close();
+    params.outputWriter->close();
 
     this->parent->outputReceived(params.output);
     emit outputCalculated();
@@ -656,7 +572,7 @@ void FullMultisliceCalcThread::run()
         emit overwriteWarning();
         if (this->parent->overwriteFile())
         {
-            //params.outputFile.flush(H5F_SCOPE_GLOBAL);
+            //params.outputWriter->getFile().flush(H5F_SCOPE_GLOBAL);
             remove(params.meta.filenameOutput.c_str());
             this->thread()->sleep(1);
             this->parent->flipOverwrite(); //flip the check back
@@ -673,7 +589,7 @@ void FullMultisliceCalcThread::run()
     QMutexLocker calculationLocker(&this->parent->calculationLock);
     Prismatic::configure(meta);
 
-    params.outputFile = H5::H5File(params.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
+    params.outputWriter = std::make_shared<Prismatic::OutputWriter>(params.meta.filenameOutput, H5F_ACC_TRUNC, params.meta.swmrInterval > 0);
     Prismatic::setupOutputFile(params);
     params.fpFlag = 0;
 
@@ -713,8 +629,9 @@ void FullMultisliceCalcThread::run()
 
     params.scale = 1.0;
     //Calls Multislice_calcOutput for first frozen phonon pass
+    Prismatic::setupDatacubeAccumulator(params);
     Prismatic::Multislice_calcOutput(params);
-    params.outputFile.close();
+    Prismatic::closeOutputFile(params);
 
     if (params.meta.numFP > 1)
     {
@@ -723,6 +640,9 @@ void FullMultisliceCalcThread::run()
         Prismatic::Array4D<PRISMATIC_FLOAT_PRECISION> DPC_CoM_output;
         if (params.meta.saveDPC_CoM)
             DPC_CoM_output = params.DPC_CoM;
+        std::shared_ptr<Prismatic::DatacubeAccumulator> datacubeAccumulator = params.datacubeAccumulator;
+        std::shared_ptr<Prismatic::DatacubeMap> datacubeMap = params.datacubeMap;
+        std::shared_ptr<Prismatic::OutputWriter> outputWriter = params.outputWriter;
         for (auto fp_num = 1; fp_num < params.meta.numFP; ++fp_num)
         {
             params.meta.randomSeed = rand() % 100000;
@@ -731,8 +651,12 @@ void FullMultisliceCalcThread::run()
             emit signalTitle("PRISM: Frozen Phonon #" + QString::number(1 + fp_num));
             progressbar->resetOutputs();
 
-            params.outputFile = H5::H5File(params.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+            Prismatic::reopenOutputFile(params, outputWriter);
             params.fpFlag = fp_num;
+            params.datacubeAccumulator = datacubeAccumulator;
+            params.datacubeMap = datacubeMap;
+            params.outputSum = &net_output;
+            params.DPC_CoMSum = &DPC_CoM_output;
             params.scale = 1.0;
 
             Prismatic::PRISM01_calcPotential(params);
@@ -743,7 +667,7 @@ void FullMultisliceCalcThread::run()
             net_output += params.output;
             if (meta.saveDPC_CoM)
                 DPC_CoM_output += params.DPC_CoM;
-            params.outputFile.close();
+            Prismatic::closeOutputFile(params);
         }
         // divide to take average
         for (auto &i : net_output)
@@ -780,121 +704,15 @@ void FullMultisliceCalcThread::run()
         gatekeeper.unlock();
     }
 
-    params.outputFile = H5::H5File(params.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
-
-    if (params.meta.save3DOutput)
-    {
-        PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-        Prismatic::setupVDOutput(params, params.output.get_diml(), dummy);
-
-        //create dummy array to pass to
-        Prismatic::Array3D<PRISMATIC_FLOAT_PRECISION> slice_image;
-        slice_image = Prismatic::zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{params.output.get_dimj(), params.output.get_dimk(), params.output.get_dimi()}});
-
-        for (auto j = 0; j < params.output.get_diml(); j++)
-        {
-            std::stringstream nameString;
-            nameString << "4DSTEM_simulation/data/realslices/virtual_detector_depth" << Prismatic::getDigitString(j);
-            H5::Group dataGroup = params.outputFile.openGroup(nameString.str());
-            hsize_t mdims[3] = {params.xp.size(), params.yp.size(), params.Ndet};
-
-            std::string dataSetName = "realslice";
-            H5::DataSet VD_data = dataGroup.openDataSet(dataSetName);
-            for (auto b = 0; b < params.output.get_dimi(); ++b)
-            {
-                for (auto y = 0; y < params.output.get_dimk(); ++y)
-                {
-                    for (auto x = 0; x < params.output.get_dimj(); ++x)
-                    {
-                        slice_image.at(x, y, b) = params.output.at(j, y, x, b);
-                    }
-                }
-            }
-            Prismatic::writeDatacube3D(VD_data, &slice_image[0], mdims);
-            VD_data.close();
-            dataGroup.close();
-        }
-    }
-
-    if (params.meta.save2DOutput)
-    {
-        size_t lower = std::max((size_t)0, (size_t)(params.meta.integrationAngleMin / params.meta.detectorAngleStep));
-        size_t upper = std::min(params.detectorAngles.size(), (size_t)(params.meta.integrationAngleMax / params.meta.detectorAngleStep));
-        Prismatic::Array2D<PRISMATIC_FLOAT_PRECISION> prism_image;
-        //std::string image_filename = std::string("multislice_2Doutput")+params.meta.filenameOutput;
-        PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-        Prismatic::setup2DOutput(params, params.output.get_diml(), dummy);
-
-        for (auto j = 0; j < params.output.get_diml(); j++)
-        {
-            //need to initiliaze output image at each slice to prevent overflow of value
-            prism_image = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-                {{params.output.get_dimj(), params.output.get_dimk()}});
+    Prismatic::reopenOutputFile(params, params.outputWriter);
+    Prismatic::writeDatacubeAccumulator(params);
 
-            for (auto y = 0; y < params.output.get_dimk(); ++y)
-            {
-                for (auto x = 0; x < params.output.get_dimj(); ++x)
-                {
-                    for (auto b = lower; b < upper; ++b)
-                    {
-                        prism_image.at(x, y) += params.output.at(j, y, x, b);
-                    }
-                }
-            }
-            //if (params.meta.numSlices != 0){
-            //	image_filename = params.meta.outputFolder +  (std::string("multislice_2Doutput_slice") + std::to_string(j) + std::string("_")) + params.meta.filenameOutput;
-            //}
-            //prism_image.toMRC_f(image_filename.c_str());
-            std::stringstream nameString;
-            nameString << "4DSTEM_simulation/data/realslices/annular_detector_depth" << Prismatic::getDigitString(j);
-            H5::Group dataGroup = params.outputFile.openGroup(nameString.str());
-            H5::DataSet AD_data = dataGroup.openDataSet("realslice");
-            hsize_t mdims[2] = {params.xp.size(), params.yp.size()};
-
-            Prismatic::writeRealSlice(AD_data, &prism_image[0], mdims);
-            AD_data.close();
-            dataGroup.close();
-        }
-    }
-
-    if (params.meta.saveDPC_CoM)
-    {
-        PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-        Prismatic::setupDPCOutput(params, params.output.get_diml(), dummy);
-
-        //create dummy array to pass to
-        Prismatic::Array3D<PRISMATIC_FLOAT_PRECISION> DPC_slice;
-        DPC_slice = Prismatic::zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{params.DPC_CoM.get_dimj(), params.DPC_CoM.get_dimk(), 2}});
-
-        for (auto j = 0; j < params.output.get_diml(); j++)
-        {
-            std::stringstream nameString;
-            nameString << "4DSTEM_simulation/data/realslices/DPC_CoM_depth" << Prismatic::getDigitString(j);
-            H5::Group dataGroup = params.outputFile.openGroup(nameString.str());
-            hsize_t mdims[3] = {params.xp.size(), params.yp.size(), 2};
-            std::string dataSetName = "realslice";
-            H5::DataSet DPC_data = dataGroup.openDataSet(dataSetName);
-
-            for (auto b = 0; b < params.DPC_CoM.get_dimi(); ++b)
-            {
-                for (auto y = 0; y < params.DPC_CoM.get_dimk(); ++y)
-                {
-                    for (auto x = 0; x < params.DPC_CoM.get_dimj(); ++x)
-                    {
-                        DPC_slice.at(x, y, b) = params.DPC_CoM.at(j, y, x, b);
-                    }
-                }
-            }
-
-            Prismatic::writeDatacube3D(DPC_data, &DPC_slice[0], mdims);
-            DPC_data.close();
-            dataGroup.close();
-        }
-    }
+    Prismatic::setupRealSliceOutput(params);
+    Prismatic::writeRealSliceOutput(params);
 
     PRISMATIC_FLOAT_PRECISION dummy = 1.0;
     Prismatic::writeMetadata(params, dummy);
-    params.outputFile.close();
+    params.outputWriter->close();
 
     this->parent->outputReceived(params.output);
     emit outputCalculated();
@@ -28,6 +28,16 @@ SOURCES += main.cpp\
         prism_qthreads.cpp \
     ../src/configure.cpp \
     ../src/WorkDispatcher.cpp \
+    ../src/memoryPlacement.cpp \
+    ../src/datacubeWriter.cpp \
+    ../src/datacubeAccumulator.cpp \
+    ../src/outputWriter.cpp \
+    ../src/outputStreamer.cpp \
+    ../src/datacubeEncoding.cpp \
+    ../src/datacubeMask.cpp \
+    ../src/datacubeStore.cpp \
+    ../src/datacubeMap.cpp \
+    ../src/mappedStorage.cpp \
     ../src/Multislice_entry.cpp \
     ../src/Multislice_calcOutput.cpp \
     ../src/PRISM_entry.cpp \
@@ -22,8 +22,128 @@
 #include <fstream>
 #include <cstring>
 #include <complex>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#ifdef _WIN32
+#include <malloc.h>
+#endif //_WIN32
+
+// alignment of aligned_vector storage -- one cache line, which also satisfies the widest SIMD loads FFTW uses
+#define PRISMATIC_ARRAY_ALIGNMENT 64
+
 namespace Prismatic
 {
+template <class T, size_t Alignment = PRISMATIC_ARRAY_ALIGNMENT>
+class AlignedAllocator
+{
+	// allocator for std::vector that returns Alignment-byte aligned storage. Growing the vector without
+	// a fill value leaves trivially copyable elements (float, double, std::complex) uninitialized, which
+	// avoids a memset pass over buffers that are about to be overwritten anyway
+public:
+	typedef T value_type;
+	template <class U>
+	struct rebind
+	{
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+	AlignedAllocator() noexcept {}
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+	T *allocate(const size_t n)
+	{
+		if (n == 0)
+			return nullptr;
+		void *ptr = nullptr;
+#ifdef _WIN32
+		ptr = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+		if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0)
+			ptr = nullptr;
+#endif //_WIN32
+		if (ptr == nullptr)
+			throw std::bad_alloc();
+		return static_cast<T *>(ptr);
+	}
+	void deallocate(T *ptr, const size_t) noexcept
+	{
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif //_WIN32
+	}
+
+	template <class U>
+	void construct(U *ptr)
+	{
+		default_construct(ptr, std::integral_constant<bool, std::is_trivially_copyable<U>::value &&
+																 std::is_trivially_destructible<U>::value>());
+	}
+	template <class U, class... Args>
+	void construct(U *ptr, Args &&... args) { ::new ((void *)ptr) U(std::forward<Args>(args)...); }
+
+private:
+	template <class U>
+	void default_construct(U *, std::true_type) {}
+	template <class U>
+	void default_construct(U *ptr, std::false_type) { ::new ((void *)ptr) U(); }
+};
+
+template <class T, class U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) { return true; }
+template <class T, class U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) { return false; }
+
+template <class T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+template <size_t N, class T>
+class ArrayView
+{
+	// non-owning view of contiguous, C-ordered data, e.g. a whole ArrayND, one probe of a batched stack,
+	// or one beam of the compact S-matrix. T is the element type and may be const. The view is only
+	// valid while the underlying storage is alive and not resized
+public:
+	ArrayView(T *_data, std::array<size_t, N> _dims) : data(_data), dims(_dims)
+	{
+		size_t stride = 1;
+		for (auto i = (N - 1); i > 0; --i)
+		{
+			stride *= this->dims[i];
+			this->strides[i - 1] = stride;
+		}
+		this->arr_size = (N > 0) ? stride * this->dims[0] : 0;
+	}
+	template <class U>
+	ArrayView(const ArrayView<N, U> &other) : data(other.begin()), dims(other.get_dims()), strides(other.get_strides()), arr_size(other.size()) {}
+
+	size_t get_dimi() const { return this->dims[N - 1]; }
+	size_t get_dimj() const { return this->dims[N - 2]; }
+	size_t get_dimk() const { return this->dims[N - 3]; }
+	size_t get_diml() const { return this->dims[N - 4]; }
+	const std::array<size_t, N> &get_dims() const { return this->dims; }
+	const std::array<size_t, N - 1> &get_strides() const { return this->strides; }
+	size_t size() const { return this->arr_size; }
+	T *begin() const { return this->data; }
+	T *end() const { return this->data + this->arr_size; }
+	T &operator[](const size_t &i) const { return data[i]; }
+	T &at(const size_t &i) const { return data[i]; }
+	T &at(const size_t &j, const size_t &i) const { return data[j * strides[0] + i]; }
+	T &at(const size_t &k, const size_t &j, const size_t &i) const { return data[k * strides[0] + j * strides[1] + i]; }
+	T &at(const size_t &l, const size_t &k, const size_t &j, const size_t &i) const
+	{
+		return data[l * strides[0] + k * strides[1] + j * strides[2] + i];
+	}
+
+private:
+	T *data;
+	std::array<size_t, N> dims;
+	std::array<size_t, N - 1> strides;
+	size_t arr_size;
+};
+
 template <size_t N, class T>
 class ArrayND
 {
@@ -56,31 +176,49 @@ public:
 
 	typename T::value_type &operator[](const size_t &i);
 	typename T::value_type operator[](const size_t &i) const;
-	ArrayND<N, T> operator-(const ArrayND<N, T> &other);
-	ArrayND<N, T> operator+(const ArrayND<N, T> &other);
-	ArrayND<N, T> operator*(const ArrayND<N, T> &other);
-	ArrayND<N, T> operator/(const ArrayND<N, T> &other);
-	ArrayND<N, T> operator-(const typename T::value_type &val);
-	ArrayND<N, T> operator+(const typename T::value_type &val);
-	ArrayND<N, T> operator*(const typename T::value_type &val);
-	ArrayND<N, T> operator/(const typename T::value_type &val);
-	ArrayND<N, T> operator-(const ArrayND<N, T> &other) const;
-	ArrayND<N, T> operator+(const ArrayND<N, T> &other) const;
-	ArrayND<N, T> operator*(const ArrayND<N, T> &other) const;
-	ArrayND<N, T> operator/(const ArrayND<N, T> &other) const;
+
+	// views of the whole array, see ArrayView
+	ArrayView<N, typename T::value_type> view() { return ArrayView<N, typename T::value_type>(data.data(), dims); }
+	ArrayView<N, const typename T::value_type> view() const { return ArrayView<N, const typename T::value_type>(data.data(), dims); }
+
+	// the rvalue overloads operate on and return the storage of the temporary, so that chained
+	// expressions such as (a - b) * c only allocate once
+	ArrayND<N, T> operator-(const ArrayND<N, T> &other) const &;
+	ArrayND<N, T> operator+(const ArrayND<N, T> &other) const &;
+	ArrayND<N, T> operator*(const ArrayND<N, T> &other) const &;
+	ArrayND<N, T> operator/(const ArrayND<N, T> &other) const &;
+	ArrayND<N, T> operator-(const ArrayND<N, T> &other) &&;
+	ArrayND<N, T> operator+(const ArrayND<N, T> &other) &&;
+	ArrayND<N, T> operator*(const ArrayND<N, T> &other) &&;
+	ArrayND<N, T> operator/(const ArrayND<N, T> &other) &&;
 	ArrayND<N, T> &operator-=(const ArrayND<N, T> &other);
 	ArrayND<N, T> &operator+=(const ArrayND<N, T> &other);
 	ArrayND<N, T> &operator*=(const ArrayND<N, T> &other);
 	ArrayND<N, T> &operator/=(const ArrayND<N, T> &other);
-	ArrayND<N, T> operator-(const typename T::value_type &val) const;
-	ArrayND<N, T> operator+(const typename T::value_type &val) const;
-	ArrayND<N, T> operator*(const typename T::value_type &val) const;
-	ArrayND<N, T> operator/(const typename T::value_type &val) const;
+	ArrayND<N, T> operator-(const typename T::value_type &val) const &;
+	ArrayND<N, T> operator+(const typename T::value_type &val) const &;
+	ArrayND<N, T> operator*(const typename T::value_type &val) const &;
+	ArrayND<N, T> operator/(const typename T::value_type &val) const &;
+	ArrayND<N, T> operator-(const typename T::value_type &val) &&;
+	ArrayND<N, T> operator+(const typename T::value_type &val) &&;
+	ArrayND<N, T> operator*(const typename T::value_type &val) &&;
+	ArrayND<N, T> operator/(const typename T::value_type &val) &&;
 	ArrayND<N, T> &operator-=(const typename T::value_type &val);
 	ArrayND<N, T> &operator+=(const typename T::value_type &val);
 	ArrayND<N, T> &operator*=(const typename T::value_type &val);
 	ArrayND<N, T> &operator/=(const typename T::value_type &val);
 
+	// Fused elementwise evaluation. Chains of the operators above materialize one temporary per
+	// operator, so e.g. (alpha + step / 2) / step is better written as
+	//     alpha.transform_fused([&](const value_type &a) { return (a + step / 2) / step; })
+	// which makes a single pass over the data in a loop the compiler can vectorize
+	template <class F>
+	ArrayND<N, T> transform_fused(F f) const;
+	template <class F>
+	ArrayND<N, T> transform_fused(const ArrayND<N, T> &other, F f) const;
+	template <class F>
+	ArrayND<N, T> &apply_fused(F f);
+
 	inline void toMRC_f(const char *filename) const;
 
 private:
@@ -92,12 +230,12 @@ private:
 
 template <size_t N, class T>
 ArrayND<N, T>::ArrayND(T _data,
-					   std::array<size_t, N> _dims) : data(_data)
+					   std::array<size_t, N> _dims) : data(std::move(_data))
 {
 	size_t _size = 1;
 	for (auto &i : _dims)
 		_size *= i;
-	if (_data.size() != _size)
+	if (this->data.size() != _size)
 	{
 		throw std::domain_error("PRISM: Size mismatch! Desired array size does not match size of input data\n");
 	}
@@ -179,155 +317,131 @@ template <size_t N, class T>
 typename T::value_type ArrayND<N, T>::operator[](const size_t &i) const { return data[i]; }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator-(const ArrayND<N, T> &other)
+ArrayND<N, T> ArrayND<N, T>::operator-(const ArrayND<N, T> &other) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
-	for (auto &i : result)
-		i -= *o++;
+	result -= other;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator+(const ArrayND<N, T> &other)
+ArrayND<N, T> ArrayND<N, T>::operator+(const ArrayND<N, T> &other) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
-	for (auto &i : result)
-		i += *o++;
+	result += other;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator*(const ArrayND<N, T> &other)
+ArrayND<N, T> ArrayND<N, T>::operator*(const ArrayND<N, T> &other) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
-	for (auto &i : result)
-		i *= *o++;
+	result *= other;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator/(const ArrayND<N, T> &other)
+ArrayND<N, T> ArrayND<N, T>::operator/(const ArrayND<N, T> &other) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
-	for (auto &i : result)
-		i /= *o++;
+	result /= other;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator-(const typename T::value_type &val)
+ArrayND<N, T> ArrayND<N, T>::operator-(const ArrayND<N, T> &other) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
-		i -= val;
-	return result;
+	(*this) -= other;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator+(const typename T::value_type &val)
+ArrayND<N, T> ArrayND<N, T>::operator+(const ArrayND<N, T> &other) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
-		i += val;
-	return result;
+	(*this) += other;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator*(const typename T::value_type &val)
+ArrayND<N, T> ArrayND<N, T>::operator*(const ArrayND<N, T> &other) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
-		i *= val;
-	return result;
+	(*this) *= other;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator/(const typename T::value_type &val)
+ArrayND<N, T> ArrayND<N, T>::operator/(const ArrayND<N, T> &other) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
-		i /= val;
-	return result;
+	(*this) /= other;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator-(const ArrayND<N, T> &other) const
+ArrayND<N, T> ArrayND<N, T>::operator-(const typename T::value_type &val) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
 	for (auto &i : result)
-		i -= *o++;
+		i -= val;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator+(const ArrayND<N, T> &other) const
+ArrayND<N, T> ArrayND<N, T>::operator+(const typename T::value_type &val) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
 	for (auto &i : result)
-		i += *o++;
+		i += val;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator*(const ArrayND<N, T> &other) const
+ArrayND<N, T> ArrayND<N, T>::operator*(const typename T::value_type &val) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
 	for (auto &i : result)
-		i *= *o++;
+		i *= val;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator/(const ArrayND<N, T> &other) const
+ArrayND<N, T> ArrayND<N, T>::operator/(const typename T::value_type &val) const &
 {
 	ArrayND<N, T> result(*this);
-	typename T::value_type *o = other.begin();
 	for (auto &i : result)
-		i /= *o++;
+		i /= val;
 	return result;
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator-(const typename T::value_type &val) const
+ArrayND<N, T> ArrayND<N, T>::operator-(const typename T::value_type &val) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
+	for (auto &i : (*this))
 		i -= val;
-	return result;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator+(const typename T::value_type &val) const
+ArrayND<N, T> ArrayND<N, T>::operator+(const typename T::value_type &val) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
+	for (auto &i : (*this))
 		i += val;
-	return result;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator*(const typename T::value_type &val) const
+ArrayND<N, T> ArrayND<N, T>::operator*(const typename T::value_type &val) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
+	for (auto &i : (*this))
 		i *= val;
-	return result;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
-ArrayND<N, T> ArrayND<N, T>::operator/(const typename T::value_type &val) const
+ArrayND<N, T> ArrayND<N, T>::operator/(const typename T::value_type &val) &&
 {
-	ArrayND<N, T> result(*this);
-	for (auto &i : result)
+	for (auto &i : (*this))
 		i /= val;
-	return result;
+	return std::move(*this);
 }
 
 template <size_t N, class T>
@@ -398,6 +512,41 @@ ArrayND<N, T> &ArrayND<N, T>::operator/=(const ArrayND<N, T> &other)
 	return *this;
 }
 
+template <size_t N, class T>
+template <class F>
+ArrayND<N, T> ArrayND<N, T>::transform_fused(F f) const
+{
+	ArrayND<N, T> result(T(this->arr_size), this->dims);
+	const typename T::value_type *in = this->data.data();
+	typename T::value_type *out = result.data.data();
+	for (size_t i = 0; i < this->arr_size; ++i)
+		out[i] = f(in[i]);
+	return result;
+}
+
+template <size_t N, class T>
+template <class F>
+ArrayND<N, T> ArrayND<N, T>::transform_fused(const ArrayND<N, T> &other, F f) const
+{
+	ArrayND<N, T> result(T(this->arr_size), this->dims);
+	const typename T::value_type *in1 = this->data.data();
+	const typename T::value_type *in2 = other.data.data();
+	typename T::value_type *out = result.data.data();
+	for (size_t i = 0; i < this->arr_size; ++i)
+		out[i] = f(in1[i], in2[i]);
+	return result;
+}
+
+template <size_t N, class T>
+template <class F>
+ArrayND<N, T> &ArrayND<N, T>::apply_fused(F f)
+{
+	typename T::value_type *d = this->data.data();
+	for (size_t i = 0; i < this->arr_size; ++i)
+		d[i] = f(d[i]);
+	return *this;
+}
+
 template <size_t N, class T>
 Prismatic::ArrayND<N, std::vector<T>> ones_ND(const std::array<size_t, N> dims)
 {
@@ -416,6 +565,25 @@ Prismatic::ArrayND<N, std::vector<T>> zeros_ND(const std::array<size_t, N> dims)
 	return Prismatic::ArrayND<N, std::vector<T>>(std::vector<T>(size, 0), dims);
 }
 
+template <size_t N, class T>
+Prismatic::ArrayND<N, aligned_vector<T>> zeros_aligned_ND(const std::array<size_t, N> dims)
+{
+	size_t size = 1;
+	for (auto &i : dims)
+		size *= i;
+	return Prismatic::ArrayND<N, aligned_vector<T>>(aligned_vector<T>(size, 0), dims);
+}
+
+template <size_t N, class T>
+Prismatic::ArrayND<N, aligned_vector<T>> uninitialized_ND(const std::array<size_t, N> dims)
+{
+	// aligned array whose contents are indeterminate -- only for buffers that are fully written before being read
+	size_t size = 1;
+	for (auto &i : dims)
+		size *= i;
+	return Prismatic::ArrayND<N, aligned_vector<T>>(aligned_vector<T>(size), dims);
+}
+
 template <class T>
 using Array2D_T = Prismatic::ArrayND<2, std::vector<T>>;
 template <class T>
@@ -32,10 +32,14 @@ namespace Prismatic
 using namespace std;
 void setupCoordinates_multislice(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+void setupPropagator_multislice(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 void setupDetector_multislice(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void setupProbes_multislice(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+void setupProbeConditions_multislice(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 void createTransmission(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void createStack(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
@@ -48,7 +52,7 @@ void formatOutput_CPU_integrate(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 								const size_t ax);
 
 void formatOutput_CPU_integrate_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
-									  Array1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack,
+									  AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack,
 									  const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
 									  const size_t currentSlice,
 									  const size_t ay,
@@ -61,7 +65,7 @@ void getMultisliceProbe_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 								  const size_t Nstop,
 								  PRISMATIC_FFTW_PLAN &plan_forward,
 								  PRISMATIC_FFTW_PLAN &plan_inverse,
-								  Array1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack);
+								  AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack);
 void getMultisliceProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 							const size_t ay,
 							const size_t ax,
@@ -48,5 +48,8 @@ void generateProjectedPotentials(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 //#else
 void PRISM01_calcPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 //#endif //PRISMATIC_ENABLE_GPU
+
+// releases the potentials kept for the runs of an energy series
+void clearPotentialCache();
 } // namespace Prismatic
 #endif //PRISMATIC_PRISM01_H
@@ -20,12 +20,28 @@
 #include "configure.h"
 #include "defines.h"
 
+// beams per block of the out-of-core S-matrix file. Each block is stored [y][x][beam in block], so the beams of a
+// pixel are contiguous for PRISM03 while a batch of beams is still written to a compact region of the file
+#define PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK 32
+
 namespace Prismatic {
 	inline void setupCoordinates(Parameters<PRISMATIC_FLOAT_PRECISION>& pars);
 	inline void setupBeams(Parameters<PRISMATIC_FLOAT_PRECISION>& pars);
 	inline void setupSMatrixCoordinates(Parameters<PRISMATIC_FLOAT_PRECISION>& pars);
 	inline void downsampleFourierComponents(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+	void allocateScompact(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+	std::complex<PRISMATIC_FLOAT_PRECISION> getScompact(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+	                                                    const size_t beam, const size_t y, const size_t x);
+
+	void storeScompactBeam(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+	                       const size_t currentBeam,
+	                       AlignedArray2D<std::complex<PRISMATIC_FLOAT_PRECISION> > &psi_small,
+	                       const PRISMATIC_FLOAT_PRECISION N_small);
+
+	void reportScompactPrecision(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 	void propagatePlaneWave_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	                            size_t currentBeam,
 	                            Array2D<std::complex<PRISMATIC_FLOAT_PRECISION> > &psi,
@@ -36,7 +52,7 @@ namespace Prismatic {
 	void propagatePlaneWave_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	                                  size_t currentBeam,
 	                                  size_t stopBeam,
-	                                  Array1D<std::complex<PRISMATIC_FLOAT_PRECISION> > &psi_stack,
+	                                  AlignedArray1D<std::complex<PRISMATIC_FLOAT_PRECISION> > &psi_stack,
 	                                  const PRISMATIC_FFTW_PLAN &plan_forward,
 	                                  const PRISMATIC_FFTW_PLAN &plan_inverse,
 	                                  std::mutex &fftw_plan_lock);
@@ -45,5 +61,10 @@ namespace Prismatic {
 
 	void PRISM02_calcSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION>& pars);
 
+	// HDF5 storage of the compact S-matrix, so that it can be reused by later runs with different probes or detectors
+	void saveSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+	void loadSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 }
 #endif //PRISMATIC_PRISM02_H
@@ -23,6 +23,10 @@
 #include "fftw3.h"
 #include "utility.h"
 
+// size in bytes of the tile of beam coefficients that buildSignal_CPU_batch keeps in cache while it
+// streams the pixels of a window. Groups with more coefficients are reduced in several passes over beam tiles
+#define PRISMATIC_PRISM03_BEAM_TILE_BYTES 32768
+
 namespace Prismatic
 {
 Array2D<PRISMATIC_FLOAT_PRECISION> array2D_subset(const Array2D<PRISMATIC_FLOAT_PRECISION> &arr,
@@ -36,13 +40,31 @@ void createStack_integrate(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 void setupFourierCoordinates(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 void transformIndices(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 void initializeProbes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+void initializeProbeConditions(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+void setupActiveBeams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 std::pair<Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>, Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>>
 getSinglePRISMProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION xp, const PRISMATIC_FLOAT_PRECISION yp);
 void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 					 const size_t &ay,
 					 const size_t &ax,
 					 PRISMATIC_FFTW_PLAN &plan,
-					 Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi);
+					 AlignedArray2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi);
+
+// binnedOutput is scratch space of pars.Ndet values, kept by the caller across probes
+void formatSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					  const size_t &ay,
+					  const size_t &ax,
+					  const size_t condition,
+					  const ArrayView<2, const std::complex<PRISMATIC_FLOAT_PRECISION>> &psi,
+					  std::vector<PRISMATIC_FLOAT_PRECISION> &binnedOutput);
+
+void permuteScompact(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+void buildSignal_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const size_t Nstart,
+						   const size_t Nstop,
+						   PRISMATIC_FFTW_PLAN &plan,
+						   AlignedArray1D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack);
 
 void buildPRISMOutput_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
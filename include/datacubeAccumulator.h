@@ -0,0 +1,77 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+// Sums the 4D output of all frozen phonon configurations in memory, or in memory-mapped scratch files when
+// it does not fit, so that each datacube is written to the output file once instead of being read back and
+// rewritten for every probe of every configuration.
+
+#ifndef PRISMATIC_DATACUBEACCUMULATOR_H
+#define PRISMATIC_DATACUBEACCUMULATOR_H
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "defines.h"
+#include "mappedStorage.h"
+#include "datacubeEncoding.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+class DatacubeAccumulator
+{
+  public:
+	// datacubes are kept in memory while their total size stays within memoryBytes, the rest are
+	// placed in scratch files whose names start with scratchPrefix
+	DatacubeAccumulator(const size_t memoryBytes, const std::string &scratchPrefix);
+	DatacubeAccumulator(const DatacubeAccumulator &) = delete;
+	DatacubeAccumulator &operator=(const DatacubeAccumulator &) = delete;
+
+	// same arguments as writeDatacube4D, file is only read to size the datacube on its first frame.
+	// Frames of different probes can be added concurrently
+	void add(H5::H5File file, const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP);
+	void add(H5::H5File file, const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP);
+
+	// writes every datacube to file and releases it. Full precision datacubes are written with a single
+	// write, encoded ones one scan row at a time
+	void write(H5::H5File file, const DatacubeEncoding &encoding);
+
+  private:
+	struct Datacube
+	{
+		hsize_t dims[4];
+		std::vector<PRISMATIC_FLOAT_PRECISION> data;
+		std::unique_ptr<MappedFile> mapped;
+		PRISMATIC_FLOAT_PRECISION *ptr; // [ax][ay][qx][qy], in data or mapped
+	};
+
+	template <class T>
+	void accumulate(H5::H5File &file, const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP);
+	Datacube &getDatacube(H5::H5File &file, const std::string &name);
+
+	const size_t memoryBytes;
+	const std::string scratchPrefix;
+	size_t usedMemory;
+	std::map<std::string, std::unique_ptr<Datacube>> datacubes;
+	std::mutex lock;
+};
+
+// memory available for the in-memory accumulation of the 4D output, half of the physical memory
+size_t getAccumulatorMemoryLimit();
+
+} // namespace Prismatic
+#endif //PRISMATIC_DATACUBEACCUMULATOR_H
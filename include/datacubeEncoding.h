@@ -0,0 +1,100 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+// Storage formats of the 4D datacubes. Besides full precision, each frame can be stored as IEEE binary16 or
+// quantized to unsigned 16 or 8 bit integers, like the counts of a real detector. A stored value v decodes as
+// v * scale + offset. The scale and offset either belong to each frame and are kept in the frame_scale and
+// frame_offset datasets [rx][ry] next to the datacube, or are fixed for the whole datacube (--4D-scale) and
+// kept as its scale and offset attributes. Frames are only encoded when they are written for the last time,
+// so frozen phonon sums are never requantized.
+
+#ifndef PRISMATIC_DATACUBEENCODING_H
+#define PRISMATIC_DATACUBEENCODING_H
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include "meta.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+struct DatacubeHandles
+{
+	H5::DataSet datacube;
+	H5::DataSet frameScale; // per-frame quantization only
+	H5::DataSet frameOffset;
+};
+
+class DatacubeEncoding
+{
+  public:
+	explicit DatacubeEncoding(const Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+	bool isFullPrecision() const { return type == DatacubeType::Float; }
+	bool hasFrameScales() const { return (!isFullPrecision()) & (scale == 0); }
+
+	// type of the datacube elements in the file
+	H5::DataType getFileType() const;
+
+	// creates the frame scale datasets or the global scale attributes of a freshly created datacube
+	void setup(H5::Group &group, H5::DataSet &datacube, const hsize_t *scanDims) const;
+
+	// opens the datacube in group name, and its frame scales if there are any
+	DatacubeHandles open(H5::H5File &file, const std::string &name, const H5::DSetAccPropList &dapl = H5::DSetAccPropList::DEFAULT) const;
+
+	// writes the frames of the hyperslab count at offset, data is laid out like the datacube
+	void write(DatacubeHandles &handles, const hsize_t *count, const hsize_t *offset, const float *data) const;
+	void write(DatacubeHandles &handles, const hsize_t *count, const hsize_t *offset, const double *data) const;
+
+  private:
+	template <class T>
+	void encodeAndWrite(DatacubeHandles &handles, const hsize_t *count, const hsize_t *offset, const T *data, const H5::PredType &nativeType) const;
+
+	DatacubeType type;
+	PRISMATIC_FLOAT_PRECISION scale; // global scale, 0 for a scale per frame
+};
+
+// name of a datacube relative to the root of the file, the GPU codes pass absolute paths
+inline std::string getDatacubeName(const std::string &nameString)
+{
+	return nameString.substr(std::min(nameString.size(), nameString.find_first_not_of('/')));
+}
+
+// byte order character of the numpy type strings of the stored arrays, '<' or '>'
+inline char getByteOrderChar()
+{
+	const uint16_t one = 1;
+	return (*(const char *)&one == 1) ? '<' : '>';
+}
+
+// restrides a frame handed to writeDatacube4D, of mdims[2] x mdims[3] values, so that qx and qy are flipped as in
+// the stored datacubes and divides it by numFP. The result is written to out, or added to it with accumulate
+template <class T, class U>
+void restrideFrame(const T *buffer, const hsize_t *mdims, const T numFP, U *out, const bool accumulate = false)
+{
+	for (auto i = 0; i < mdims[2]; i++)
+	{
+		for (auto j = 0; j < mdims[3]; j++)
+		{
+			if (accumulate)
+				out[i * mdims[3] + j] += buffer[j * mdims[2] + i] / numFP;
+			else
+				out[i * mdims[3] + j] = buffer[j * mdims[2] + i] / numFP;
+		}
+	}
+}
+
+} // namespace Prismatic
+#endif //PRISMATIC_DATACUBEENCODING_H
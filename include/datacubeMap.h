@@ -0,0 +1,70 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+
+// NumPy output for the 4D datacubes (--4D-format npy). Every datacube goes to its own .npy file next to the HDF5
+// output, named after the output file and the datacube group. The file is created at full size when the output is
+// set up and stays mapped into memory for the whole run. The compute threads copy their frames straight to the
+// offset of their scan position. No lock is needed, since each position is written by exactly one thread per pass.
+// The frozen phonon passes add to the mapped frames in place. The frames are stored as the threads hand them over,
+// with qy before qx, so the array has the shape (rx, ry, qy, qx) and saves the restride done for the HDF5 datacube.
+// Use .transpose(0, 1, 3, 2) in numpy to get the HDF5 layout. The HDF5 output still holds everything else.
+
+#ifndef PRISMATIC_DATACUBEMAP_H
+#define PRISMATIC_DATACUBEMAP_H
+#include <map>
+#include <memory>
+#include <string>
+#include "defines.h"
+#include "mappedStorage.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+class DatacubeMap
+{
+  public:
+	// the arrays are written to basename_<group>.npy
+	DatacubeMap(const std::string &basename);
+
+	// creates and maps the zero-filled array for the datacube in group name, with dims [rx][ry][qx][qy].
+	// Throws std::runtime_error on failure
+	void create(const std::string &name, const hsize_t *dims);
+
+	// writes one diffraction pattern like OutputWriter::writeDatacube4D, accumulate adds it to the stored frame.
+	// Throws std::runtime_error if the array is missing or the frame does not fit it
+	void writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP, const bool accumulate) const;
+	void writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP, const bool accumulate) const;
+
+	// name of the file holding the datacube in group name
+	std::string getFilename(const std::string &name) const;
+
+  private:
+	struct Array
+	{
+		std::unique_ptr<MappedFile> mapped;
+		PRISMATIC_FLOAT_PRECISION *data;
+		hsize_t dims[4];
+	};
+
+	template <class T>
+	void writeFrame(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP, const bool accumulate) const;
+
+	std::string basename;
+	std::map<std::string, Array> arrays; // only changed while the output is set up, before any frame is written
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_DATACUBEMAP_H
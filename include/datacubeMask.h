@@ -0,0 +1,62 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+
+// Detector mask of the sparse 4D output. Only the pixels inside a set of annuli (--4D-mask-annuli) or selected
+// by a mask file (--4D-mask-file) are stored, so each frame of the datacube becomes a 1 x nnz row of values.
+// The mask is the same for every frame, and its CSR index is saved next to the datacube: row qx of a pattern
+// holds the values mask_indptr[qx] to mask_indptr[qx + 1] of the row, at the qy columns in mask_indices.
+// Everything outside of the mask reconstructs as zero.
+
+#ifndef PRISMATIC_DATACUBEMASK_H
+#define PRISMATIC_DATACUBEMASK_H
+#include <vector>
+#include <cstdint>
+#include "meta.h"
+#include "ArrayND.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+class DatacubeMask
+{
+  public:
+	// builds the mask for frames whose rows and columns have the spatial frequencies qx and qy (in 1/Angstroms),
+	// throws a runtime_error if the mask file cannot be read or nothing is selected
+	DatacubeMask(const Metadata<PRISMATIC_FLOAT_PRECISION> &meta, const ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> &qx,
+				 const ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> &qy, const PRISMATIC_FLOAT_PRECISION lambda);
+
+	// number of stored pixels per frame
+	size_t size() const { return sources.size(); }
+
+	// copies the masked pixels of a frame, laid out like the buffers passed to writeDatacube4D (qx fastest)
+	template <class T>
+	void gather(const T *frame, T *masked) const
+	{
+		for (auto k = 0; k < sources.size(); ++k)
+			masked[k] = frame[sources[k]];
+	}
+
+	// writes the mask_indptr and mask_indices datasets to group
+	void write(H5::Group &group) const;
+
+  private:
+	std::vector<uint64_t> indptr;  // nqx + 1
+	std::vector<uint64_t> indices; // qy of each stored pixel
+	std::vector<size_t> sources;   // position of each stored pixel in a frame buffer
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_DATACUBEMASK_H
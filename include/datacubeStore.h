@@ -0,0 +1,62 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+
+// Directory store for the 4D output (--4D-format zarr), laid out like an uncompressed Zarr v2 group. Every datacube
+// is an array directory named after its HDF5 group, with a .zarray manifest and one file per chunk of
+// chunk4DX x chunk4DY scan positions. Frames are written straight into their chunk file with pwrite, so the compute
+// threads write in parallel without write4D_lock or a writer thread. Within a pass every scan position is written by
+// exactly one thread, so the later frozen phonon passes can add to the stored frames without locking either.
+// The HDF5 output still holds everything else, including the dimensions of the datacubes, and
+// prismatic-convert-store copies the arrays into it to produce the usual EMD layout.
+
+#ifndef PRISMATIC_DATACUBESTORE_H
+#define PRISMATIC_DATACUBESTORE_H
+#include <string>
+#include "defines.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+class DatacubeStore
+{
+  public:
+	// store in directory root with chunks of chunkX x chunkY scan positions
+	DatacubeStore(const std::string &root, const size_t chunkX, const size_t chunkY);
+
+	// creates the empty array for the datacube in group name, with dims [rx][ry][qx][qy], replacing an older one
+	void create(const std::string &name, const hsize_t *dims) const;
+
+	// writes one diffraction pattern like OutputWriter::writeDatacube4D, accumulate adds it to the stored frame.
+	// Throws std::runtime_error on failure
+	void writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP, const bool accumulate) const;
+	void writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP, const bool accumulate) const;
+
+	// copies every array of the store at root into the datacube dataset of its group in the EMD file, returns the number of
+	// datacubes converted. Throws std::runtime_error on failure
+	static size_t convertToEMD(const std::string &root, H5::H5File &file);
+
+  private:
+	template <class T>
+	void writeFrame(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP, const bool accumulate) const;
+	std::string getArrayPath(const std::string &nameString) const;
+
+	std::string root;
+	size_t chunkX;
+	size_t chunkY;
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_DATACUBESTORE_H
@@ -0,0 +1,106 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+// Asynchronous writer for the 4D output. Compute threads hand their diffraction patterns to a bounded queue
+// instead of writing them under the global HDF5 lock, and a single I/O thread assembles them into bands of
+// whole scan rows that are written to the datacube with one hyperslab write each. Frozen phonon passes after
+// the first add their band to the values already in the file, so each band is read and written once per pass
+// rather than once per probe.
+
+#ifndef PRISMATIC_DATACUBEWRITER_H
+#define PRISMATIC_DATACUBEWRITER_H
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "defines.h"
+#include "datacubeEncoding.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+class DatacubeWriter
+{
+  public:
+	// accumulate adds the frames to the data already in the file. queueBytes bounds the memory of the frames
+	// waiting to be written and, separately, of the bands being assembled. A band holds at most a quarter of it.
+	// Complete bands are encoded by the I/O thread
+	DatacubeWriter(H5::H5File file, const DatacubeEncoding &encoding, const bool accumulate, const size_t queueBytes);
+	~DatacubeWriter();
+	DatacubeWriter(const DatacubeWriter &) = delete;
+	DatacubeWriter &operator=(const DatacubeWriter &) = delete;
+
+	// same arguments as writeDatacube4D. Blocks while the queue is full
+	void push(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP);
+	void push(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP);
+
+	// writes everything that is still queued or partially assembled and stops the I/O thread. Throws
+	// std::runtime_error if a write failed
+	void finish();
+
+  private:
+	struct Frame
+	{
+		std::string name;
+		hsize_t ax, ay;
+		hsize_t dimx, dimy;
+		std::vector<PRISMATIC_FLOAT_PRECISION> data; // already transposed and divided by numFP
+	};
+
+	struct Band
+	{
+		std::vector<PRISMATIC_FLOAT_PRECISION> data; // [ax][ay - firstRow][qx][qy]
+		std::vector<bool> received;
+		size_t numReceived;
+	};
+
+	struct Target
+	{
+		DatacubeHandles handles;
+		hsize_t dims[4];
+		hsize_t bandRows;
+		std::map<hsize_t, Band> bands; // by first row
+	};
+
+	template <class T>
+	void enqueue(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP);
+	void run();
+	void store(Frame &frame);
+	void writeBlock(Target &target, const hsize_t *count, const hsize_t *offset, PRISMATIC_FLOAT_PRECISION *data);
+	void writeBand(Target &target, const hsize_t firstRow, Band &band);
+	void flushFullestBand();
+
+	H5::H5File file;
+	const DatacubeEncoding encoding;
+	const bool accumulate;
+	const size_t queueBytes;
+	std::deque<Frame> queue;
+	size_t queuedBytes;
+	bool finished;
+	std::string error;
+	std::map<std::string, Target> targets;
+	size_t assembledBytes;
+	std::mutex lock;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::thread worker;
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_DATACUBEWRITER_H
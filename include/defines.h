@@ -109,6 +109,10 @@ typedef double PRISMATIC_FLOAT_PRECISION;
 #define PRISMATIC_FFTW_INIT_THREADS fftw_init_threads
 #define PRISMATIC_FFTW_PLAN_WITH_NTHREADS fftw_plan_with_nthreads
 #define PRISMATIC_FFTW_CLEANUP_THREADS fftw_cleanup_threads
+#define PRISMATIC_FFTW_IMPORT_WISDOM_FROM_FILENAME fftw_import_wisdom_from_filename
+#define PRISMATIC_FFTW_EXPORT_WISDOM_TO_FILENAME fftw_export_wisdom_to_filename
+#define PRISMATIC_FFTW_VERSION fftw_version
+#define PRISMATIC_FFTW_PRECISION_STRING "double"
 
 #else
 typedef float PRISMATIC_FLOAT_PRECISION;
@@ -122,6 +126,10 @@ typedef float PRISMATIC_FLOAT_PRECISION;
 #define PRISMATIC_FFTW_INIT_THREADS fftwf_init_threads
 #define PRISMATIC_FFTW_PLAN_WITH_NTHREADS fftwf_plan_with_nthreads
 #define PRISMATIC_FFTW_CLEANUP_THREADS fftwf_cleanup_threads
+#define PRISMATIC_FFTW_IMPORT_WISDOM_FROM_FILENAME fftwf_import_wisdom_from_filename
+#define PRISMATIC_FFTW_EXPORT_WISDOM_TO_FILENAME fftwf_export_wisdom_to_filename
+#define PRISMATIC_FFTW_VERSION fftwf_version
+#define PRISMATIC_FFTW_PRECISION_STRING "float"
 #endif //PRISMATIC_ENABLE_DOUBLE_PRECISION
 
 //#ifdef PRISMATIC_BUILDING_GUI
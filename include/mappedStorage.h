@@ -0,0 +1,45 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+// Scratch files mapped into memory, used to hold the compact S-matrix when it is larger than the available RAM.
+// The file is unlinked as soon as it is mapped, so it disappears when the mapping is released (or the process
+// dies) and the kernel pages its contents in and out as they are used. Output files mapped the same way are kept.
+
+#ifndef PRISMATIC_MAPPEDSTORAGE_H
+#define PRISMATIC_MAPPEDSTORAGE_H
+#include <cstddef>
+#include <string>
+
+namespace Prismatic
+{
+
+class MappedFile
+{
+  public:
+	// creates a zero-filled file of the given size and maps it read/write, a scratch file is removed once it is mapped.
+	// Throws std::runtime_error on failure
+	MappedFile(const std::string &filename, const size_t bytes, const bool scratch = true);
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	void *data() { return ptr; }
+	size_t size() const { return bytes; }
+
+  private:
+	void *ptr;
+	size_t bytes;
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_MAPPEDSTORAGE_H
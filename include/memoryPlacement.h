@@ -0,0 +1,43 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+// Page placement and thread affinity helpers for the large shared arrays (pot, transmission, Scompact).
+// On multi-socket machines the zero-filling in zeros_ND touches every page from a single thread, so
+// all of the memory ends up on one NUMA node. These routines redistribute the pages of a freshly
+// zeroed array and pin the CPU workers so that they stream from their local memory.
+
+#ifndef PRISMATIC_MEMORYPLACEMENT_H
+#define PRISMATIC_MEMORYPLACEMENT_H
+#include <cstddef>
+#include "meta.h"
+#include "ArrayND.h"
+
+namespace Prismatic
+{
+
+// pins the calling thread, worker number threadID, according to meta.affinityPolicy
+void pinCurrentThread(const size_t threadID, const Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+// applies the huge page and NUMA policies to a buffer whose contents are all zero
+void placeZeroedBuffer(void *ptr, const size_t bytes, const Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+template <size_t N, class T>
+void placeZeroedArray(ArrayND<N, std::vector<T>> &arr, const Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	if (arr.size() == 0)
+		return;
+	placeZeroedBuffer((void *)&arr[0], arr.size() * sizeof(T), meta);
+}
+
+} // namespace Prismatic
+#endif //PRISMATIC_MEMORYPLACEMENT_H
@@ -22,11 +22,32 @@
 namespace Prismatic{
 
     enum class StreamingMode{Stream, SingleXfer, Auto};
+    enum class FFTWPlanningMode{Measure, Patient, Exhaustive};
+    enum class NUMAPolicy{Default, FirstTouch, Interleave};
+    enum class AffinityPolicy{None, Compact, Scatter};
+    enum class ScompactPrecision{Full, Float16, BFloat16, Int16};
+    enum class FPAccumulation{Auto, Memory, File, Disk};
+    enum class Compression4D{None, Deflate, LZ4, Bitshuffle};
+    enum class DatacubeType{Float, Float16, UInt16, UInt8};
+    enum class Format4D{HDF5, Zarr, Npy};
+
+    // the probe settings that can be varied within a single run, see Metadata::getProbeConditions
+    template <class T>
+    struct ProbeCondition{
+        T probeDefocus;
+        T C3;
+        T C5;
+        T probeSemiangle;
+        T probeXtilt;
+        T probeYtilt;
+    };
+
     template <class T>
     class Metadata{
     public:
         void toString();
         bool operator==(const Metadata<T> other);
+        std::vector<ProbeCondition<T> > getProbeConditions() const;
 
         Metadata(){
             interpolationFactorY  = 4;
@@ -84,6 +105,19 @@ namespace Prismatic{
             save3DOutput          = true;
             save4DOutput          = false;
             crop4DOutput          = false;
+            bin4D                 = 1;
+            writerQueueMB         = 256;
+            fpAccumulation4D      = FPAccumulation::Auto;
+            format4D              = Format4D::HDF5;
+            chunk4DX              = 1;
+            chunk4DY              = 1;
+            compression4D         = Compression4D::None;
+            compressionLevel4D    = 4;
+            datacubeType          = DatacubeType::Float;
+            datacubeScale         = 0;
+            maskAnnuli4D          = std::vector<T>(); // empty with no mask file stores the full 4D frames
+            filenameMask4D        = "";
+            swmrInterval          = 0;
             saveDPC_CoM           = false;
             saveRealSpaceCoords   = false;
             savePotentialSlices   = false;
@@ -94,6 +128,23 @@ namespace Prismatic{
             integrationAngleMax   = detectorAngleStep;
             transferMode          = StreamingMode::Auto;
             nyquistSampling		  = false;
+            fftwPlanningMode      = FFTWPlanningMode::Measure;
+            useFFTWWisdom         = true;
+            fftwWisdomFile        = ""; // empty string selects the per-user cache location
+            numaPolicy            = NUMAPolicy::Default;
+            affinityPolicy        = AffinityPolicy::None;
+            useHugePages          = false;
+            scompactPrecision     = ScompactPrecision::Full;
+            filenameScompact      = ""; // empty string keeps the S-matrix in memory
+            filenameSaveSMatrix   = ""; // empty string does not save the S-matrix
+            filenameLoadSMatrix   = ""; // empty string computes the S-matrix
+            probeDefocusSeries    = std::vector<T>(); // empty series use the single value above
+            C3Series              = std::vector<T>();
+            C5Series              = std::vector<T>();
+            probeSemiangleSeries  = std::vector<T>();
+            probeXtiltSeries      = std::vector<T>();
+            probeYtiltSeries      = std::vector<T>();
+            energySeries          = std::vector<T>(); // empty series runs at E0 only
         }
         size_t interpolationFactorY; // PRISM f_y parameter
         size_t interpolationFactorX; // PRISM f_x parameter
@@ -148,6 +199,19 @@ namespace Prismatic{
         bool save3DOutput;
         bool save4DOutput;
         bool crop4DOutput;
+        size_t bin4D; // each pattern of the 4D output is binned bin4D x bin4D
+        size_t writerQueueMB; // memory for 4D frames waiting for the asynchronous writer thread, 0 writes synchronously
+        FPAccumulation fpAccumulation4D; // where the 4D output of the frozen phonon passes is summed
+        Format4D format4D; // where the 4D output is written, see datacubeStore.h and datacubeMap.h
+        size_t chunk4DX; // number of scan positions in x per HDF5 chunk of the 4D output
+        size_t chunk4DY; // number of scan positions in y per HDF5 chunk of the 4D output
+        Compression4D compression4D; // filters applied to the chunks of the 4D output
+        int compressionLevel4D; // deflate level, 1-9
+        DatacubeType datacubeType; // element type of the 4D output, see datacubeEncoding.h
+        T datacubeScale; // intensity per stored unit of a quantized 4D output, 0 for a scale per frame
+        std::vector<T> maskAnnuli4D; // inner and outer angles (in rad) of the annuli stored by a sparse 4D output, see datacubeMask.h
+        std::string filenameMask4D; // text file selecting the pixels stored by a sparse 4D output
+        size_t swmrInterval; // seconds between refreshes of the output streamed in SWMR mode, 0 writes it at the end, see outputStreamer.h
         bool saveDPC_CoM;
         bool saveRealSpaceCoords;
         bool savePotentialSlices;
@@ -156,6 +220,23 @@ namespace Prismatic{
         bool realSpaceWindow_y;
         bool nyquistSampling;
         StreamingMode transferMode;
+        FFTWPlanningMode fftwPlanningMode; // rigor of the FFTW planner used for the reusable worker plans
+        bool useFFTWWisdom; // import/export accumulated FFTW wisdom between runs
+        std::string fftwWisdomFile; // location of the FFTW wisdom cache
+        NUMAPolicy numaPolicy; // page placement of the large shared arrays
+        AffinityPolicy affinityPolicy; // how CPU worker threads are pinned to cores
+        bool useHugePages; // request transparent huge pages for the large shared arrays
+        ScompactPrecision scompactPrecision; // storage format of the compact S-matrix, see reducedPrecision.h
+        std::string filenameScompact; // memory-mapped scratch file for an out-of-core compact S-matrix
+        std::string filenameSaveSMatrix; // HDF5 file the compact S-matrix is saved to for later runs
+        std::string filenameLoadSMatrix; // HDF5 file a previously saved compact S-matrix is loaded from
+        std::vector<T> probeDefocusSeries; // probe settings to evaluate in one run, every combination of the series is used
+        std::vector<T> C3Series;
+        std::vector<T> C5Series;
+        std::vector<T> probeSemiangleSeries;
+        std::vector<T> probeXtiltSeries;
+        std::vector<T> probeYtiltSeries;
+        std::vector<T> energySeries; // electron energies of a series sharing one potential, each is a separate run and output file
 
     };
 
@@ -214,6 +295,7 @@ namespace Prismatic{
         std::cout << "integrationAngleMax = " << integrationAngleMax<< std::endl;
         std::cout << "randomSeed = " << randomSeed << std::endl;
         std::cout << "crop4Damax = " << crop4Damax << std::endl;
+        std::cout << "bin4D = " << bin4D << std::endl;
 
         if (includeOccupancy) {
             std::cout << "includeOccupancy = true" << std::endl;
@@ -250,6 +332,54 @@ namespace Prismatic{
         } else {
             std::cout << "crop4DOutput = false" << std::endl;
         }
+        std::cout << "writerQueueMB = " << writerQueueMB << std::endl;
+        if (fpAccumulation4D == Prismatic::FPAccumulation::Memory){
+            std::cout << "fpAccumulation4D = memory" << std::endl;
+        } else if (fpAccumulation4D == Prismatic::FPAccumulation::File){
+            std::cout << "fpAccumulation4D = file" << std::endl;
+        } else if (fpAccumulation4D == Prismatic::FPAccumulation::Disk){
+            std::cout << "fpAccumulation4D = disk" << std::endl;
+        } else {
+            std::cout << "fpAccumulation4D = auto" << std::endl;
+        }
+        if (format4D == Prismatic::Format4D::Zarr){
+            std::cout << "format4D = zarr" << std::endl;
+        } else if (format4D == Prismatic::Format4D::Npy){
+            std::cout << "format4D = npy" << std::endl;
+        } else {
+            std::cout << "format4D = hdf5" << std::endl;
+        }
+        std::cout << "chunk4DX = " << chunk4DX << std::endl;
+        std::cout << "chunk4DY = " << chunk4DY << std::endl;
+        if (compression4D == Prismatic::Compression4D::Deflate){
+            std::cout << "compression4D = deflate" << std::endl;
+        } else if (compression4D == Prismatic::Compression4D::LZ4){
+            std::cout << "compression4D = lz4" << std::endl;
+        } else if (compression4D == Prismatic::Compression4D::Bitshuffle){
+            std::cout << "compression4D = bitshuffle" << std::endl;
+        } else {
+            std::cout << "compression4D = none" << std::endl;
+        }
+        std::cout << "compressionLevel4D = " << compressionLevel4D << std::endl;
+        if (datacubeType == Prismatic::DatacubeType::Float16){
+            std::cout << "datacubeType = float16" << std::endl;
+        } else if (datacubeType == Prismatic::DatacubeType::UInt16){
+            std::cout << "datacubeType = uint16" << std::endl;
+        } else if (datacubeType == Prismatic::DatacubeType::UInt8){
+            std::cout << "datacubeType = uint8" << std::endl;
+        } else {
+            std::cout << "datacubeType = float" << std::endl;
+        }
+        std::cout << "datacubeScale = " << datacubeScale << std::endl;
+        if (!maskAnnuli4D.empty()){
+            std::cout << "maskAnnuli4D = ";
+            for (auto &a : maskAnnuli4D) std::cout << a << " ";
+            std::cout << std::endl;
+        }
+        if (filenameMask4D != ""){
+            std::cout << "filenameMask4D = " << filenameMask4D << std::endl;
+        }
+        std::cout << "swmrInterval = " << swmrInterval << std::endl;
         if (saveDPC_CoM) {
             std::cout << "saveDPC_CoM = true" << std::endl;
         } else {
@@ -270,6 +400,63 @@ namespace Prismatic{
         }else{
             std::cout << "nyquistSampling = false" << std::endl;
         }
+        if (fftwPlanningMode == Prismatic::FFTWPlanningMode::Exhaustive){
+            std::cout << "fftwPlanningMode = exhaustive" << std::endl;
+        } else if (fftwPlanningMode == Prismatic::FFTWPlanningMode::Patient){
+            std::cout << "fftwPlanningMode = patient" << std::endl;
+        } else {
+            std::cout << "fftwPlanningMode = measure" << std::endl;
+        }
+        if (useFFTWWisdom) {
+            std::cout << "useFFTWWisdom = true" << std::endl;
+        } else {
+            std::cout << "useFFTWWisdom = false" << std::endl;
+        }
+        std::cout << "fftwWisdomFile = " << fftwWisdomFile << std::endl;
+        if (numaPolicy == Prismatic::NUMAPolicy::Interleave){
+            std::cout << "numaPolicy = interleave" << std::endl;
+        } else if (numaPolicy == Prismatic::NUMAPolicy::FirstTouch){
+            std::cout << "numaPolicy = first-touch" << std::endl;
+        } else {
+            std::cout << "numaPolicy = default" << std::endl;
+        }
+        if (affinityPolicy == Prismatic::AffinityPolicy::Scatter){
+            std::cout << "affinityPolicy = scatter" << std::endl;
+        } else if (affinityPolicy == Prismatic::AffinityPolicy::Compact){
+            std::cout << "affinityPolicy = compact" << std::endl;
+        } else {
+            std::cout << "affinityPolicy = none" << std::endl;
+        }
+        if (useHugePages) {
+            std::cout << "useHugePages = true" << std::endl;
+        } else {
+            std::cout << "useHugePages = false" << std::endl;
+        }
+        if (scompactPrecision == Prismatic::ScompactPrecision::Float16){
+            std::cout << "scompactPrecision = fp16" << std::endl;
+        } else if (scompactPrecision == Prismatic::ScompactPrecision::BFloat16){
+            std::cout << "scompactPrecision = bf16" << std::endl;
+        } else if (scompactPrecision == Prismatic::ScompactPrecision::Int16){
+            std::cout << "scompactPrecision = int16" << std::endl;
+        } else {
+            std::cout << "scompactPrecision = full" << std::endl;
+        }
+        std::cout << "filenameScompact = " << filenameScompact << std::endl;
+        std::cout << "filenameSaveSMatrix = " << filenameSaveSMatrix << std::endl;
+        std::cout << "filenameLoadSMatrix = " << filenameLoadSMatrix << std::endl;
+        const std::vector<ProbeCondition<T> > conditions = getProbeConditions();
+        if (conditions.size() > 1){
+            std::cout << "probe conditions (defocus, C3, C5, semiangle, xtilt, ytilt) = " << std::endl;
+            for (auto &c : conditions){
+                std::cout << "    " << c.probeDefocus << ", " << c.C3 << ", " << c.C5 << ", " << c.probeSemiangle << ", "
+                          << c.probeXtilt << ", " << c.probeYtilt << std::endl;
+            }
+        }
+        if (!energySeries.empty()){
+            std::cout << "energySeries = ";
+            for (auto &E : energySeries) std::cout << E << " ";
+            std::cout << std::endl;
+        }
 
 
     #ifdef PRISMATIC_ENABLE_GPU
@@ -335,6 +522,19 @@ namespace Prismatic{
         if(save3DOutput != other.save3DOutput)return false;
         if(save4DOutput != other.save4DOutput)return false;
         if(crop4DOutput != other.crop4DOutput)return false;
+        if(bin4D != other.bin4D)return false;
+        if(writerQueueMB != other.writerQueueMB)return false;
+        if(fpAccumulation4D != other.fpAccumulation4D)return false;
+        if(format4D != other.format4D)return false;
+        if(chunk4DX != other.chunk4DX)return false;
+        if(chunk4DY != other.chunk4DY)return false;
+        if(compression4D != other.compression4D)return false;
+        if(compressionLevel4D != other.compressionLevel4D)return false;
+        if(datacubeType != other.datacubeType)return false;
+        if(datacubeScale != other.datacubeScale)return false;
+        if(maskAnnuli4D != other.maskAnnuli4D)return false;
+        if(filenameMask4D != other.filenameMask4D)return false;
+        if(swmrInterval != other.swmrInterval)return false;
         if(saveDPC_CoM != other.saveDPC_CoM)return false;
         if(saveRealSpaceCoords != other.saveRealSpaceCoords)return false;
         if(savePotentialSlices != other.savePotentialSlices)return false;
@@ -342,8 +542,45 @@ namespace Prismatic{
         if(realSpaceWindow_x != other.realSpaceWindow_x)return false;
         if(realSpaceWindow_y != other.realSpaceWindow_y)return false;
         if(nyquistSampling != other.nyquistSampling)return false;
+        if(fftwPlanningMode != other.fftwPlanningMode)return false;
+        if(useFFTWWisdom != other.useFFTWWisdom)return false;
+        if(fftwWisdomFile != other.fftwWisdomFile)return false;
+        if(numaPolicy != other.numaPolicy)return false;
+        if(affinityPolicy != other.affinityPolicy)return false;
+        if(useHugePages != other.useHugePages)return false;
+        if(scompactPrecision != other.scompactPrecision)return false;
+        if(filenameScompact != other.filenameScompact)return false;
+        if(filenameSaveSMatrix != other.filenameSaveSMatrix)return false;
+        if(filenameLoadSMatrix != other.filenameLoadSMatrix)return false;
+        if(probeDefocusSeries != other.probeDefocusSeries)return false;
+        if(C3Series != other.C3Series)return false;
+        if(C5Series != other.C5Series)return false;
+        if(probeSemiangleSeries != other.probeSemiangleSeries)return false;
+        if(probeXtiltSeries != other.probeXtiltSeries)return false;
+        if(probeYtiltSeries != other.probeYtiltSeries)return false;
+        if(energySeries != other.energySeries)return false;
         return true;
     }
 
+    template <class T>
+    std::vector<ProbeCondition<T> > Metadata<T>::getProbeConditions() const{
+        // every combination of the probe setting series, with defocus varying fastest. A setting without a
+        // series keeps its single value, so without any series this is just the one probe of the run
+        const std::vector<T> df = probeDefocusSeries.empty() ? std::vector<T>{probeDefocus} : probeDefocusSeries;
+        const std::vector<T> c3 = C3Series.empty() ? std::vector<T>{C3} : C3Series;
+        const std::vector<T> c5 = C5Series.empty() ? std::vector<T>{C5} : C5Series;
+        const std::vector<T> sa = probeSemiangleSeries.empty() ? std::vector<T>{probeSemiangle} : probeSemiangleSeries;
+        const std::vector<T> tx = probeXtiltSeries.empty() ? std::vector<T>{probeXtilt} : probeXtiltSeries;
+        const std::vector<T> ty = probeYtiltSeries.empty() ? std::vector<T>{probeYtilt} : probeYtiltSeries;
+        std::vector<ProbeCondition<T> > conditions;
+        for (auto &ty_t : ty)
+            for (auto &tx_t : tx)
+                for (auto &sa_t : sa)
+                    for (auto &c5_t : c5)
+                        for (auto &c3_t : c3)
+                            for (auto &df_t : df)
+                                conditions.push_back(ProbeCondition<T>{df_t, c3_t, c5_t, sa_t, tx_t, ty_t});
+        return conditions;
+    }
 }
 #endif //PRISMATIC_META_H
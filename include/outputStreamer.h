@@ -0,0 +1,68 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+// Streams the partial results of a run into the output file while it is computed (--swmr-interval). The file is
+// switched to HDF5 single-writer/multiple-reader mode once all of its objects exist and stays open until the run
+// ends. A background thread then periodically writes a snapshot of the 2D, 3D and DPC images, averaged over the
+// frozen phonon passes so far, updates the progress dataset of the file and flushes it, together with the 4D frames
+// written so far. The snapshot is taken while the compute threads keep writing, so positions being computed at that
+// time may hold partial values.
+
+#ifndef PRISMATIC_OUTPUTSTREAMER_H
+#define PRISMATIC_OUTPUTSTREAMER_H
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "defines.h"
+
+namespace Prismatic
+{
+
+template <class T>
+class Parameters;
+
+class OutputStreamer
+{
+  public:
+	// refreshes the output of pars, which must outlive the streamer, every interval seconds
+	OutputStreamer(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t interval);
+	~OutputStreamer();
+	OutputStreamer(const OutputStreamer &) = delete;
+	OutputStreamer &operator=(const OutputStreamer &) = delete;
+
+	// called by the compute threads as they complete probe positions
+	void addProbes(const size_t n) { probesDone += n; }
+
+	// refreshes the output a last time, with the whole pass done, and stops the thread
+	void finish();
+
+  private:
+	void run();
+	void refresh(const size_t probes);
+
+	const Parameters<PRISMATIC_FLOAT_PRECISION> &pars;
+	const std::chrono::seconds interval;
+	std::atomic<size_t> probesDone;
+	bool finished;
+	bool failed;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread worker;
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_OUTPUTSTREAMER_H
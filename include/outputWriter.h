@@ -0,0 +1,75 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+// Owner of the HDF5 output file of a run. The datacube datasets are opened once and kept open together with
+// their dataspaces, so that the synchronous 4D write path does not reopen the group and dataset and flush
+// the file for every probe position. Parameters refers to it through a shared pointer, so that the copies
+// of Parameters handed to the worker threads share one set of handles.
+
+#ifndef PRISMATIC_OUTPUTWRITER_H
+#define PRISMATIC_OUTPUTWRITER_H
+#include <string>
+#include <map>
+#include <mutex>
+#include "defines.h"
+#include "datacubeEncoding.h"
+#include "H5Cpp.h"
+
+namespace Prismatic
+{
+
+extern std::mutex write4D_lock; // serializes all access to the HDF5 library, defined in utility.cpp
+
+class OutputWriter
+{
+  public:
+	// opens filename with H5F_ACC_TRUNC or H5F_ACC_RDWR. A file that will be switched to SWMR mode is opened with the
+	// latest file format, which SWMR requires
+	OutputWriter(const std::string &filename, const unsigned int flags, const bool swmr = false);
+	~OutputWriter();
+	OutputWriter(const OutputWriter &) = delete;
+	OutputWriter &operator=(const OutputWriter &) = delete;
+
+	H5::H5File &getFile() { return file; }
+
+	// writes one diffraction pattern to the datacube in group nameString at scan position offset, see
+	// writeDatacube4D. accumulate adds it to the values already in the file, which requires full precision
+	void writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP, const bool accumulate, const DatacubeEncoding &encoding);
+	void writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP, const bool accumulate, const DatacubeEncoding &encoding);
+
+	// switches the file to single-writer/multiple-reader mode, in which the datasets can still be written but no new
+	// objects can be created. Throws std::runtime_error on failure
+	void startSWMR();
+
+	// closes the cached handles and flushes and closes the file
+	void close();
+
+  private:
+	struct Datacube
+	{
+		DatacubeHandles handles;
+		H5::DataSpace fspace;
+		H5::DataSpace mspace; // one frame
+	};
+
+	template <class T>
+	void writeFrame(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP, const bool accumulate, const DatacubeEncoding &encoding, const H5::PredType &type);
+	Datacube &getDatacube(const std::string &nameString, const hsize_t *mdims, const DatacubeEncoding &encoding);
+
+	H5::H5File file;
+	std::map<std::string, Datacube> datacubes;
+};
+
+} // namespace Prismatic
+#endif //PRISMATIC_OUTPUTWRITER_H
@@ -18,7 +18,16 @@
 #include <algorithm>
 #include <mutex>
 #include <complex>
+#include <memory>
 #include "ArrayND.h"
+#include "mappedStorage.h"
+#include "datacubeWriter.h"
+#include "datacubeAccumulator.h"
+#include "datacubeMask.h"
+#include "datacubeStore.h"
+#include "datacubeMap.h"
+#include "outputStreamer.h"
+#include "outputWriter.h"
 #include "atom.h"
 #include "meta.h"
 #include "H5Cpp.h"
@@ -33,8 +42,18 @@ namespace Prismatic{
 	using Array2D = Prismatic::ArrayND<2, std::vector<T> >;
 	template <class T>
 	using Array3D = Prismatic::ArrayND<3, std::vector<T> >;
+	// the output arrays are cache line aligned so that the probe blocks of getCacheAlignedProbeBlock
+	// start on line boundaries
 	template <class T>
-	using Array4D = Prismatic::ArrayND<4, std::vector<T> >;
+	using Array4D = Prismatic::ArrayND<4, aligned_vector<T> >;
+
+	// aligned storage for FFTW buffers and per-probe scratch arrays, see uninitialized_ND
+	template <class T>
+	using AlignedArray1D = Prismatic::ArrayND<1, aligned_vector<T> >;
+	template <class T>
+	using AlignedArray2D = Prismatic::ArrayND<2, aligned_vector<T> >;
+	template <class T>
+	using AlignedArray3D = Prismatic::ArrayND<3, aligned_vector<T> >;
 
 	// for monitoring memory consumption on GPU
 	static std::mutex memLock;
@@ -50,6 +69,13 @@ namespace Prismatic{
 	    void calculateLambda();
 	    Metadata<T> meta;
 	    Array3D< std::complex<T>  > Scompact;
+	    Prismatic::ArrayND<3, std::vector<uint16_t> > ScompactReduced; // [beam][y][2*x], replaces Scompact for 16-bit meta.scompactPrecision
+	    std::vector<T> ScompactScale; // per-beam scale factor of ScompactReduced
+	    std::vector<T> ScompactRelativeError; // per-beam RMS encoding error of ScompactReduced relative to the beam's RMS value
+	    AlignedArray3D< std::complex<T> > permutedScompact; // [y][x][active beam], only held while PRISM03 runs on the CPU
+	    AlignedArray3D<uint16_t> permutedScompactReduced; // [y][x][2*active beam], same for ScompactReduced
+	    std::shared_ptr<MappedFile> ScompactFile; // out-of-core S-matrix, [beam block][y][x][beam in block], see fill_Scompact_CPUOnly
+	    size_t probeStripWidth; // scan columns per strip of the PRISM03 probe order, 0 for row-major order
 	    Array4D<T> output;
 		Array4D<T> DPC_CoM;
 		Array3D<T> pot;
@@ -58,6 +84,11 @@ namespace Prismatic{
 	    Array2D< std::complex<T>  > prop;
 	    Array2D< std::complex<T> > propBack;
 	    Array2D< std::complex<T> > psiProbeInit;
+	    std::vector<ProbeCondition<T> > probeConditions; // probe settings of this run, each gets its own output layer
+	    std::vector<Array2D< std::complex<T> > > conditionProbeInit; // psiProbeInit of each probe condition
+	    std::vector<Array2D<T> > conditionAlphaInd; // alphaInd of each probe condition, which differ with tilt
+	    std::vector<Array2D< std::complex<T> > > conditionProp; // multislice propagator of each distinct probe tilt
+	    std::vector<size_t> conditionPropIndex; // entry of conditionProp used by each probe condition
 	    Array2D<unsigned int> qMask;
 	    T zTotal;
 	    T xTiltShift;
@@ -77,6 +108,12 @@ namespace Prismatic{
 		Array1D<T> qy;
         std::vector<size_t> beamsIndex;
 	    Prismatic::ArrayND<2, std::vector<long> > xyBeams;
+	    std::vector<size_t> activeBeams; // beams inside of the probe aperture, see setupActiveBeams
+	    Array1D<T> activeBeamsQx;
+	    Array1D<T> activeBeamsQy;
+	    Array2D< std::complex<T> > activeBeamsAmplitude; // [condition][active beam]
+	    Array3D< std::complex<T> > xPhaseCoeffs; // [condition][ax][active beam], includes the probe amplitude
+	    Array3D< std::complex<T> > yPhaseCoeffs; // [condition][ay][active beam]
 		Array2D<T> beams;
 	    Array2D<T> beamsOutput;
         Array1D<T> xVec;
@@ -107,8 +144,16 @@ namespace Prismatic{
 		size_t numSlices;
 		size_t zStartPlane;
 	    size_t numberBeams;
-		H5::H5File outputFile;
+		std::shared_ptr<OutputWriter> outputWriter; // output file of the run, see outputWriter.h
 		size_t fpFlag; //flag to prevent creation of new HDF5 files
+		std::shared_ptr<DatacubeWriter> datacubeWriter; // asynchronous 4D writer of the current pass, see datacubeWriter.h
+		std::shared_ptr<DatacubeAccumulator> datacubeAccumulator; // 4D output summed over all frozen phonon passes, see datacubeAccumulator.h
+		std::shared_ptr<const DatacubeMask> datacubeMask; // pixels stored by a sparse 4D output, see datacubeMask.h
+		std::shared_ptr<const DatacubeStore> datacubeStore; // directory store the 4D output is written to, see datacubeStore.h
+		std::shared_ptr<DatacubeMap> datacubeMap; // mapped .npy 4D output kept over all frozen phonon passes, see datacubeMap.h
+		std::shared_ptr<OutputStreamer> outputStreamer; // refreshes the output of the current pass in SWMR mode, see outputStreamer.h
+		const Array4D<T> *outputSum = nullptr; // output summed over the finished frozen phonon passes, streamed as a running average
+		const Array4D<T> *DPC_CoMSum = nullptr; // same for DPC_CoM
 
 #ifdef PRISMATIC_ENABLE_GPU
 		cudaDeviceProp deviceProperties;
@@ -163,6 +208,7 @@ namespace Prismatic{
 		    zTotal = tiledCellDim[0];
 		    xTiltShift = -zTotal * tan(meta.probeXtilt);
 		    yTiltShift = -zTotal * tan(meta.probeYtilt);
+		    probeConditions = meta.getProbeConditions();
 
 			if(meta.realSpaceWindow_x){
 				scanWindowXMin = std::min(meta.scanWindowXMin_r, tiledCellDim[2]) / tiledCellDim[2]; //default to max size if dimension exceeds tiled cell
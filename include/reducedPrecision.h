@@ -0,0 +1,183 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+// 16-bit storage formats for the compact S-matrix. Each complex value is stored as a pair of 16-bit words,
+// either IEEE binary16, bfloat16 (the upper half of a binary32), or a signed integer. Every beam is divided
+// by its own scale factor before encoding so that its largest component maps to the top of the format's range,
+// and the scale is multiplied back into the beam coefficient in PRISM03. Values are decoded to
+// PRISMATIC_FLOAT_PRECISION before they are accumulated.
+
+#ifndef PRISMATIC_REDUCEDPRECISION_H
+#define PRISMATIC_REDUCEDPRECISION_H
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include "meta.h"
+
+namespace Prismatic
+{
+
+inline uint32_t floatBits(const float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+inline float bitsFloat(const uint32_t u)
+{
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+// binary32 -> binary16 with round to nearest even, after F. Giesen's float_to_half_fast3_rtne
+inline uint16_t floatToHalf(const float value)
+{
+	const uint32_t f32infty = 255u << 23;
+	const uint32_t f16max = (127u + 16u) << 23;
+	const float denormMagic = bitsFloat(((127u - 15u) + (23u - 10u) + 1u) << 23);
+	uint32_t u = floatBits(value);
+	const uint32_t sign = u & 0x80000000u;
+	u ^= sign;
+	uint16_t o;
+	if (u >= f16max)
+	{
+		o = (u > f32infty) ? 0x7e00 : 0x7c00; // NaN stays NaN, everything else saturates to infinity
+	}
+	else if (u < (113u << 23))
+	{
+		// the result is subnormal, let the FPU do the rounding
+		o = (uint16_t)(floatBits(bitsFloat(u) + denormMagic) - floatBits(denormMagic));
+	}
+	else
+	{
+		const uint32_t mantissaOdd = (u >> 13) & 1;
+		u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+		u += mantissaOdd;
+		o = (uint16_t)(u >> 13);
+	}
+	return o | (uint16_t)(sign >> 16);
+}
+
+inline float halfToFloat(const uint16_t h)
+{
+	const uint32_t shiftedExp = 0x7c00u << 13;
+	uint32_t u = (h & 0x7fffu) << 13;
+	const uint32_t exp = shiftedExp & u;
+	u += (127u - 15u) << 23;
+	if (exp == shiftedExp)
+	{
+		u += (128u - 16u) << 23; // Inf/NaN
+	}
+	else if (exp == 0)
+	{
+		u += 1u << 23; // subnormal, renormalize
+		u = floatBits(bitsFloat(u) - bitsFloat(113u << 23));
+	}
+	return bitsFloat(u | ((uint32_t)(h & 0x8000u) << 16));
+}
+
+// binary32 -> bfloat16 with round to nearest even
+inline uint16_t floatToBFloat16(const float value)
+{
+	const uint32_t u = floatBits(value);
+	if ((u & 0x7fffffffu) > 0x7f800000u)
+		return (uint16_t)((u >> 16) | 0x40); // quiet NaN
+	return (uint16_t)((u + 0x7fffu + ((u >> 16) & 1)) >> 16);
+}
+
+inline float bfloat16ToFloat(const uint16_t h)
+{
+	return bitsFloat((uint32_t)h << 16);
+}
+
+// decoders used as template parameters of the PRISM03 reduction
+struct HalfDecoder
+{
+	PRISMATIC_FLOAT_PRECISION operator()(const uint16_t h) const { return halfToFloat(h); }
+};
+
+struct BFloat16Decoder
+{
+	PRISMATIC_FLOAT_PRECISION operator()(const uint16_t h) const { return bfloat16ToFloat(h); }
+};
+
+struct Int16Decoder
+{
+	PRISMATIC_FLOAT_PRECISION operator()(const uint16_t h) const { return (PRISMATIC_FLOAT_PRECISION)(int16_t)h; }
+};
+
+inline uint16_t encodeValue16(const PRISMATIC_FLOAT_PRECISION value, const ScompactPrecision precision)
+{
+	switch (precision)
+	{
+	case ScompactPrecision::Float16:
+		return floatToHalf((float)value);
+	case ScompactPrecision::BFloat16:
+		return floatToBFloat16((float)value);
+	default:
+		return (uint16_t)(int16_t)std::max(-32767L, std::min(32767L, std::lround(value)));
+	}
+}
+
+inline PRISMATIC_FLOAT_PRECISION decodeValue16(const uint16_t h, const ScompactPrecision precision)
+{
+	switch (precision)
+	{
+	case ScompactPrecision::Float16:
+		return halfToFloat(h);
+	case ScompactPrecision::BFloat16:
+		return bfloat16ToFloat(h);
+	default:
+		return (PRISMATIC_FLOAT_PRECISION)(int16_t)h;
+	}
+}
+
+// Encodes the n complex values in (each multiplied by factor) as 2n words of out and returns the beam's scale.
+// The squared encoding error and squared magnitude of the values are added to errorSq and normSq
+template <class T>
+T encodeComplex16(const std::complex<T> *in, const size_t n, const T factor, uint16_t *out,
+				  const ScompactPrecision precision, double &errorSq, double &normSq)
+{
+	T maxComponent = 0;
+	for (auto j = 0; j < n; ++j)
+		maxComponent = std::max(maxComponent, std::max(std::abs(in[j].real()), std::abs(in[j].imag())));
+	maxComponent *= std::abs(factor);
+	if (maxComponent == 0)
+	{
+		memset(out, 0, 2 * n * sizeof(uint16_t));
+		return 1;
+	}
+
+	// int16 maps the largest component to 32767, the floating point formats to 1
+	const T scale = (precision == ScompactPrecision::Int16) ? maxComponent / 32767 : maxComponent;
+	const T invScale = factor / scale;
+	for (auto j = 0; j < n; ++j)
+	{
+		const T re = in[j].real() * invScale;
+		const T im = in[j].imag() * invScale;
+		out[2 * j] = encodeValue16(re, precision);
+		out[2 * j + 1] = encodeValue16(im, precision);
+		const double errRe = ((double)decodeValue16(out[2 * j], precision) - re) * scale;
+		const double errIm = ((double)decodeValue16(out[2 * j + 1], precision) - im) * scale;
+		errorSq += errRe * errRe + errIm * errIm;
+		normSq += (double)(re * scale) * (re * scale) + (double)(im * scale) * (im * scale);
+	}
+	return scale;
+}
+
+} // namespace Prismatic
+#endif //PRISMATIC_REDUCEDPRECISION_H
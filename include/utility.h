@@ -20,6 +20,7 @@
 #include <complex>
 #include <ctime>
 #include <iomanip>
+#include <algorithm>
 #include "defines.h"
 #include "fftw3.h"
 #include "configure.h"
@@ -60,10 +61,10 @@ Array1D<T> makeFourierCoords(const size_t &N, const T &pixel_size)
 	return result;
 };
 
-template <class T>
-Array2D<T> fftshift2(Array2D<T> arr)
+template <class T, class U>
+void fftshift2(const ArrayView<2, T> &arr, const ArrayView<2, U> &result)
 {
-	Array2D<T> result(arr);
+	// writes the shifted array into result, which must have the same shape and must not overlap arr
 	const long sj = std::floor(arr.get_dimj() / 2);
 	const long si = std::floor(arr.get_dimi() / 2);
 	for (auto j = 0; j < arr.get_dimj(); ++j)
@@ -73,11 +74,50 @@ Array2D<T> fftshift2(Array2D<T> arr)
 			result.at((j + sj) % arr.get_dimj(), (i + si) % arr.get_dimi()) = arr.at(j, i);
 		}
 	}
+};
+
+template <class Storage>
+ArrayND<2, Storage> fftshift2(const ArrayND<2, Storage> &arr)
+{
+	ArrayND<2, Storage> result(Storage(arr.size()), {{arr.get_dimj(), arr.get_dimi()}});
+	fftshift2(arr.view(), result.view());
 	return result;
 };
 
 template <class T>
-Array1D<T> fftshift(Array1D<T> arr)
+void circShiftInPlace(const ArrayView<2, T> &arr, const long sj, const long si)
+{
+	// rotates each row by si and then the rows by sj, without a temporary copy of the array
+	const size_t dimj = arr.get_dimj();
+	const size_t dimi = arr.get_dimi();
+	const size_t shift_i = ((si % (long)dimi) + dimi) % dimi;
+	const size_t shift_j = ((sj % (long)dimj) + dimj) % dimj;
+	if (shift_i != 0)
+	{
+		for (auto j = 0; j < dimj; ++j)
+		{
+			T *row = &arr.at(j, 0);
+			std::rotate(row, row + dimi - shift_i, row + dimi);
+		}
+	}
+	if (shift_j != 0)
+		std::rotate(arr.begin(), arr.begin() + (dimj - shift_j) * dimi, arr.end());
+};
+
+template <class T>
+void fftshift2InPlace(const ArrayView<2, T> &arr)
+{
+	circShiftInPlace(arr, std::floor(arr.get_dimj() / 2), std::floor(arr.get_dimi() / 2));
+};
+
+template <class Storage>
+void fftshift2InPlace(ArrayND<2, Storage> &arr)
+{
+	fftshift2InPlace(arr.view());
+};
+
+template <class T>
+Array1D<T> fftshift(const Array1D<T> &arr)
 {
 	Array1D<T> result(arr);
 	const long si = std::floor(arr.get_dimi() / 2);
@@ -88,24 +128,20 @@ Array1D<T> fftshift(Array1D<T> arr)
 	return result;
 };
 
-template <class T>
-Array2D<T> circShift(Array2D<T> &arr,const long sj, const long si)
+template <class Storage>
+ArrayND<2, Storage> circShift(const ArrayND<2, Storage> &arr,const long sj, const long si)
 {
-    Array2D<T> result(arr);
-    for (auto j = 0; j < arr.get_dimj(); ++j)
-    {
-        for (auto i = 0; i < arr.get_dimi(); ++i)
-        {
-            result.at((j + sj) % arr.get_dimj(), (i + si) % arr.get_dimi()) = arr.at(j, i);
-        }
-    }
+    ArrayND<2, Storage> result(arr);
+    circShiftInPlace(result.view(), sj, si);
     return result;
 };
 
 template <class T>
-Array2D<T> cropOutput(Array2D<T> &img, const Parameters<T> &pars){
-    size_t qxInd_max = 0;
-    size_t qyInd_max = 0;
+void cropOutputIndices(const Parameters<T> &pars, size_t &qyInd_max, size_t &qxInd_max)
+{
+    // number of Fourier pixels on each side of the origin that lie within crop4Damax
+    qxInd_max = 0;
+    qyInd_max = 0;
     PRISMATIC_FLOAT_PRECISION qMax = pars.meta.crop4Damax / pars.lambda;
 
     for(auto i = 0; i < pars.qx.get_dimi(); i++)
@@ -131,26 +167,116 @@ Array2D<T> cropOutput(Array2D<T> &img, const Parameters<T> &pars){
             break;
         }
     }
+}
 
-    //shift image so that desired region is in top left
-    Array2D<T> shifted = circShift(img,qyInd_max,qxInd_max);
-
-    //construct cropped return image
-    Array2D<T> cropped = zeros_ND<2, PRISMATIC_FLOAT_PRECISION >({{qyInd_max*2, qxInd_max*2}});
-
-    //copy data to return array
-    for(auto j = 0; j < cropped.get_dimj(); j++)
+template <class T, class U>
+void cropOutput(const ArrayView<2, T> &img, const size_t qyInd_max, const size_t qxInd_max, const ArrayView<2, U> &cropped)
+{
+    // copies the region within qyInd_max, qxInd_max of the origin into cropped (2*qyInd_max x 2*qxInd_max)
+    // with the origin moved to the center. Equivalent to circShift followed by taking the top left corner
+    const long ndimy = (long) img.get_dimj();
+    const long ndimx = (long) img.get_dimi();
+    for(long j = 0; j < (long) cropped.get_dimj(); j++)
     {
-        for(auto i = 0; i < cropped.get_dimi(); i++)
+        const long y = ((j - (long) qyInd_max) % ndimy + ndimy) % ndimy;
+        for(long i = 0; i < (long) cropped.get_dimi(); i++)
         {
-            cropped.at(j,i) = shifted.at(j,i);
+            cropped.at(j,i) = img.at(y, ((i - (long) qxInd_max) % ndimx + ndimx) % ndimx);
         }
     }
-    
+}
+
+template <class T, class Storage>
+ArrayND<2, Storage> cropOutput(const ArrayND<2, Storage> &img, const Parameters<T> &pars){
+    size_t qxInd_max, qyInd_max;
+    cropOutputIndices(pars, qyInd_max, qxInd_max);
+
+    //construct cropped return image
+    ArrayND<2, Storage> cropped(Storage(qyInd_max*2*qxInd_max*2), {{qyInd_max*2, qxInd_max*2}});
+    cropOutput(img.view(), qyInd_max, qxInd_max, cropped.view());
     return cropped;
 }
 
 
+template <class T, class U>
+void cropBinOutput(const ArrayView<2, T> &img, const size_t qyInd_max, const size_t qxInd_max, const size_t bin, const ArrayView<2, U> &binned)
+{
+	// sums bin x bin blocks of the region cropOutput copies into a (bin * binned.get_dimj()) x (bin * binned.get_dimi())
+	// array, in a single pass over the pattern
+	if (bin == 1)
+	{
+		cropOutput(img, qyInd_max, qxInd_max, binned);
+		return;
+	}
+	const long ndimy = (long)img.get_dimj();
+	const long ndimx = (long)img.get_dimi();
+	std::fill(binned.begin(), binned.end(), 0);
+	for (long j = 0; j < (long)(binned.get_dimj() * bin); j++)
+	{
+		const long y = ((j - (long)qyInd_max) % ndimy + ndimy) % ndimy;
+		U *row = &binned.at(j / bin, 0);
+		for (long i = 0; i < (long)(binned.get_dimi() * bin); i++)
+		{
+			row[i / bin] += img.at(y, ((i - (long)qxInd_max) % ndimx + ndimx) % ndimx);
+		}
+	}
+}
+
+template <class T>
+void get4DOutputRegion(const Parameters<T> &pars, const size_t dimj, const size_t dimi, size_t &qyInd_max, size_t &qxInd_max, size_t &ny, size_t &nx)
+{
+	// region of a dimj x dimi pattern saved in the 4D output, before binning: ny x nx pixels with the origin at
+	// (qyInd_max, qxInd_max)
+	if (pars.meta.crop4DOutput)
+	{
+		cropOutputIndices(pars, qyInd_max, qxInd_max);
+		ny = 2 * qyInd_max;
+		nx = 2 * qxInd_max;
+	}
+	else if (pars.meta.algorithm == Algorithm::Multislice)
+	{
+		// the outer half of the multislice grid is beyond the antialiasing aperture
+		ny = dimj / 2;
+		nx = dimi / 2;
+		qyInd_max = dimj / 4;
+		qxInd_max = dimi / 4;
+	}
+	else
+	{
+		ny = dimj;
+		nx = dimi;
+		qyInd_max = dimj / 2;
+		qxInd_max = dimi / 2;
+	}
+}
+
+template <class T, class Storage>
+ArrayND<2, Storage> get4DOutputFrame(const ArrayND<2, Storage> &img, const Parameters<T> &pars)
+{
+	// crops, centers and bins a diffraction pattern into the frame stored in the 4D output
+	size_t qyInd_max, qxInd_max, ny, nx;
+	get4DOutputRegion(pars, img.get_dimj(), img.get_dimi(), qyInd_max, qxInd_max, ny, nx);
+	const size_t bin = pars.meta.bin4D;
+	ArrayND<2, Storage> frame(Storage((ny / bin) * (nx / bin)), {{ny / bin, nx / bin}});
+	cropBinOutput(img.view(), qyInd_max, qxInd_max, bin, frame.view());
+	return frame;
+}
+
+template <class T>
+Array1D<T> binCoordinates(const T *q, const size_t n, const size_t bin)
+{
+	// coordinates of the binned pixels, the mean of the bin pixels each of them sums
+	Array1D<T> result = zeros_ND<1, T>({{n / bin}});
+	for (auto i = 0; i < result.get_dimi(); ++i)
+	{
+		for (auto b = 0; b < bin; ++b)
+			result[i] += q[i * bin + b];
+		result[i] /= bin;
+	}
+	return result;
+}
+
+
 template <class T>
 std::string generateFilename(const Parameters<T> &pars, const size_t currentSlice, const size_t ay, const size_t ax)
 {
@@ -179,7 +305,17 @@ PRISMATIC_FLOAT_PRECISION computePearsonCorrelation(Prismatic::Array2D<std::comp
 PRISMATIC_FLOAT_PRECISION computeRfactor(Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> left,
 										 Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> right);
 
-int nyquistProbes(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, size_t dim);
+int nyquistProbes(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t dim);
+
+size_t getCacheAlignedProbeBlock(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numProbes);
+
+unsigned int getFFTWPlanningFlag(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+std::string getFFTWWisdomFilename(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+bool importFFTWWisdom(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+bool exportFFTWWisdom(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
 
 std::string remove_extension(const std::string &filename);
 
@@ -187,23 +323,23 @@ int testFilenameOutput(const std::string &filename);
 int testWrite(const std::string &filename);
 int testExist(const std::string &filename);
 
-void setupOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> prismatic_pars);
+void setupOutputFile(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
-void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy);
+void setup4DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy);
 
-void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy);
+void setup4DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy);
 
-void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy);
+void setupVDOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy);
 
-void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy);
+void setupVDOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy);
 
-void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy);
+void setup2DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy);
 
-void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy);
+void setup2DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy);
 
-void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy);
+void setupDPCOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy);
 
-void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy);
+void setupDPCOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy);
 
 void writeRealSlice(H5::DataSet dataset, const float *buffer, const hsize_t *mdims);
 
@@ -213,17 +349,65 @@ void writeDatacube3D(H5::DataSet dataset, const float *buffer, const hsize_t *md
 
 void writeDatacube3D(H5::DataSet dataset, const double *buffer, const hsize_t *mdims);
 
-void writeDatacube4D(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, float *buffer, const hsize_t *mdims, const hsize_t *offset, const float numFP, const std::string nameString);
+void writeDatacube4D(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const float *buffer, const hsize_t *mdims, const hsize_t *offset, const float numFP, const std::string nameString);
+
+void writeDatacube4D(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const double *buffer, const hsize_t *mdims, const hsize_t *offset, const double numFP, const std::string nameString);
+
+// builds the detector mask of a sparse 4D output for the current pass, if --4D-mask-annuli or --4D-mask-file are given
+void setupDatacubeMask(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// opens the Zarr directory store for the 4D output of the current pass if --4D-format is zarr, or sets up the
+// mapped npy files of the run if it is npy
+void setupDatacubeStore(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// starts the asynchronous writer for the 4D output of the current pass, unless --4D-queue is 0
+void startDatacubeWriter(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// waits until all 4D frames of the current pass are in the file and stops the writer
+void finishDatacubeWriter(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
-void writeDatacube4D(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, double *buffer, const hsize_t *mdims, const hsize_t *offset, const double numFP, const std::string nameString);
+// with several frozen phonons, sums the 4D output of all passes before writing it, unless --4D-fp-accumulation is disk
+void setupDatacubeAccumulator(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// writes the summed 4D output after the last frozen phonon pass
+void writeDatacubeAccumulator(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// creates the groups of the saved 3D, 2D and DPC outputs with one layer per layer of pars.output, unless they exist
+void setupRealSliceOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// writes the saved 3D, 2D and DPC outputs from pars.output and pars.DPC_CoM into the groups of setupRealSliceOutput
+void writeRealSliceOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// same, from the given output and DPC_CoM arrays
+void writeRealSliceOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						  const Prismatic::Array4D<PRISMATIC_FLOAT_PRECISION> &output,
+						  const Prismatic::Array4D<PRISMATIC_FLOAT_PRECISION> &DPC_CoM);
+
+// with --swmr-interval, switches the output file to SWMR mode in the first pass, after creating everything the run
+// writes to it, and starts refreshing it in the background
+void startOutputStreamer(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// refreshes the streamed output with the whole pass done and stops the refreshing
+void finishOutputStreamer(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// closes the output file after a frozen phonon pass. A streamed output stays open until the end of the run, so that
+// the readers attached to it are not locked out when it is reopened
+void closeOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// opens the output file for the next pass or the final output, or hands on outputWriter if the output is streamed
+void reopenOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const std::shared_ptr<Prismatic::OutputWriter> &outputWriter);
 
 void writeStringArray(H5::DataSet dataset,H5std_string * string_array, hsize_t elements);
 
 std::string getDigitString(int digit);
 
-void writeMetadata(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, float dummy);
+std::string getSeriesFilename(const std::string &filename, const std::string &tag, const size_t n);
+
+std::string getLayerString(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t n, const size_t numLayers);
+
+void writeMetadata(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, float dummy);
 
-void writeMetadata(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, double dummy);
+void writeMetadata(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, double dummy);
 
 } // namespace Prismatic
 
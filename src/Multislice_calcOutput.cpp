@@ -24,6 +24,7 @@
 #include "utility.h"
 #include "fftw3.h"
 #include "WorkDispatcher.h"
+#include "memoryPlacement.h"
 #include "Multislice_calcOutput.h"
 
 namespace Prismatic{
@@ -115,30 +116,27 @@ namespace Prismatic{
 		}
 
 		// build propagators
-		pars.prop     = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> >({{pars.imageSize[0], pars.imageSize[1]}});
 		pars.propBack = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> >({{pars.imageSize[0], pars.imageSize[1]}});
+		setupPropagator_multislice(pars);
+	}
+
+	void setupPropagator_multislice(Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
+		// the propagator includes the probe tilt, so it is rebuilt for every tilt of a probe condition series
+		pars.prop     = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> >({{pars.imageSize[0], pars.imageSize[1]}});
 		for (auto y = 0; y < pars.qMask.get_dimj(); ++y) {
 			for (auto x = 0; x < pars.qMask.get_dimi(); ++x) {
 				if (pars.qMask.at(y,x)==1)
 				{
-		//					pars.prop.at(y,x)     = exp(-i * pi * complex<PRISMATIC_FLOAT_PRECISION>(pars.lambda, 0) *
-		//					                            complex<PRISMATIC_FLOAT_PRECISION>(pars.meta.sliceThickness, 0) *
-		//					                            complex<PRISMATIC_FLOAT_PRECISION>(pars.q2.at(y, x), 0));
-		//					pars.propBack.at(y,x) = exp(i * pi * complex<PRISMATIC_FLOAT_PRECISION>(pars.lambda, 0) *
-		//					                            complex<PRISMATIC_FLOAT_PRECISION>(pars.tiledCellDim[0], 0) *
-		//					                            complex<PRISMATIC_FLOAT_PRECISION>(pars.q2.at(y, x), 0));
-
 					pars.prop.at(y,x)     = exp(-i*pi*complex<PRISMATIC_FLOAT_PRECISION>(pars.lambda, 0) *
 												complex<PRISMATIC_FLOAT_PRECISION>(pars.meta.sliceThickness, 0) *
 												complex<PRISMATIC_FLOAT_PRECISION>(pars.q2.at(y, x), 0) +
 												i * complex<PRISMATIC_FLOAT_PRECISION>(2, 0)*pi *
 												complex<PRISMATIC_FLOAT_PRECISION>(pars.meta.sliceThickness, 0) *
-												(qx[x] * tan(pars.meta.probeXtilt) + qy[y] * tan(pars.meta.probeYtilt)));
+												(pars.qx[x] * tan(pars.meta.probeXtilt) + pars.qy[y] * tan(pars.meta.probeYtilt)));
 
 				}
 			}
 		}
-
 	}
 
 	void setupDetector_multislice(Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
@@ -147,9 +145,12 @@ namespace Prismatic{
 		Array1D<PRISMATIC_FLOAT_PRECISION> detectorAngles(detectorAngles_d, {{detectorAngles_d.size()}});
 		pars.detectorAngles = detectorAngles;
 		pars.Ndet = pars.detectorAngles.size();
-		Array2D<PRISMATIC_FLOAT_PRECISION> alpha = pars.q1 * pars.lambda;
-		pars.alphaInd = (alpha + pars.meta.detectorAngleStep/2) / pars.meta.detectorAngleStep;
-		for (auto& q : pars.alphaInd) q = std::round(q);
+		const PRISMATIC_FLOAT_PRECISION lambda = pars.lambda;
+		const PRISMATIC_FLOAT_PRECISION step   = pars.meta.detectorAngleStep;
+		pars.alphaInd = pars.q1.transform_fused([lambda, step](const PRISMATIC_FLOAT_PRECISION &q) {
+			const PRISMATIC_FLOAT_PRECISION alpha = q * lambda;
+			return std::round((alpha + step/2) / step);
+		});
 		pars.dq = (pars.qxa.at(0, 1) + pars.qya.at(1, 0)) / 2;
 	}
 
@@ -190,9 +191,55 @@ namespace Prismatic{
 				});
 	}
 
+	void setupProbeConditions_multislice(Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
+		// Probe conditions differ in their initial probes and, through the tilt, in their propagators. Conditions
+		// with the same tilt share a propagator. pars.meta, pars.psiProbeInit and pars.prop are left with the
+		// settings of the first condition
+		pars.conditionProbeInit.clear();
+		pars.conditionProp.clear();
+		pars.conditionPropIndex.clear();
+		for (auto c = 0; c < pars.probeConditions.size(); ++c){
+			const ProbeCondition<PRISMATIC_FLOAT_PRECISION> &condition = pars.probeConditions[c];
+			pars.meta.probeDefocus   = condition.probeDefocus;
+			pars.meta.C3             = condition.C3;
+			pars.meta.C5             = condition.C5;
+			pars.meta.probeSemiangle = condition.probeSemiangle;
+			pars.meta.probeXtilt     = condition.probeXtilt;
+			pars.meta.probeYtilt     = condition.probeYtilt;
+
+			size_t propIndex = c;
+			for (auto prev = 0; prev < c; ++prev){
+				if ((pars.probeConditions[prev].probeXtilt == condition.probeXtilt) &
+				    (pars.probeConditions[prev].probeYtilt == condition.probeYtilt)){
+					propIndex = pars.conditionPropIndex[prev];
+					break;
+				}
+			}
+			if (propIndex == c){
+				setupPropagator_multislice(pars);
+				propIndex = pars.conditionProp.size();
+				pars.conditionProp.push_back(pars.prop);
+			}
+			pars.conditionPropIndex.push_back(propIndex);
+
+			setupProbes_multislice(pars);
+			pars.conditionProbeInit.push_back(pars.psiProbeInit);
+		}
+		const ProbeCondition<PRISMATIC_FLOAT_PRECISION> &first = pars.probeConditions[0];
+		pars.meta.probeDefocus   = first.probeDefocus;
+		pars.meta.C3             = first.C3;
+		pars.meta.C5             = first.C5;
+		pars.meta.probeSemiangle = first.probeSemiangle;
+		pars.meta.probeXtilt     = first.probeXtilt;
+		pars.meta.probeYtilt     = first.probeYtilt;
+		pars.psiProbeInit = pars.conditionProbeInit[0];
+		pars.prop         = pars.conditionProp[0];
+	}
+
 	void createTransmission(Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
 		pars.transmission = zeros_ND<3, complex<PRISMATIC_FLOAT_PRECISION> >(
 				{{pars.pot.get_dimk(), pars.pot.get_dimj(), pars.pot.get_dimi()}});
+		placeZeroedArray(pars.transmission, pars.meta);
 		{
 			auto p = pars.pot.begin();
 			for (auto &j:pars.transmission)j = exp(i * pars.sigma * (*p++));
@@ -209,10 +256,15 @@ namespace Prismatic{
 		cout << "Number of layers: " << numLayers << endl;
 		cout << "First output depth is at " << firstLayer * pars.meta.sliceThickness * pars.numSlices << " angstroms with steps of " << pars.numSlices * pars.meta.sliceThickness << " angstroms" << endl;
 
-		pars.output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers, pars.yp.size(), pars.xp.size(), pars.Ndet}});
+		// the layers of the probe conditions follow each other, depth fastest
+		numLayers *= pars.probeConditions.size();
+
+		pars.output = zeros_aligned_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers, pars.yp.size(), pars.xp.size(), pars.Ndet}});
 		PRISMATIC_FLOAT_PRECISION dummy = 1.0;
 
-		if(pars.meta.saveDPC_CoM) pars.DPC_CoM = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers,pars.yp.size(),pars.xp.size(),2}});
+		if(pars.meta.saveDPC_CoM) pars.DPC_CoM = zeros_aligned_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers,pars.yp.size(),pars.xp.size(),2}});
+		setupDatacubeMask(pars);
+		setupDatacubeStore(pars);
 		if(pars.meta.save4DOutput && (pars.fpFlag == 0)) setup4DOutput(pars, numLayers, dummy);
 		//set up
 	}
@@ -223,17 +275,19 @@ namespace Prismatic{
 										   const size_t currentSlice,
 	                                       const size_t ay,
 	                                       const size_t ax){
-		Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{psi.get_dimj(), psi.get_dimi()}});
+		AlignedArray2D<PRISMATIC_FLOAT_PRECISION> intOutput = uninitialized_ND<2, PRISMATIC_FLOAT_PRECISION>({{psi.get_dimj(), psi.get_dimi()}});
 		auto psi_ptr = psi.begin();
 		for (auto& j:intOutput) j = pow(abs(*psi_ptr++),2);
 
 
 		if (pars.meta.saveDPC_CoM){
 			//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
+			PRISMATIC_FLOAT_PRECISION CoM_x = 0;
+			PRISMATIC_FLOAT_PRECISION CoM_y = 0;
 			for (long y = 0; y < psi.get_dimj(); ++y){
 				for (long x = 0; x < psi.get_dimi(); ++x){
-					pars.DPC_CoM.at(currentSlice,ay,ax,0) += pars.qxa.at(y,x) * intOutput.at(y,x); 
-					pars.DPC_CoM.at(currentSlice,ay,ax,1) += pars.qya.at(y,x) * intOutput.at(y,x); 
+					CoM_x += pars.qxa.at(y,x) * intOutput.at(y,x);
+					CoM_y += pars.qya.at(y,x) * intOutput.at(y,x);
 				}
 			}
 			//divide by sum of intensity
@@ -241,48 +295,29 @@ namespace Prismatic{
 			for (auto iter = intOutput.begin(); iter != intOutput.end(); ++iter){
 				intensitySum += *iter;
 			}
-			pars.DPC_CoM.at(currentSlice,ay,ax,0) /= intensitySum; 
-			pars.DPC_CoM.at(currentSlice,ay,ax,1) /= intensitySum;
+			pars.DPC_CoM.at(currentSlice,ay,ax,0) = (pars.DPC_CoM.at(currentSlice,ay,ax,0) + CoM_x) / intensitySum;
+			pars.DPC_CoM.at(currentSlice,ay,ax,1) = (pars.DPC_CoM.at(currentSlice,ay,ax,1) + CoM_y) / intensitySum;
 		}
 
 		//update stack -- ax,ay are unique per thread so this write is thread-safe without a lock
+		//bins are accumulated locally so that the shared output line is only written once per probe
+		std::vector<PRISMATIC_FLOAT_PRECISION> binnedOutput(pars.Ndet, 0);
 		auto idx = alphaInd.begin();
 		for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts){
 			if (*idx <= pars.Ndet){
-				pars.output.at(currentSlice,ay,ax,(*idx)-1) += *counts;
+				binnedOutput[(*idx)-1] += *counts;
 			}
 			++idx;
 		};
+		for (auto b = 0; b < pars.Ndet; ++b) pars.output.at(currentSlice,ay,ax,b) += binnedOutput[b];
 
 		//save 4D output if applicable
 		if (pars.meta.save4DOutput) {
 
             
-            Array2D<PRISMATIC_FLOAT_PRECISION> intOutput_small;
+            AlignedArray2D<PRISMATIC_FLOAT_PRECISION> intOutput_small = get4DOutputFrame(intOutput, pars);
             hsize_t mdims[4];
             mdims[0] = mdims[1] = {1};
-            
-            if(pars.meta.crop4DOutput)
-            {
-                intOutput_small = cropOutput(intOutput,pars);
-            }
-            else
-            {
-                intOutput_small = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{psi.get_dimj()/2, psi.get_dimi()/2}});
-                {
-                    long offset_x = psi.get_dimi() / 4;
-                    long offset_y = psi.get_dimj() / 4;
-                    long ndimy = (long) psi.get_dimj();
-                    long ndimx = (long) psi.get_dimi();
-                    for (long y = 0; y < psi.get_dimj() / 2; ++y) {
-                        for (long x = 0; x < psi.get_dimi() / 2; ++x) {
-                            intOutput_small.at(y, x) = intOutput.at(((y - offset_y) % ndimy + ndimy) % ndimy,
-                                                        ((x - offset_x) % ndimx + ndimx) % ndimx);
-                        }
-                    }
-                }
-            }
-
             mdims[2] = {intOutput_small.get_dimi()};
             mdims[3] = {intOutput_small.get_dimj()};
             // unique_lock<mutex> HDF5_gatekeeper(HDF5_lock);
@@ -290,7 +325,7 @@ namespace Prismatic{
             std::stringstream nameString;
             nameString << "4DSTEM_simulation/data/datacubes/CBED_array_depth" << getDigitString(currentSlice);
 
-            // H5::Group dataGroup = pars.outputFile.openGroup(nameString.str());
+            // H5::Group dataGroup = pars.outputWriter->getFile().openGroup(nameString.str());
             // H5::DataSet CBED_data = dataGroup.openDataSet("datacube");
 
             hsize_t offset[4] = {ax,ay,0,0}; //order by ax, ay so that aligns with py4DSTEM
@@ -304,96 +339,85 @@ namespace Prismatic{
 		}
 	}
 	void formatOutput_CPU_integrate_batch(Parameters<PRISMATIC_FLOAT_PRECISION>& pars,
-	                                      Array1D< complex<PRISMATIC_FLOAT_PRECISION> >& psi_stack,
+	                                      AlignedArray1D< complex<PRISMATIC_FLOAT_PRECISION> >& psi_stack,
 	                                      const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
 	                                      size_t Nstart,
 	                                      const size_t Nstop,
 										  const size_t currentSlice){
+		// psi_stack holds the probe conditions of each probe position next to each other
+		const size_t numConditions = pars.probeConditions.size();
+		const size_t numDepths = pars.output.get_diml() / numConditions;
 		int probe_idx = 0;
+		std::vector<PRISMATIC_FLOAT_PRECISION> binnedOutput(pars.Ndet, 0);
 		while (Nstart < Nstop) {
 			const size_t ay = Nstart / pars.xp.size();
 			const size_t ax = Nstart % pars.xp.size();
-			Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-					{{pars.psiProbeInit.get_dimj(), pars.psiProbeInit.get_dimi()}});
-			auto psi_ptr = &psi_stack[probe_idx*pars.psiProbeInit.size()];
-			for (auto &j:intOutput) j = pow(abs(*psi_ptr++), 2);
-
-			if (pars.meta.saveDPC_CoM){
-				//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
-				for (long y = 0; y < pars.psiProbeInit.get_dimj(); ++y){
-					for (long x = 0; x < pars.psiProbeInit.get_dimi(); ++x){
-						pars.DPC_CoM.at(currentSlice,ay,ax,0) += pars.qxa.at(y,x) * intOutput.at(y,x); 
-						pars.DPC_CoM.at(currentSlice,ay,ax,1) += pars.qya.at(y,x) * intOutput.at(y,x); 
+			for (auto c = 0; c < numConditions; ++c) {
+				const size_t layer = c * numDepths + currentSlice;
+				AlignedArray2D<PRISMATIC_FLOAT_PRECISION> intOutput = uninitialized_ND<2, PRISMATIC_FLOAT_PRECISION>(
+						{{pars.psiProbeInit.get_dimj(), pars.psiProbeInit.get_dimi()}});
+				auto psi_ptr = &psi_stack[(probe_idx * numConditions + c) * pars.psiProbeInit.size()];
+				for (auto &j:intOutput) j = pow(abs(*psi_ptr++), 2);
+
+				if (pars.meta.saveDPC_CoM){
+					//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
+					PRISMATIC_FLOAT_PRECISION CoM_x = 0;
+					PRISMATIC_FLOAT_PRECISION CoM_y = 0;
+					for (long y = 0; y < pars.psiProbeInit.get_dimj(); ++y){
+						for (long x = 0; x < pars.psiProbeInit.get_dimi(); ++x){
+							CoM_x += pars.qxa.at(y,x) * intOutput.at(y,x);
+							CoM_y += pars.qya.at(y,x) * intOutput.at(y,x);
+						}
 					}
-				}
-
-				//divide by sum of intensity
-				PRISMATIC_FLOAT_PRECISION intensitySum = 0;
-				for (auto iter = intOutput.begin(); iter != intOutput.end(); ++iter){
-					intensitySum += *iter;
-				}
-				pars.DPC_CoM.at(currentSlice,ay,ax,0) /= intensitySum; 
-				pars.DPC_CoM.at(currentSlice,ay,ax,1) /= intensitySum;
-			}
 
-			//update stack -- ax,ay are unique per thread so this write is thread-safe without a lock
-			auto idx = alphaInd.begin();
-			for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts) {
-				if (*idx <= pars.Ndet) {
-					pars.output.at(currentSlice, ay, ax, (*idx) - 1) += *counts;
+					//divide by sum of intensity
+					PRISMATIC_FLOAT_PRECISION intensitySum = 0;
+					for (auto iter = intOutput.begin(); iter != intOutput.end(); ++iter){
+						intensitySum += *iter;
+					}
+					pars.DPC_CoM.at(layer,ay,ax,0) = (pars.DPC_CoM.at(layer,ay,ax,0) + CoM_x) / intensitySum;
+					pars.DPC_CoM.at(layer,ay,ax,1) = (pars.DPC_CoM.at(layer,ay,ax,1) + CoM_y) / intensitySum;
 				}
-				++idx;
-			};
-
-            //save 4D output if applicable
-            if (pars.meta.save4DOutput) {
 
-                Array2D<PRISMATIC_FLOAT_PRECISION> intOutput_small;
-
-                hsize_t mdims[4];
-                mdims[0] = mdims[1] = {1};
-            
-                if(pars.meta.crop4DOutput)
-                {
-                    intOutput_small = cropOutput(intOutput,pars);
-                }
-                else
-                {
-                    intOutput_small = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{pars.psiProbeInit.get_dimj()/2, pars.psiProbeInit.get_dimi()/2}});
-                    {
-                        long offset_x = pars.psiProbeInit.get_dimi() / 4;
-                        long offset_y = pars.psiProbeInit.get_dimj() / 4;
-                        long ndimy = (long) pars.psiProbeInit.get_dimj();
-                        long ndimx = (long) pars.psiProbeInit.get_dimi();
-                        for (long y = 0; y < pars.psiProbeInit.get_dimj() / 2; ++y) {
-                            for (long x = 0; x < pars.psiProbeInit.get_dimi() / 2; ++x) {
-                                intOutput_small.at(y, x) = intOutput.at(((y - offset_y) % ndimy + ndimy) % ndimy,
-                                                            ((x - offset_x) % ndimx + ndimx) % ndimx);
-                            }
-                        }
-                    }
-                }
-
-                
-                mdims[2] = {intOutput_small.get_dimi()};
-                mdims[3] = {intOutput_small.get_dimj()};
-                //std::string section4DFilename = generateFilename(pars, currentSlice, ay, ax);
-                // unique_lock<mutex> HDF5_gatekeeper(HDF5_lock);
-                std::stringstream nameString;
-                nameString << "4DSTEM_simulation/data/datacubes/CBED_array_depth" << getDigitString(currentSlice);
-
-                // H5::Group dataGroup = pars.outputFile.openGroup(nameString.str());
-                // H5::DataSet CBED_data = dataGroup.openDataSet("datacube");
-
-                hsize_t offset[4] = {ax,ay,0,0}; //order by ax, ay so that aligns with py4DSTEM
-                PRISMATIC_FLOAT_PRECISION numFP = pars.meta.numFP;
-                writeDatacube4D(pars, &intOutput_small[0],mdims,offset,numFP,nameString.str());
-
-                // CBED_data.close();
-                // dataGroup.close();
-                // HDF5_gatekeeper.unlock();
-                //intOutput_small.toMRC_f(section4DFilename.c_str());
-            }
+				//update stack -- ax,ay are unique per thread so this write is thread-safe without a lock
+				//bins are accumulated locally so that the shared output line is only written once per probe
+				std::fill(binnedOutput.begin(), binnedOutput.end(), 0);
+				auto idx = alphaInd.begin();
+				for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts) {
+					if (*idx <= pars.Ndet) {
+						binnedOutput[(*idx) - 1] += *counts;
+					}
+					++idx;
+				};
+				for (auto b = 0; b < pars.Ndet; ++b) pars.output.at(layer, ay, ax, b) += binnedOutput[b];
+
+	            //save 4D output if applicable
+	            if (pars.meta.save4DOutput) {
+
+	                AlignedArray2D<PRISMATIC_FLOAT_PRECISION> intOutput_small = get4DOutputFrame(intOutput, pars);
+
+	                hsize_t mdims[4];
+	                mdims[0] = mdims[1] = {1};
+	                mdims[2] = {intOutput_small.get_dimi()};
+	                mdims[3] = {intOutput_small.get_dimj()};
+	                //std::string section4DFilename = generateFilename(pars, currentSlice, ay, ax);
+	                // unique_lock<mutex> HDF5_gatekeeper(HDF5_lock);
+	                std::stringstream nameString;
+	                nameString << "4DSTEM_simulation/data/datacubes/CBED_array_depth" << getLayerString(pars, layer, pars.output.get_diml());
+
+	                // H5::Group dataGroup = pars.outputWriter->getFile().openGroup(nameString.str());
+	                // H5::DataSet CBED_data = dataGroup.openDataSet("datacube");
+
+	                hsize_t offset[4] = {ax,ay,0,0}; //order by ax, ay so that aligns with py4DSTEM
+	                PRISMATIC_FLOAT_PRECISION numFP = pars.meta.numFP;
+	                writeDatacube4D(pars, &intOutput_small[0],mdims,offset,numFP,nameString.str());
+
+	                // CBED_data.close();
+	                // dataGroup.close();
+	                // HDF5_gatekeeper.unlock();
+	                //intOutput_small.toMRC_f(section4DFilename.c_str());
+	            }
+			}
 
 			++Nstart;
 			++probe_idx;
@@ -451,7 +475,7 @@ namespace Prismatic{
 				}
 			}
 		}
-		psi_small = fftshift2(psi_small);
+		fftshift2InPlace(psi_small);
 		kspace_probe = psi_small;
 		gatekeeper.lock();
 		PRISMATIC_FFTW_PLAN plan_inverse_small = PRISMATIC_FFTW_PLAN_DFT_2D(psi_small.get_dimj(), psi_small.get_dimi(),
@@ -476,11 +500,17 @@ namespace Prismatic{
 	                                  const size_t Nstop,
 	                                  PRISMATIC_FFTW_PLAN& plan_forward,
 	                                  PRISMATIC_FFTW_PLAN& plan_inverse,
-	                                  Array1D<complex<PRISMATIC_FLOAT_PRECISION> >& psi_stack){
+	                                  AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION> >& psi_stack){
+		// The batch holds every probe condition of each probe position, so that each transmission slice that is
+		// loaded is applied to all of them. Probe batch_idx of condition c is entry batch_idx * numConditions + c
+		const size_t numConditions = pars.probeConditions.size();
+		const size_t numProbes = min(pars.meta.batchSizeCPU, Nstop - Nstart) * numConditions;
 		{
 			auto psi_ptr = psi_stack.begin();
 			for (auto batch_num = 0; batch_num < min(pars.meta.batchSizeCPU, Nstop - Nstart); ++batch_num) {
-				for (auto i:pars.psiProbeInit)*psi_ptr++ = i;
+				for (auto &probe : pars.conditionProbeInit){
+					for (auto i:probe)*psi_ptr++ = i;
+				}
 			}
 		}
 		auto psi_ptr   = psi_stack.begin();
@@ -496,14 +526,18 @@ namespace Prismatic{
 				auto qxa_ptr = pars.qxa.begin();
 				auto qya_ptr = pars.qya.begin();
 				for (auto jj = 0; jj < pars.qxa.size(); ++jj) {
-					*psi_ptr++ *= exp(-2 * pi * i * ((*qxa_ptr++) * pars.xp[ax] +
-					                               (*qya_ptr++) * pars.yp[ay]));
+					const complex<PRISMATIC_FLOAT_PRECISION> shift = exp(-2 * pi * i * ((*qxa_ptr++) * pars.xp[ax] +
+					                                                                    (*qya_ptr++) * pars.yp[ay]));
+					for (auto c = 0; c < numConditions; ++c) psi_ptr[c * pars.qxa.size() + jj] *= shift;
 				}
 			}
+			psi_ptr += numConditions * pars.qxa.size();
 		}
 
-		auto scaled_prop = pars.prop;
-		for (auto& jj : scaled_prop) jj/=pars.psiProbeInit.size(); // apply FFT scaling factor here once in advance rather than at every plane
+		vector<Array2D<complex<PRISMATIC_FLOAT_PRECISION> > > scaled_prop(pars.conditionProp);
+		for (auto& prop : scaled_prop){
+			for (auto& jj : prop) jj/=pars.psiProbeInit.size(); // apply FFT scaling factor here once in advance rather than at every plane
+		}
 		complex<PRISMATIC_FLOAT_PRECISION>* slice_ptr = &pars.transmission[0];
 		size_t currentSlice = 0;
 
@@ -511,7 +545,7 @@ namespace Prismatic{
 				PRISMATIC_FFTW_EXECUTE(plan_inverse); // batch FFT
 
 				// transmit each of the probes in the batch
-				for (auto batch_idx = 0; batch_idx < min(pars.meta.batchSizeCPU, Nstop - Nstart); ++batch_idx){
+				for (auto batch_idx = 0; batch_idx < numProbes; ++batch_idx){
 					auto t_ptr   = slice_ptr; // start at the beginning of the current slice
 					auto psi_ptr = &psi_stack[batch_idx * pars.psiProbeInit.size()];
 					for (auto jj = 0; jj < pars.psiProbeInit.size(); ++jj){
@@ -522,8 +556,8 @@ namespace Prismatic{
 				PRISMATIC_FFTW_EXECUTE(plan_forward); // batch FFT
 
 				// propagate each of the probes in the batch
-				for (auto batch_idx = 0; batch_idx < min(pars.meta.batchSizeCPU, Nstop - Nstart); ++batch_idx){
-					auto p_ptr = scaled_prop.begin();
+				for (auto batch_idx = 0; batch_idx < numProbes; ++batch_idx){
+					auto p_ptr = scaled_prop[pars.conditionPropIndex[batch_idx % numConditions]].begin();
 					auto psi_ptr = &psi_stack[batch_idx * pars.psiProbeInit.size()];
 					for (auto jj = 0; jj < pars.psiProbeInit.size(); ++jj){
 						*psi_ptr++ *= (*p_ptr++);// propagate
@@ -601,22 +635,25 @@ namespace Prismatic{
 
 		// If the batch size is too big, the work won't be spread over the threads, which will usually hurt more than the benefit
 		// of batch FFT
-		pars.meta.batchSizeCPU = min(pars.meta.batchSizeTargetCPU, max((size_t)1, pars.xp.size() * pars.yp.size() / pars.meta.numThreads));
+		// Every probe position in a batch carries all of the probe conditions
+		const size_t numConditions = pars.probeConditions.size();
+		pars.meta.batchSizeCPU = min(max((size_t)1, pars.meta.batchSizeTargetCPU / numConditions), max((size_t)1, pars.xp.size() * pars.yp.size() / pars.meta.numThreads));
 		for (auto t = 0; t < pars.meta.numThreads; ++t){
 			cout << "Launching CPU worker #" << t << endl;
-			workers.push_back(thread([&pars, &dispatcher, t, &PRISMATIC_PRINT_FREQUENCY_PROBES]() {
+			workers.push_back(thread([&pars, &dispatcher, t, &PRISMATIC_PRINT_FREQUENCY_PROBES, numConditions]() {
+				pinCurrentThread(t, pars.meta);
 				size_t Nstart, Nstop;
                 Nstart=Nstop=0;
 				if (dispatcher.getWork(Nstart, Nstop, pars.meta.batchSizeCPU)){ // synchronously get work assignment
 
 					// Allocate memory for the propagated probes. These are 2D arrays, but as they will be operated on
 					// as a batch FFT they are all stacked together into one linearized array
-					Array1D<complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >({{pars.psiProbeInit.size() * pars.meta.batchSizeCPU}});
+					AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_aligned_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >({{pars.psiProbeInit.size() * pars.meta.batchSizeCPU * numConditions}});
 
 					// setup batch FFTW parameters
 					const int rank    = 2;
 					int n[]           = {(int)pars.psiProbeInit.get_dimj(), (int)pars.psiProbeInit.get_dimi()};
-					const int howmany = pars.meta.batchSizeCPU;
+					const int howmany = pars.meta.batchSizeCPU * numConditions;
 					int idist         = n[0]*n[1];
 					int odist         = n[0]*n[1];
 					int istride       = 1;
@@ -640,13 +677,13 @@ namespace Prismatic{
 					                                                         istride, idist,
 					                                                         reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), onembed,
 					                                                         ostride, odist,
-					                                                         FFTW_FORWARD, FFTW_MEASURE);
+					                                                         FFTW_FORWARD, getFFTWPlanningFlag(pars.meta));
 					PRISMATIC_FFTW_PLAN plan_inverse = PRISMATIC_FFTW_PLAN_DFT_BATCH(rank, n, howmany,
 					                                                         reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), inembed,
 					                                                         istride, idist,
 					                                                         reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), onembed,
 					                                                         ostride, odist,
-					                                                         FFTW_BACKWARD, FFTW_MEASURE);
+					                                                         FFTW_BACKWARD, getFFTWPlanningFlag(pars.meta));
 
 					gatekeeper.unlock();
 					// main work loop
@@ -660,6 +697,8 @@ namespace Prismatic{
 #ifdef PRISMATIC_BUILDING_GUI
                             pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+							if (pars.outputStreamer)
+								pars.outputStreamer->addProbes(Nstop - Nstart);
 							Nstart=Nstop;
 						}
 					} while(dispatcher.getWork(Nstart, Nstop, pars.meta.batchSizeCPU));
@@ -684,8 +723,8 @@ namespace Prismatic{
 		// setup detector coordinates and angles
 		setupDetector_multislice(pars);
 
-		// create initial probes
-		setupProbes_multislice(pars);
+		// create initial probes and propagators of each probe condition
+		setupProbeConditions_multislice(pars);
 
 		// create transmission array
 		createTransmission(pars);
@@ -699,6 +738,10 @@ namespace Prismatic{
 #endif
 
 		// create the output
+		startOutputStreamer(pars);
+		startDatacubeWriter(pars);
 		buildMultisliceOutput(pars);
+		finishDatacubeWriter(pars);
+		finishOutputStreamer(pars);
 	}
 }
@@ -301,6 +301,8 @@ namespace Prismatic{
 #ifdef PRISMATIC_BUILDING_GUI
 						pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+						if (pars.outputStreamer)
+							pars.outputStreamer->addProbes(Nstop - Nstart);
 						Nstart=Nstop;
 					}
 				}
@@ -333,7 +335,7 @@ namespace Prismatic{
 						early_CPU_stop = pars.xp.size() * pars.yp.size();
 					}
 					if (dispatcher.getWork(Nstart, Nstop, pars.meta.batchSizeCPU, early_CPU_stop)) { // synchronously get work assignment
-						Array1D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >({{pars.psiProbeInit.size() * pars.meta.batchSizeCPU}});
+						AlignedArray1D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_aligned_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >({{pars.psiProbeInit.size() * pars.meta.batchSizeCPU}});
 
 						// setup batch FFTW parameters
 						const int rank    = 2;
@@ -371,6 +373,8 @@ namespace Prismatic{
 #ifdef PRISMATIC_BUILDING_GUI
 								pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+								if (pars.outputStreamer)
+									pars.outputStreamer->addProbes(Nstop - Nstart);
 								Nstart=Nstop;
 							}
 							if (Nstop >= early_CPU_stop) break;
@@ -464,6 +468,8 @@ namespace Prismatic{
 #ifdef PRISMATIC_BUILDING_GUI
 						pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+						if (pars.outputStreamer)
+							pars.outputStreamer->addProbes(Nstop - Nstart);
 						Nstart = Nstop;
 					}
 				}
@@ -492,7 +498,7 @@ namespace Prismatic{
 						early_CPU_stop = pars.xp.size() * pars.yp.size();
 					}
 					if (dispatcher.getWork(Nstart, Nstop, pars.meta.batchSizeCPU, early_CPU_stop)) { // synchronously get work assignment
-						Array1D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >({{pars.psiProbeInit.size() * pars.meta.batchSizeCPU}});
+						AlignedArray1D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_aligned_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >({{pars.psiProbeInit.size() * pars.meta.batchSizeCPU}});
 
 						// setup batch FFTW parameters
 						const int rank = 2;
@@ -530,6 +536,8 @@ namespace Prismatic{
 #ifdef PRISMATIC_BUILDING_GUI
 								pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+								if (pars.outputStreamer)
+									pars.outputStreamer->addProbes(Nstop - Nstart);
 								Nstart=Nstop;
 							}
 							if (Nstop >= early_CPU_stop) break;
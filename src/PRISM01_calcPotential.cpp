@@ -25,7 +25,9 @@
 #include "ArrayND.h"
 #include "projectedPotential.h"
 #include "WorkDispatcher.h"
+#include "memoryPlacement.h"
 #include "utility.h"
+#include "mappedStorage.h"
 
 #ifdef PRISMATIC_BUILDING_GUI
 #include "prism_progressbar.h"
@@ -113,6 +115,7 @@ void generateProjectedPotentials(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 
 	// initialize the potential array
 	pars.pot = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{pars.numPlanes, pars.imageSize[0], pars.imageSize[1]}});
+	placeZeroedArray(pars.pot, pars.meta);
 
 	// create a key-value map to match the atomic Z numbers with their place in the potential lookup table
 	map<size_t, size_t> Z_lookup;
@@ -129,7 +132,8 @@ void generateProjectedPotentials(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	{
 		cout << "Launching thread #" << t << " to compute projected potential slices\n";
 		workers.push_back(thread([&pars, &x, &y, &z, &ID, &Z_lookup, &xvec, &sigma, &occ,
-								  &zPlane, &yvec, &potentialLookup, &dispatcher]() {
+								  &zPlane, &yvec, &potentialLookup, &dispatcher, t]() {
+			pinCurrentThread(t, pars.meta);
 			// create a random number generator to simulate thermal effects
 			// std::cout<<"random seed = " << pars.meta.randomSeed << std::endl;
 			// srand(pars.meta.randomSeed);
@@ -214,12 +218,27 @@ void generateProjectedPotentials(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 #endif //PRISMATIC_BUILDING_GUI
 };
 
-void PRISM01_calcPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+// potential of a frozen phonon configuration kept for the runs of an energy series. It is spilled to a scratch file so
+// that the cache holds no memory besides the page cache, which the system can reclaim. If the file can't be created,
+// only the random seed is kept and the potential is computed again from it
+struct CachedPotential
 {
-	//builds projected, sliced potential
+	PRISMATIC_FLOAT_PRECISION randomSeed;
+	std::array<size_t, 3> dims;
+	std::shared_ptr<MappedFile> file;
+};
 
+// potentials of the frozen phonon configurations of an energy series, by fpNum
+static map<size_t, CachedPotential> potentialCache;
+
+void clearPotentialCache()
+{
+	potentialCache.clear();
+}
+
+static void computePotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
 	// setup some coordinates
-	cout << "Entering PRISM01_calcPotential" << endl;
 	PRISMATIC_FLOAT_PRECISION yleng = std::ceil(pars.meta.potBound / pars.pixelSize[0]);
 	PRISMATIC_FLOAT_PRECISION xleng = std::ceil(pars.meta.potBound / pars.pixelSize[1]);
 	ArrayND<1, vector<long>> xvec(vector<long>(2 * (size_t)xleng + 1, 0), {{2 * (size_t)xleng + 1}});
@@ -249,11 +268,64 @@ void PRISM01_calcPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 	// populate the slices with the projected potentials
 	generateProjectedPotentials(pars, potentialLookup, unique_species, xvec, yvec);
+}
+
+void PRISM01_calcPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//builds projected, sliced potential
+	cout << "Entering PRISM01_calcPotential" << endl;
+
+	// The potential does not depend on the electron energy, so the runs of an energy series compute it once per
+	// frozen phonon configuration and reuse it, together with its random seed, for the remaining energies
+	auto cached = potentialCache.find(pars.meta.fpNum);
+	if (!pars.meta.energySeries.empty() & (cached != potentialCache.end()))
+	{
+		pars.meta.randomSeed = cached->second.randomSeed;
+		if (cached->second.file)
+		{
+			cout << "Reusing the potential of frozen phonon configuration #" << pars.meta.fpNum << endl;
+			const PRISMATIC_FLOAT_PRECISION *ptr = (const PRISMATIC_FLOAT_PRECISION *)cached->second.file->data();
+			const std::array<size_t, 3> &dims = cached->second.dims;
+			pars.pot = Array3D<PRISMATIC_FLOAT_PRECISION>(vector<PRISMATIC_FLOAT_PRECISION>(ptr, ptr + dims[0] * dims[1] * dims[2]), dims);
+			pars.numPlanes = pars.pot.get_dimk();
+			if (pars.meta.numSlices == 0)
+			{
+				pars.numSlices = pars.numPlanes;
+			}
+		}
+		else
+		{
+			cout << "Recomputing the potential of frozen phonon configuration #" << pars.meta.fpNum << " from its random seed" << endl;
+			computePotential(pars);
+		}
+	}
+	else
+	{
+		computePotential(pars);
+		if (!pars.meta.energySeries.empty())
+		{
+			CachedPotential entry;
+			entry.randomSeed = pars.meta.randomSeed;
+			entry.dims = {{pars.pot.get_dimk(), pars.pot.get_dimj(), pars.pot.get_dimi()}};
+			try
+			{
+				const string filename = pars.meta.filenameOutput + ".potential" + getDigitString(pars.meta.fpNum);
+				entry.file = std::make_shared<MappedFile>(filename, pars.pot.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+				std::memcpy(entry.file->data(), &pars.pot[0], pars.pot.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+			}
+			catch (const std::runtime_error &e)
+			{
+				cout << e.what() << "The potential will be computed again for the other energies" << endl;
+				entry.file.reset();
+			}
+			potentialCache[pars.meta.fpNum] = entry;
+		}
+	}
 
 	if (pars.meta.savePotentialSlices)
 	{
 		//create new datacube group
-		H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+		H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 		std::string groupName = "ppotential";
 		H5::Group ppotential;
 		if (pars.fpFlag == 0)
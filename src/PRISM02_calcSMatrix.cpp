@@ -15,14 +15,20 @@
 #include "params.h"
 #include <iostream>
 #include <vector>
+#include <string>
+#include <sstream>
 #include <thread>
 #include "fftw3.h"
 #include <mutex>
 #include "ArrayND.h"
 #include <complex>
+#include <cstdint>
 #include "utility.h"
 #include "configure.h"
 #include "WorkDispatcher.h"
+#include "memoryPlacement.h"
+#include "reducedPrecision.h"
+#include "H5Cpp.h"
 #ifdef PRISMATIC_BUILDING_GUI
 #include "prism_progressbar.h"
 #endif
@@ -194,6 +200,120 @@ inline void downsampleFourierComponents(Parameters<PRISMATIC_FLOAT_PRECISION> &p
 	}
 }
 
+void allocateScompact(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// allocates zeroed storage for pars.numberBeams beams of the compact S-matrix. An out-of-core S-matrix is
+	// written straight into its mapped file, and a reduced precision one straight into its 16-bit storage
+	pars.ScompactFile.reset();
+	pars.Scompact = Array3D<complex<PRISMATIC_FLOAT_PRECISION>>();
+	if (pars.meta.filenameScompact != "")
+	{
+		const size_t B = PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK;
+		const size_t numBlocks = (pars.numberBeams + B - 1) / B;
+		const size_t bytes = numBlocks * B * (pars.imageSize[0] / 2) * (pars.imageSize[1] / 2) * sizeof(complex<PRISMATIC_FLOAT_PRECISION>);
+		try
+		{
+			pars.ScompactFile = std::make_shared<MappedFile>(pars.meta.filenameScompact, bytes);
+			cout << "Storing the compact S-matrix (" << (double)bytes / (1024 * 1024) << " MB) in " << pars.meta.filenameScompact << endl;
+		}
+		catch (const std::runtime_error &e)
+		{
+			cout << e.what() << "Storing the compact S-matrix in memory instead" << endl;
+		}
+	}
+	if (!pars.ScompactFile)
+	{
+		if (pars.meta.scompactPrecision == ScompactPrecision::Full)
+		{
+			pars.Scompact = zeros_ND<3, complex<PRISMATIC_FLOAT_PRECISION>>(
+				{{pars.numberBeams, pars.imageSize[0] / 2, pars.imageSize[1] / 2}});
+			placeZeroedArray(pars.Scompact, pars.meta);
+		}
+		else
+		{
+			pars.ScompactReduced = zeros_ND<3, uint16_t>({{pars.numberBeams, pars.imageSize[0] / 2, pars.imageSize[1]}});
+			pars.ScompactScale = std::vector<PRISMATIC_FLOAT_PRECISION>(pars.numberBeams, 1);
+			pars.ScompactRelativeError = std::vector<PRISMATIC_FLOAT_PRECISION>(pars.numberBeams, 0);
+			placeZeroedArray(pars.ScompactReduced, pars.meta);
+		}
+	}
+}
+
+std::complex<PRISMATIC_FLOAT_PRECISION> getScompact(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+												const size_t beam, const size_t y, const size_t x)
+{
+	// reads a single value of the compact S-matrix from whichever storage holds it
+	const size_t dimy = pars.imageSize[0] / 2;
+	const size_t dimx = pars.imageSize[1] / 2;
+	if (pars.ScompactFile)
+	{
+		const size_t B = PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK;
+		return static_cast<const complex<PRISMATIC_FLOAT_PRECISION> *>(pars.ScompactFile->data())
+			[((beam / B) * dimy * dimx + y * dimx + x) * B + beam % B];
+	}
+	if (pars.meta.scompactPrecision == ScompactPrecision::Full)
+		return pars.Scompact.at(beam, y, x);
+	return complex<PRISMATIC_FLOAT_PRECISION>(
+			   decodeValue16(pars.ScompactReduced.at(beam, y, 2 * x), pars.meta.scompactPrecision),
+			   decodeValue16(pars.ScompactReduced.at(beam, y, 2 * x + 1), pars.meta.scompactPrecision)) *
+		   pars.ScompactScale[beam];
+}
+
+void storeScompactBeam(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					   const size_t currentBeam,
+					   AlignedArray2D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_small,
+					   const PRISMATIC_FLOAT_PRECISION N_small)
+{
+	// writes one cropped/propagated plane wave into the compact S-matrix, dividing it by N_small to normalize the
+	// FFT and encoding it in the requested storage format. Each beam is written by exactly one thread
+	if (pars.ScompactFile)
+	{
+		// scatter the beam into its block of the file, one value per pixel
+		const size_t B = PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK;
+		complex<PRISMATIC_FLOAT_PRECISION> *S_t = static_cast<complex<PRISMATIC_FLOAT_PRECISION> *>(pars.ScompactFile->data()) +
+												  (currentBeam / B) * psi_small.size() * B + currentBeam % B;
+		for (auto &jj : psi_small)
+		{
+			*S_t = jj / N_small;
+			S_t += B;
+		}
+		return;
+	}
+	if (pars.meta.scompactPrecision == ScompactPrecision::Full)
+	{
+		complex<PRISMATIC_FLOAT_PRECISION> *S_t = &pars.Scompact[currentBeam * pars.Scompact.get_dimj() * pars.Scompact.get_dimi()];
+		for (auto &jj : psi_small)
+		{
+			*S_t++ = jj / N_small;
+		}
+		return;
+	}
+	double errorSq = 0;
+	double normSq = 0;
+	pars.ScompactScale[currentBeam] = encodeComplex16(&psi_small[0], psi_small.size(), 1 / N_small,
+													  &pars.ScompactReduced[currentBeam * pars.ScompactReduced.get_dimj() * pars.ScompactReduced.get_dimi()],
+													  pars.meta.scompactPrecision, errorSq, normSq);
+	pars.ScompactRelativeError[currentBeam] = (normSq > 0) ? sqrt(errorSq / normSq) : 0;
+}
+
+void reportScompactPrecision(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// summarizes the encoding error of a reduced precision S-matrix relative to the full precision result
+	if (pars.meta.scompactPrecision == ScompactPrecision::Full)
+		return;
+	PRISMATIC_FLOAT_PRECISION maxError = 0;
+	PRISMATIC_FLOAT_PRECISION meanError = 0;
+	for (auto &e : pars.ScompactRelativeError)
+	{
+		maxError = max(maxError, e);
+		meanError += e;
+	}
+	meanError /= max((size_t)1, pars.ScompactRelativeError.size());
+	cout << "Compact S-matrix stored in " << (double)(pars.ScompactReduced.size() * sizeof(uint16_t)) / (1024 * 1024)
+		 << " MB instead of " << (double)(pars.ScompactReduced.size() * sizeof(PRISMATIC_FLOAT_PRECISION)) / (1024 * 1024) << " MB" << endl;
+	cout << "Relative RMS encoding error per beam: mean = " << meanError << ", max = " << maxError << endl;
+}
+
 void propagatePlaneWave_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 							size_t currentBeam,
 							Array2D<complex<PRISMATIC_FLOAT_PRECISION>> &psi,
@@ -223,7 +343,7 @@ void propagatePlaneWave_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	PRISMATIC_FFTW_EXECUTE(plan_forward); // final FFT to get result at detector plane
 
 	// only keep the necessary plane waves
-	Array2D<complex<PRISMATIC_FLOAT_PRECISION>> psi_small = zeros_ND<2, complex<PRISMATIC_FLOAT_PRECISION>>(
+	AlignedArray2D<complex<PRISMATIC_FLOAT_PRECISION>> psi_small = uninitialized_ND<2, complex<PRISMATIC_FLOAT_PRECISION>>(
 		{{pars.qyInd.size(), pars.qxInd.size()}});
 
 	unique_lock<mutex> gatekeeper(fftw_plan_lock);
@@ -247,18 +367,13 @@ void propagatePlaneWave_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	gatekeeper.unlock();
 
 	// insert the cropped/propagated plane wave into the relevant slice of the compact S-matrix
-	complex<PRISMATIC_FLOAT_PRECISION> *S_t = &pars.Scompact[currentBeam * pars.Scompact.get_dimj() * pars.Scompact.get_dimi()];
-	const PRISMATIC_FLOAT_PRECISION N_small = (PRISMATIC_FLOAT_PRECISION)psi_small.size();
-	for (auto &jj : psi_small)
-	{
-		*S_t++ = jj / N_small;
-	}
+	storeScompactBeam(pars, currentBeam, psi_small, (PRISMATIC_FLOAT_PRECISION)psi_small.size());
 }
 
 void propagatePlaneWave_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 								  size_t currentBeam,
 								  size_t stopBeam,
-								  Array1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack,
+								  AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack,
 								  const PRISMATIC_FFTW_PLAN &plan_forward,
 								  const PRISMATIC_FFTW_PLAN &plan_inverse,
 								  mutex &fftw_plan_lock)
@@ -311,9 +426,8 @@ void propagatePlaneWave_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	PRISMATIC_FFTW_EXECUTE(plan_forward);
 
 	// only keep the necessary plane waves
-	Array2D<complex<PRISMATIC_FLOAT_PRECISION>> psi_small = zeros_ND<2, complex<PRISMATIC_FLOAT_PRECISION>>(
+	AlignedArray2D<complex<PRISMATIC_FLOAT_PRECISION>> psi_small = uninitialized_ND<2, complex<PRISMATIC_FLOAT_PRECISION>>(
 		{{pars.qyInd.size(), pars.qxInd.size()}});
-	const PRISMATIC_FLOAT_PRECISION N_small = (PRISMATIC_FLOAT_PRECISION)psi_small.size();
 	unique_lock<mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_final = PRISMATIC_FFTW_PLAN_DFT_2D(psi_small.get_dimj(), psi_small.get_dimi(),
 																reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_small[0]),
@@ -331,11 +445,7 @@ void propagatePlaneWave_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 			}
 		}
 		PRISMATIC_FFTW_EXECUTE(plan_final);
-		complex<PRISMATIC_FLOAT_PRECISION> *S_t = &pars.Scompact[currentBeam * pars.Scompact.get_dimj() * pars.Scompact.get_dimi()];
-		for (auto &jj : psi_small)
-		{
-			*S_t++ = jj / N_small;
-		}
+		storeScompactBeam(pars, currentBeam, psi_small, (PRISMATIC_FLOAT_PRECISION)psi_small.size());
 		++currentBeam;
 		++batch_idx;
 	}
@@ -351,10 +461,10 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	extern mutex fftw_plan_lock; // lock for protecting FFTW plans
 
 	// initialize arrays
-	pars.Scompact = zeros_ND<3, complex<PRISMATIC_FLOAT_PRECISION>>(
-		{{pars.numberBeams, pars.imageSize[0] / 2, pars.imageSize[1] / 2}});
+	allocateScompact(pars);
 	pars.transmission = zeros_ND<3, complex<PRISMATIC_FLOAT_PRECISION>>(
 		{{pars.pot.get_dimk(), pars.pot.get_dimj(), pars.pot.get_dimi()}});
+	placeZeroedArray(pars.transmission, pars.meta);
 	{
 		auto p = pars.pot.begin();
 		for (auto &j : pars.transmission)
@@ -374,7 +484,8 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	for (auto t = 0; t < pars.meta.numThreads; ++t)
 	{
 		cout << "Launching thread #" << t << " to compute beams\n";
-		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_BEAMS]() {
+		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_BEAMS, t]() {
+			pinCurrentThread(t, pars.meta);
 			// allocate array for psi just once per thread
 			//				Array2D<complex<PRISMATIC_FLOAT_PRECISION> > psi = zeros_ND<2, complex<PRISMATIC_FLOAT_PRECISION> >(
 			//						{{pars.imageSize[0], pars.imageSize[1]}});
@@ -382,7 +493,7 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 			currentBeam = stopBeam = 0;
 			if (dispatcher.getWork(currentBeam, stopBeam, pars.meta.batchSizeCPU))
 			{
-				Array1D<complex<PRISMATIC_FLOAT_PRECISION>> psi_stack = zeros_ND<1, complex<PRISMATIC_FLOAT_PRECISION>>(
+				AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION>> psi_stack = uninitialized_ND<1, complex<PRISMATIC_FLOAT_PRECISION>>(
 					{{pars.imageSize[0] * pars.imageSize[1] * pars.meta.batchSizeCPU}});
 				//				PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
 				//				                                                      reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
@@ -412,7 +523,7 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 																				 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]),
 																				 onembed,
 																				 ostride, odist,
-																				 FFTW_FORWARD, FFTW_MEASURE);
+																				 FFTW_FORWARD, getFFTWPlanningFlag(pars.meta));
 				PRISMATIC_FFTW_PLAN plan_inverse = PRISMATIC_FFTW_PLAN_DFT_BATCH(rank, n, howmany,
 																				 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]),
 																				 inembed,
@@ -420,7 +531,7 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 																				 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]),
 																				 onembed,
 																				 ostride, odist,
-																				 FFTW_BACKWARD, FFTW_MEASURE);
+																				 FFTW_BACKWARD, getFFTWPlanningFlag(pars.meta));
 				gatekeeper.unlock(); // unlock it so we only block as long as necessary to deal with plans
 
 				// main work loop
@@ -492,8 +603,242 @@ void PRISM02_calcSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 	// populate compact S-matrix
 	fill_Scompact(pars);
+	reportScompactPrecision(pars);
 
 	// only keep the relevant/nonzero Fourier components
 	downsampleFourierComponents(pars);
 }
+
+static const H5::PredType &floatType()
+{
+	return (sizeof(PRISMATIC_FLOAT_PRECISION) == sizeof(float)) ? H5::PredType::NATIVE_FLOAT : H5::PredType::NATIVE_DOUBLE;
+}
+
+// FNV-1a hash of the tiled atom list, identifying the specimen without storing it. It is kept as four 16 bit
+// words so that each one is exactly representable and compares exactly within the tolerance used for settings
+static vector<double> getAtomsHash(const vector<atom> &atoms)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](const void *data, const size_t bytes) {
+		const unsigned char *ptr = (const unsigned char *)data;
+		for (size_t j = 0; j < bytes; ++j)
+		{
+			hash ^= ptr[j];
+			hash *= 1099511628211ULL;
+		}
+	};
+	for (auto &a : atoms)
+	{
+		const uint64_t species = a.species;
+		mix(&a.x, sizeof(a.x));
+		mix(&a.y, sizeof(a.y));
+		mix(&a.z, sizeof(a.z));
+		mix(&species, sizeof(species));
+		mix(&a.sigma, sizeof(a.sigma));
+		mix(&a.occ, sizeof(a.occ));
+	}
+	vector<double> words;
+	for (auto shift = 0; shift < 64; shift += 16)
+		words.push_back((double)((hash >> shift) & 0xFFFF));
+	return words;
+}
+
+// the settings that determine the compact S-matrix. A saved S-matrix can only be loaded by a run in which all of
+// these are the same; the probe, scan, and detector settings are free to change
+static vector<pair<string, vector<double>>> getSMatrixSettings(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	vector<pair<string, vector<double>>> settings;
+	settings.push_back(make_pair("atomsHash", getAtomsHash(pars.atoms)));
+	settings.push_back(make_pair("tiles", vector<double>{(double)pars.meta.tileX, (double)pars.meta.tileY, (double)pars.meta.tileZ}));
+	settings.push_back(make_pair("numFP", vector<double>{(double)pars.meta.numFP}));
+	settings.push_back(make_pair("E0", vector<double>{pars.meta.E0}));
+	settings.push_back(make_pair("tiledCellDim", vector<double>(pars.tiledCellDim.begin(), pars.tiledCellDim.end())));
+	settings.push_back(make_pair("imageSize", vector<double>{(double)pars.imageSize[0], (double)pars.imageSize[1]}));
+	settings.push_back(make_pair("pixelSize", vector<double>(pars.pixelSize.begin(), pars.pixelSize.end())));
+	settings.push_back(make_pair("interpolationFactor", vector<double>{(double)pars.meta.interpolationFactorY, (double)pars.meta.interpolationFactorX}));
+	settings.push_back(make_pair("alphaBeamMax", vector<double>{pars.meta.alphaBeamMax}));
+	settings.push_back(make_pair("sliceThickness", vector<double>{pars.meta.sliceThickness}));
+	settings.push_back(make_pair("potBound", vector<double>{pars.meta.potBound}));
+	settings.push_back(make_pair("includeThermalEffects", vector<double>{(double)pars.meta.includeThermalEffects}));
+	return settings;
+}
+
+static void writeAttribute(H5::H5Object &obj, const string &name, const vector<double> &values)
+{
+	hsize_t dims[1] = {values.size()};
+	H5::DataSpace space(1, dims);
+	H5::Attribute attr = obj.createAttribute(name, H5::PredType::NATIVE_DOUBLE, space);
+	attr.write(H5::PredType::NATIVE_DOUBLE, &values[0]);
+}
+
+static vector<double> readAttribute(H5::H5Object &obj, const string &name)
+{
+	if (!obj.attrExists(name))
+		throw std::runtime_error("attribute \"" + name + "\" is missing\n");
+	H5::Attribute attr = obj.openAttribute(name);
+	vector<double> values(attr.getSpace().getSimpleExtentNpoints());
+	attr.read(H5::PredType::NATIVE_DOUBLE, &values[0]);
+	return values;
+}
+
+static void writeArray2D(H5::Group &group, const string &name, Array2D<PRISMATIC_FLOAT_PRECISION> &arr)
+{
+	hsize_t dims[2] = {arr.get_dimj(), arr.get_dimi()};
+	H5::DataSpace space(2, dims);
+	H5::DataSet data = group.createDataSet(name, floatType(), space);
+	data.write(&arr[0], floatType());
+}
+
+static Array2D<PRISMATIC_FLOAT_PRECISION> readArray2D(H5::Group &group, const string &name)
+{
+	H5::DataSet data = group.openDataSet(name);
+	hsize_t dims[2];
+	data.getSpace().getSimpleExtentDims(dims);
+	Array2D<PRISMATIC_FLOAT_PRECISION> arr = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{(size_t)dims[0], (size_t)dims[1]}});
+	data.read(&arr[0], floatType());
+	return arr;
+}
+
+static string getSMatrixGroupName(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	return "frozen_phonon" + getDigitString(pars.fpFlag);
+}
+
+void saveSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// Saves the compact S-matrix of the current frozen phonon configuration in full precision. The first
+	// configuration creates the file along with the settings and beam/grid data shared by every configuration,
+	// each configuration then adds a group holding its S-matrix as [beam][y][x][real/imaginary]
+	cout << "Saving compact S-matrix to " << pars.meta.filenameSaveSMatrix << endl;
+	try
+	{
+		H5::H5File file(pars.meta.filenameSaveSMatrix.c_str(), (pars.fpFlag == 0) ? H5F_ACC_TRUNC : H5F_ACC_RDWR);
+		H5::Group root = file.openGroup("/");
+		if (pars.fpFlag == 0)
+		{
+			for (auto &setting : getSMatrixSettings(pars))
+				writeAttribute(root, setting.first, setting.second);
+			writeAttribute(root, "qMax", vector<double>{pars.qMax});
+			writeAttribute(root, "randomSeed", vector<double>{pars.meta.randomSeed});
+
+			vector<unsigned long long> beamsIndex(pars.beamsIndex.begin(), pars.beamsIndex.end());
+			hsize_t beam_dims[1] = {beamsIndex.size()};
+			H5::DataSpace beam_space(1, beam_dims);
+			H5::DataSet beam_data = root.createDataSet("beamsIndex", H5::PredType::NATIVE_ULLONG, beam_space);
+			beam_data.write(&beamsIndex[0], H5::PredType::NATIVE_ULLONG);
+			writeArray2D(root, "beamsOutput", pars.beamsOutput);
+			writeArray2D(root, "qxaOutput", pars.qxaOutput);
+			writeArray2D(root, "qyaOutput", pars.qyaOutput);
+		}
+
+		H5::Group group = file.createGroup(getSMatrixGroupName(pars));
+		const size_t dimy = pars.imageSize[0] / 2;
+		const size_t dimx = pars.imageSize[1] / 2;
+		hsize_t dims[4] = {pars.numberBeams, dimy, dimx, 2};
+		H5::DataSpace fspace(4, dims);
+		H5::DataSet data = group.createDataSet("Scompact", floatType(), fspace);
+
+		// one beam at a time, so that reduced precision and out-of-core S-matrices are never expanded in memory
+		hsize_t mdims[4] = {1, dimy, dimx, 2};
+		H5::DataSpace mspace(4, mdims);
+		vector<complex<PRISMATIC_FLOAT_PRECISION>> beam(dimy * dimx);
+		for (auto b = 0; b < pars.numberBeams; ++b)
+		{
+			auto ptr = beam.begin();
+			for (auto y = 0; y < dimy; ++y)
+			{
+				for (auto x = 0; x < dimx; ++x)
+					*ptr++ = getScompact(pars, b, y, x);
+			}
+			hsize_t offset[4] = {(hsize_t)b, 0, 0, 0};
+			fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
+			data.write(&beam[0], floatType(), mspace, fspace);
+		}
+	}
+	catch (const H5::Exception &e)
+	{
+		throw std::runtime_error("Unable to save the compact S-matrix to " + pars.meta.filenameSaveSMatrix + "\n");
+	}
+}
+
+void loadSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// Loads a compact S-matrix written by saveSMatrix in place of running PRISM01 and PRISM02, after checking that
+	// it was computed with the same settings as this run. It is stored in the format requested by this run
+	cout << "Loading compact S-matrix from " << pars.meta.filenameLoadSMatrix << endl;
+	try
+	{
+		H5::H5File file(pars.meta.filenameLoadSMatrix.c_str(), H5F_ACC_RDONLY);
+		H5::Group root = file.openGroup("/");
+		vector<pair<string, vector<double>>> settings = getSMatrixSettings(pars);
+		// the saved configurations are looked up by their index, the seed of the first one identifies the whole series
+		if (pars.meta.includeThermalEffects & (pars.fpFlag == 0))
+			settings.push_back(make_pair("randomSeed", vector<double>{pars.meta.randomSeed}));
+		for (auto &setting : settings)
+		{
+			const vector<double> saved = readAttribute(root, setting.first);
+			bool match = saved.size() == setting.second.size();
+			for (auto j = 0; match & (j < saved.size()); ++j)
+				match = std::abs(saved[j] - setting.second[j]) <= 1e-6 * std::max(std::abs(saved[j]), std::abs(setting.second[j]));
+			if (!match)
+			{
+				stringstream ss;
+				ss << "The saved S-matrix has a different " << setting.first << " (";
+				for (auto &v : saved)
+					ss << ' ' << v;
+				ss << " ) than this simulation (";
+				for (auto &v : setting.second)
+					ss << ' ' << v;
+				ss << " )\n";
+				throw std::runtime_error(ss.str());
+			}
+		}
+		const string groupName = getSMatrixGroupName(pars);
+		if (H5Lexists(file.getId(), groupName.c_str(), H5P_DEFAULT) <= 0)
+			throw std::runtime_error("The saved S-matrix has no frozen phonon configuration #" + to_string(pars.fpFlag) + "\n");
+
+		pars.qMax = readAttribute(root, "qMax")[0];
+		{
+			H5::DataSet beam_data = root.openDataSet("beamsIndex");
+			vector<unsigned long long> beamsIndex(beam_data.getSpace().getSimpleExtentNpoints());
+			beam_data.read(&beamsIndex[0], H5::PredType::NATIVE_ULLONG);
+			pars.beamsIndex = vector<size_t>(beamsIndex.begin(), beamsIndex.end());
+			pars.numberBeams = pars.beamsIndex.size();
+		}
+		pars.beamsOutput = readArray2D(root, "beamsOutput");
+		pars.qxaOutput = readArray2D(root, "qxaOutput");
+		pars.qyaOutput = readArray2D(root, "qyaOutput");
+		pars.imageSizeOutput = pars.imageSize;
+		pars.imageSizeOutput[0] /= 2;
+		pars.imageSizeOutput[1] /= 2;
+		pars.pixelSizeOutput = pars.pixelSize;
+		pars.pixelSizeOutput[0] *= 2;
+		pars.pixelSizeOutput[1] *= 2;
+
+		H5::DataSet data = file.openGroup(groupName).openDataSet("Scompact");
+		H5::DataSpace fspace = data.getSpace();
+		hsize_t dims[4];
+		fspace.getSimpleExtentDims(dims);
+		if ((dims[0] != pars.numberBeams) | (dims[1] != pars.imageSizeOutput[0]) | (dims[2] != pars.imageSizeOutput[1]) | (dims[3] != 2))
+			throw std::runtime_error("The saved S-matrix does not match its beam and grid data\n");
+
+		allocateScompact(pars);
+		hsize_t mdims[4] = {1, dims[1], dims[2], 2};
+		H5::DataSpace mspace(4, mdims);
+		AlignedArray2D<complex<PRISMATIC_FLOAT_PRECISION>> psi_small = uninitialized_ND<2, complex<PRISMATIC_FLOAT_PRECISION>>(
+			{{pars.imageSizeOutput[0], pars.imageSizeOutput[1]}});
+		for (auto b = 0; b < pars.numberBeams; ++b)
+		{
+			hsize_t offset[4] = {(hsize_t)b, 0, 0, 0};
+			fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
+			data.read(&psi_small[0], floatType(), mspace, fspace);
+			storeScompactBeam(pars, b, psi_small, 1);
+		}
+	}
+	catch (const H5::Exception &e)
+	{
+		throw std::runtime_error("Unable to read a compact S-matrix from " + pars.meta.filenameLoadSMatrix + "\n");
+	}
+	reportScompactPrecision(pars);
+}
 } // namespace Prismatic
@@ -434,7 +434,7 @@ namespace Prismatic {
 					if (dispatcher.getWork(currentBeam, stopBeam, pars.meta.batchSizeCPU, early_CPU_stop)) {
 
 						// allocate array to hold the batch of propagated plane waves
-						Array1D<complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >(
+						AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = uninitialized_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >(
 								{{pars.imageSize[0]*pars.imageSize[1]*pars.meta.batchSizeCPU}});
 
 //						 setup batch FFTW parameters
@@ -619,7 +619,7 @@ namespace Prismatic {
 
 					if (dispatcher.getWork(currentBeam, stopBeam, pars.meta.batchSizeCPU, early_CPU_stop)) {
 						// allocate array for psi just once per thread
-						Array1D<complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = zeros_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >(
+						AlignedArray1D<complex<PRISMATIC_FLOAT_PRECISION> > psi_stack = uninitialized_ND<1, complex<PRISMATIC_FLOAT_PRECISION> >(
 								{{pars.imageSize[0]*pars.imageSize[1]*pars.meta.batchSizeCPU}});
 
 						// setup batch FFTW parameters
@@ -24,7 +24,10 @@
 #include "fftw3.h"
 #include "utility.h"
 #include "WorkDispatcher.h"
+#include "memoryPlacement.h"
 #include "ArrayND.h"
+#include "reducedPrecision.h"
+#include "PRISM02_calcSMatrix.h"
 
 #ifdef PRISMATIC_BUILDING_GUI
 #include "prism_progressbar.h"
@@ -158,13 +161,15 @@ void setupBeams_2(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 void createStack_integrate(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
-	// create output of a size corresponding to 3D mode (integration)
+	// create output of a size corresponding to 3D mode (integration), one layer per probe condition
 
-	pars.output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{1, pars.yp.size(), pars.xp.size(), pars.Ndet}});
-	size_t numLayers = 1;
+	size_t numLayers = max((size_t)1, pars.probeConditions.size());
+	pars.output = zeros_aligned_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers, pars.yp.size(), pars.xp.size(), pars.Ndet}});
 	PRISMATIC_FLOAT_PRECISION dummy = 1.0;
 	if (pars.meta.saveDPC_CoM)
-		pars.DPC_CoM = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{1, pars.yp.size(), pars.xp.size(), 2}});
+		pars.DPC_CoM = zeros_aligned_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers, pars.yp.size(), pars.xp.size(), 2}});
+	setupDatacubeMask(pars);
+	setupDatacubeStore(pars);
 	if (pars.meta.save4DOutput && (pars.fpFlag == 0))
 		setup4DOutput(pars, numLayers, dummy);
 }
@@ -219,20 +224,22 @@ getSinglePRISMProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISM
 	PRISMATIC_FLOAT_PRECISION x0 = xp / pars.pixelSizeOutput[1];
 	PRISMATIC_FLOAT_PRECISION y0 = yp / pars.pixelSizeOutput[0];
 
-	Array1D<PRISMATIC_FLOAT_PRECISION> x = pars.xVec + round(x0);
 	// the second call to fmod here is to make sure the result is positive
-	transform(x.begin(), x.end(), x.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
+	const PRISMATIC_FLOAT_PRECISION x0_round = round(x0);
+	Array1D<PRISMATIC_FLOAT_PRECISION> x = pars.xVec.transform_fused([&pars, x0_round](const PRISMATIC_FLOAT_PRECISION &xv) {
+		const PRISMATIC_FLOAT_PRECISION a = xv + x0_round;
 		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1] +
 						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]),
 					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]);
 	});
-	Array1D<PRISMATIC_FLOAT_PRECISION> y = pars.yVec + round(y0);
-	transform(y.begin(), y.end(), y.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
+	const PRISMATIC_FLOAT_PRECISION y0_round = round(y0);
+	Array1D<PRISMATIC_FLOAT_PRECISION> y = pars.yVec.transform_fused([&pars, y0_round](const PRISMATIC_FLOAT_PRECISION &yv) {
+		const PRISMATIC_FLOAT_PRECISION a = yv + y0_round;
 		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0] +
 						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]),
 					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]);
 	});
-	Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
+	AlignedArray2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::uninitialized_ND<2, PRISMATIC_FLOAT_PRECISION>(
 		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
 
 	memset(&psi[0], 0, sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>) * psi.size());
@@ -253,7 +260,7 @@ getSinglePRISMProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISM
 			{
 				for (auto i = 0; i < x.size(); ++i)
 				{
-					*psi_ptr++ += (tmp_const * pars.Scompact.at(a4, y[j], x[i]));
+					*psi_ptr++ += (tmp_const * getScompact(pars, a4, y[j], x[i]));
 				}
 			}
 		}
@@ -283,41 +290,78 @@ void buildPRISMOutput_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	workers.reserve(pars.meta.numThreads);																  // prevents multiple reallocations
 	const size_t PRISMATIC_PRINT_FREQUENCY_PROBES = max((size_t)1, pars.xp.size() * pars.yp.size() / 10); // for printing status
 	WorkDispatcher dispatcher(0, pars.xp.size() * pars.yp.size());
+
+	// hand out probes in blocks that fill whole cache lines of the output arrays. Each block is computed
+	// as a batch, so it is grown towards the requested CPU batch size
+	// the probes are reduced from the beam-fastest copy of Scompact
+	permuteScompact(pars);
+
+	// An out-of-core S-matrix is read straight from its file. The probes are then visited in strips of scan
+	// columns whose windows span about one window width, so that the part of the file a strip needs stays
+	// resident while its rows of probes are computed and each part of the file is read about once
+	pars.probeStripWidth = 0;
+	if (pars.ScompactFile)
+	{
+		const PRISMATIC_FLOAT_PRECISION windowWidth = pars.xVec.size() * pars.pixelSizeOutput[1];
+		while ((pars.probeStripWidth < pars.xp.size()) && (pars.xp[pars.probeStripWidth] - pars.xp[0] < windowWidth))
+			++pars.probeStripWidth;
+		pars.probeStripWidth = max((size_t)1, pars.probeStripWidth);
+		cout << "Computing probes in strips of " << pars.probeStripWidth << " scan columns" << endl;
+	}
+
+	// every probe of a batch is computed for all of the probe conditions, so the batch target is shared among them
+	const size_t numConditions = pars.probeConditions.size();
+	const size_t probeBlock = getCacheAlignedProbeBlock(pars, pars.xp.size() * pars.yp.size());
+	const size_t probeBatch = max(probeBlock, min(max((size_t)1, pars.meta.batchSizeTargetCPU / numConditions),
+												   max((size_t)1, pars.xp.size() * pars.yp.size() / pars.meta.numThreads)) /
+												   probeBlock * probeBlock);
 	for (auto t = 0; t < pars.meta.numThreads; ++t)
 	{
 		cout << "Launching CPU worker thread #" << t << " to compute partial PRISM result\n";
-		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_PROBES]() {
+		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_PROBES, &probeBatch, numConditions, t]() {
+			pinCurrentThread(t, pars.meta);
 			size_t Nstart, Nstop, ay, ax;
 			Nstart = Nstop = 0;
-			if (dispatcher.getWork(Nstart, Nstop))
+			if (dispatcher.getWork(Nstart, Nstop, probeBatch))
 			{ // synchronously get work assignment
-				Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>(
-					{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+				// the propagated probes of a batch are stacked together into one linearized array for a batch FFT
+				AlignedArray1D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi_stack = Prismatic::uninitialized_ND<1, std::complex<PRISMATIC_FLOAT_PRECISION>>(
+					{{pars.imageSizeReduce[0] * pars.imageSizeReduce[1] * probeBatch * numConditions}});
+
+				// setup batch FFTW parameters
+				const int rank = 2;
+				int n[] = {(int)pars.imageSizeReduce[0], (int)pars.imageSizeReduce[1]};
+				const int howmany = probeBatch * numConditions;
+				int idist = n[0] * n[1];
+				int odist = n[0] * n[1];
+				int istride = 1;
+				int ostride = 1;
+				int *inembed = n;
+				int *onembed = n;
 				unique_lock<mutex> gatekeeper(fftw_plan_lock);
-				PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
-																	  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
-																	  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
-																	  FFTW_FORWARD, FFTW_MEASURE);
+				PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_BATCH(rank, n, howmany,
+																		 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), inembed,
+																		 istride, idist,
+																		 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), onembed,
+																		 ostride, odist,
+																		 FFTW_FORWARD, getFFTWPlanningFlag(pars.meta));
 				gatekeeper.unlock();
 
 				// main work loop
 				do
 				{
-					while (Nstart < Nstop)
+					if ((Nstart / PRISMATIC_PRINT_FREQUENCY_PROBES != (Nstop - 1) / PRISMATIC_PRINT_FREQUENCY_PROBES) |
+						(Nstart % PRISMATIC_PRINT_FREQUENCY_PROBES == 0) | (Nstart <= 100 & Nstop > 100))
 					{
-						if (Nstart % PRISMATIC_PRINT_FREQUENCY_PROBES == 0 | Nstart == 100)
-						{
-							cout << "Computing Probe Position5 #" << Nstart << "/" << pars.xp.size() * pars.yp.size() << endl;
-						}
-						ay = Nstart / pars.xp.size();
-						ax = Nstart % pars.xp.size();
-						buildSignal_CPU(pars, ay, ax, plan, psi);
+						cout << "Computing Probe Position5 #" << Nstart << "/" << pars.xp.size() * pars.yp.size() << endl;
+					}
+					buildSignal_CPU_batch(pars, Nstart, Nstop, plan, psi_stack);
 #ifdef PRISMATIC_BUILDING_GUI
-						pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
+					pars.progressbar->signalOutputUpdate(Nstop, pars.xp.size() * pars.yp.size());
 #endif
-						++Nstart;
-					}
-				} while (dispatcher.getWork(Nstart, Nstop));
+					if (pars.outputStreamer)
+						pars.outputStreamer->addProbes(Nstop - Nstart);
+				} while (dispatcher.getWork(Nstart, Nstop, probeBatch));
 				gatekeeper.lock();
 				PRISMATIC_FFTW_DESTROY_PLAN(plan);
 				gatekeeper.unlock();
@@ -329,83 +373,92 @@ void buildPRISMOutput_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	for (auto &t : workers)
 		t.join();
 	PRISMATIC_FFTW_CLEANUP_THREADS();
+
+	// release the permuted copy, Scompact itself is kept for single probe calculations in the GUI
+	pars.permutedScompact = AlignedArray3D<std::complex<PRISMATIC_FLOAT_PRECISION>>();
+	pars.permutedScompactReduced = AlignedArray3D<uint16_t>();
+	pars.probeStripWidth = 0;
 }
 
 void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 					 const size_t &ay,
 					 const size_t &ax,
 					 PRISMATIC_FFTW_PLAN &plan,
-					 Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi)
+					 AlignedArray2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi)
 {
 	// build the output for a single probe position using CPU resources
 
-	const static std::complex<PRISMATIC_FLOAT_PRECISION> i(0, 1);
-	const static PRISMATIC_FLOAT_PRECISION pi = std::acos(-1);
-
 	// setup some coordinates
 	PRISMATIC_FLOAT_PRECISION x0 = pars.xp[ax] / pars.pixelSizeOutput[1];
 	PRISMATIC_FLOAT_PRECISION y0 = pars.yp[ay] / pars.pixelSizeOutput[0];
-	Array1D<PRISMATIC_FLOAT_PRECISION> x = pars.xVec + round(x0);
 
 	// the second call to fmod here is to make sure the result is positive
-	transform(x.begin(), x.end(), x.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
+	const PRISMATIC_FLOAT_PRECISION x0_round = round(x0);
+	Array1D<PRISMATIC_FLOAT_PRECISION> x = pars.xVec.transform_fused([&pars, x0_round](const PRISMATIC_FLOAT_PRECISION &xv) {
+		const PRISMATIC_FLOAT_PRECISION a = xv + x0_round;
 		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1] +
 						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]),
 					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]);
 	});
-	Array1D<PRISMATIC_FLOAT_PRECISION> y = pars.yVec + round(y0);
-	transform(y.begin(), y.end(), y.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
+	const PRISMATIC_FLOAT_PRECISION y0_round = round(y0);
+	Array1D<PRISMATIC_FLOAT_PRECISION> y = pars.yVec.transform_fused([&pars, y0_round](const PRISMATIC_FLOAT_PRECISION &yv) {
+		const PRISMATIC_FLOAT_PRECISION a = yv + y0_round;
 		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0] +
 						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]),
 					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]);
 	});
-	Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
-
 	memset(&psi[0], 0, sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>) * psi.size());
 
-	for (auto a4 = 0; a4 < pars.beamsIndex.size(); ++a4)
+	for (auto k = 0; k < pars.activeBeams.size(); ++k)
 	{
-		PRISMATIC_FLOAT_PRECISION yB = pars.xyBeams.at(a4, 0);
-		PRISMATIC_FLOAT_PRECISION xB = pars.xyBeams.at(a4, 1);
-
-		if (abs(pars.psiProbeInit.at(yB, xB)) > 0)
+		const size_t a4 = pars.activeBeams[k];
+		const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = pars.xPhaseCoeffs.at(0, ax, k) * pars.yPhaseCoeffs.at(0, ay, k);
+		auto psi_ptr = psi.begin();
+		for (auto j = 0; j < y.size(); ++j)
 		{
-			PRISMATIC_FLOAT_PRECISION q0_0 = pars.qxaReduce.at(yB, xB);
-			PRISMATIC_FLOAT_PRECISION q0_1 = pars.qyaReduce.at(yB, xB);
-			std::complex<PRISMATIC_FLOAT_PRECISION> phaseShift = exp(
-				-2 * pi * i * (q0_0 * (pars.xp[ax] + pars.xTiltShift) + q0_1 * (pars.yp[ay] + pars.yTiltShift)));
-
-			const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = pars.psiProbeInit.at(yB, xB) * phaseShift;
-			auto psi_ptr = psi.begin();
-			for (auto j = 0; j < y.size(); ++j)
+			for (auto i = 0; i < x.size(); ++i)
 			{
-				for (auto i = 0; i < x.size(); ++i)
-				{
-					*psi_ptr++ += (tmp_const * pars.Scompact.at(a4, y[j], x[i]));
-				}
+				*psi_ptr++ += (tmp_const * pars.Scompact.at(a4, y[j], x[i]));
 			}
 		}
 	}
 
 	PRISMATIC_FFTW_EXECUTE(plan);
+	std::vector<PRISMATIC_FLOAT_PRECISION> binnedOutput(pars.Ndet);
+	formatSignal_CPU(pars, ay, ax, 0, psi.view(), binnedOutput);
+}
+
+void formatSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					  const size_t &ay,
+					  const size_t &ax,
+					  const size_t condition,
+					  const ArrayView<2, const std::complex<PRISMATIC_FLOAT_PRECISION>> &psi,
+					  std::vector<PRISMATIC_FLOAT_PRECISION> &binnedOutput)
+{
+	// integrate and store the output for a single probe position and probe condition from its propagated wave function
+	AlignedArray2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::uninitialized_ND<2, PRISMATIC_FLOAT_PRECISION>(
+		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
 	for (auto jj = 0; jj < intOutput.get_dimj(); ++jj)
 	{
 		for (auto ii = 0; ii < intOutput.get_dimi(); ++ii)
 		{
-			intOutput.at(jj, ii) += pow(abs(psi.at(jj, ii)), 2) * pars.scale;
+			intOutput.at(jj, ii) = pow(abs(psi.at(jj, ii)), 2) * pars.scale;
 		}
 	}
 
+	// neighboring probes are computed by other threads and share cache lines in the output arrays,
+	// so all accumulation happens in local storage and the shared arrays are written once per probe
 	if (pars.meta.saveDPC_CoM)
 	{
 		//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
+		PRISMATIC_FLOAT_PRECISION CoM_x = 0;
+		PRISMATIC_FLOAT_PRECISION CoM_y = 0;
 		for (long y = 0; y < intOutput.get_dimj(); ++y)
 		{
 			for (long x = 0; x < intOutput.get_dimi(); ++x)
 			{
-				pars.DPC_CoM.at(0, ay, ax, 0) += pars.qxaReduce.at(y, x) * intOutput.at(y, x);
-				pars.DPC_CoM.at(0, ay, ax, 1) += pars.qyaReduce.at(y, x) * intOutput.at(y, x);
+				CoM_x += pars.qxaReduce.at(y, x) * intOutput.at(y, x);
+				CoM_y += pars.qyaReduce.at(y, x) * intOutput.at(y, x);
 			}
 		}
 		//divide by sum of intensity
@@ -414,20 +467,23 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 		{
 			intensitySum += *iter;
 		}
-		pars.DPC_CoM.at(0, ay, ax, 0) /= intensitySum;
-		pars.DPC_CoM.at(0, ay, ax, 1) /= intensitySum;
+		pars.DPC_CoM.at(condition, ay, ax, 0) = (pars.DPC_CoM.at(condition, ay, ax, 0) + CoM_x) / intensitySum;
+		pars.DPC_CoM.at(condition, ay, ax, 1) = (pars.DPC_CoM.at(condition, ay, ax, 1) + CoM_y) / intensitySum;
 	}
 
 	//         update output -- ax,ay are unique per thread so this write is thread-safe without a lock
-	auto idx = pars.alphaInd.begin();
+	binnedOutput.assign(pars.Ndet, 0);
+	auto idx = pars.conditionAlphaInd[condition].begin();
 	for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts)
 	{
 		if (*idx <= pars.Ndet)
 		{
-			pars.output.at(0, ay, ax, (*idx) - 1) += *counts;
+			binnedOutput[(*idx) - 1] += *counts;
 		}
 		++idx;
 	};
+	for (auto b = 0; b < pars.Ndet; ++b)
+		pars.output.at(condition, ay, ax, b) += binnedOutput[b];
 
 	//save 4D output if applicable
 	if (pars.meta.save4DOutput)
@@ -435,27 +491,18 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 		//std::string section4DFilename = generateFilename(pars, 0, ay, ax);
 		// unique_lock<mutex> HDF5_gatekeeper(HDF5_lock);
 		std::stringstream nameString;
-		nameString << "4DSTEM_simulation/data/datacubes/CBED_array_depth" << getDigitString(0);
+		nameString << "4DSTEM_simulation/data/datacubes/CBED_array_depth" << getLayerString(pars, condition, pars.output.get_diml());
 
-		// H5::Group dataGroup = pars.outputFile.openGroup(nameString.str());
+		// H5::Group dataGroup = pars.outputWriter->getFile().openGroup(nameString.str());
 		// H5::DataSet CBED_data = dataGroup.openDataSet("datacube");
 
 		hsize_t offset[4] = {ax, ay, 0, 0}; //order by ax, ay so that aligns with py4DSTEM
 
 		PRISMATIC_FLOAT_PRECISION numFP = pars.meta.numFP;
 
-        if(pars.meta.crop4DOutput)
-        {
-            Array2D<PRISMATIC_FLOAT_PRECISION> croppedOutput = cropOutput(intOutput,pars);
-            hsize_t mdims[4] = {1, 1, croppedOutput.get_dimi(), croppedOutput.get_dimj()};
-            writeDatacube4D(pars, &croppedOutput[0], mdims, offset, numFP, nameString.str());
-        }
-        else
-        {
-            hsize_t mdims[4] = {1, 1, intOutput.get_dimi(), intOutput.get_dimj()};
-            intOutput = fftshift2(intOutput);
-            writeDatacube4D(pars, &intOutput[0], mdims, offset, numFP,nameString.str());
-        }
+        AlignedArray2D<PRISMATIC_FLOAT_PRECISION> frame = get4DOutputFrame(intOutput, pars);
+        hsize_t mdims[4] = {1, 1, frame.get_dimi(), frame.get_dimj()};
+        writeDatacube4D(pars, &frame[0], mdims, offset, numFP, nameString.str());
 
 		// CBED_data.close();
 		// dataGroup.close();
@@ -464,6 +511,344 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	}
 }
 
+// copies the active beams of a [beam][y][x] array with wordsPerValue elements per value into [y][x][beam] order
+template <class T>
+static void transposeActiveBeams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const T *src, T *dst,
+								 const size_t dimj, const size_t dimi, const size_t wordsPerValue)
+{
+	const std::vector<size_t> &activeBeams = pars.activeBeams;
+	const size_t numActive = activeBeams.size();
+	const size_t numThreads = max((size_t)1, min(pars.meta.numThreads, dimj));
+	vector<thread> workers;
+	workers.reserve(numThreads);
+	for (auto t = 0; t < numThreads; ++t)
+	{
+		workers.push_back(thread([&pars, &activeBeams, src, dst, numActive, dimj, dimi, wordsPerValue, numThreads, t]() {
+			pinCurrentThread(t, pars.meta);
+			for (auto y = dimj * t / numThreads; y < dimj * (t + 1) / numThreads; ++y)
+			{
+				// transpose in blocks of beams so that both the reads and the writes stay within a few pages
+				for (size_t k0 = 0; k0 < numActive; k0 += 16)
+				{
+					const size_t k1 = min(k0 + 16, numActive);
+					for (auto k = k0; k < k1; ++k)
+					{
+						const T *S_row = src + (activeBeams[k] * dimj + y) * dimi * wordsPerValue;
+						T *P_ptr = dst + (y * dimi * numActive + k) * wordsPerValue;
+						for (auto x = 0; x < dimi; ++x)
+						{
+							for (auto w = 0; w < wordsPerValue; ++w)
+								P_ptr[x * numActive * wordsPerValue + w] = S_row[x * wordsPerValue + w];
+						}
+					}
+				}
+			}
+		}));
+	}
+	for (auto &t : workers)
+		t.join();
+}
+
+void permuteScompact(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// Copies the active beams of Scompact into pars.permutedScompact with the beam dimension fastest, the same
+	// layout the GPU code uses. Every output pixel of a probe is a dot product over the beams, so this lets the
+	// CPU reduction walk each pixel's beam vector contiguously instead of touching one cache line per beam.
+	// The rows are divided among the (pinned) worker threads, so the pages are also first touched on the node
+	// of the thread most likely to read them. A reduced precision S-matrix is permuted without decoding it
+	const size_t numActive = pars.activeBeams.size();
+	if (pars.ScompactFile)
+	{
+		return; // already stored beam-fastest
+	}
+	else if (pars.meta.scompactPrecision == ScompactPrecision::Full)
+	{
+		const size_t dimj = pars.Scompact.get_dimj();
+		const size_t dimi = pars.Scompact.get_dimi();
+		pars.permutedScompact = uninitialized_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{dimj, dimi, numActive}});
+		if (numActive > 0)
+			transposeActiveBeams(pars, &pars.Scompact[0], &pars.permutedScompact[0], dimj, dimi, 1);
+	}
+	else
+	{
+		const size_t dimj = pars.ScompactReduced.get_dimj();
+		const size_t dimi = pars.ScompactReduced.get_dimi() / 2;
+		pars.permutedScompactReduced = uninitialized_ND<3, uint16_t>({{dimj, dimi, 2 * numActive}});
+		if (numActive > 0)
+			transposeActiveBeams(pars, &pars.ScompactReduced[0], &pars.permutedScompactReduced[0], dimj, dimi, 2);
+	}
+}
+
+struct IdentityDecoder
+{
+	PRISMATIC_FLOAT_PRECISION operator()(const PRISMATIC_FLOAT_PRECISION v) const { return v; }
+};
+
+// offset of the real part of active beam k within a pixel's beam vector
+struct ContiguousBeams
+{
+	size_t operator()(const size_t k) const { return 2 * k; }
+};
+
+struct ListedBeams
+{
+	const size_t *offsets; // offsets of beams k0, k0 + 1, ...
+	size_t k0;
+	size_t operator()(const size_t k) const { return offsets[k - k0]; }
+};
+
+// Accumulates beams k0..k1-1 of a group of probes that share the same window. For each pixel the beam vector
+// S(pixel, k0:k1) is read contiguously from S_base ([y][x][real/imag of each beam], pixelStride words per pixel),
+// decoded, and multiplied into the coefficients of every probe in the group, which are stored [beam][probe] so
+// that the innermost loop over probes vectorizes. Each output element accumulates its beams in ascending order
+template <class S_t, class Decoder, class BeamOffset>
+static void accumulateBeamVectors(const S_t *S_base,
+								  const size_t dimx,
+								  const size_t pixelStride,
+								  const Decoder decode,
+								  const BeamOffset offset,
+								  const std::vector<size_t> &xInd,
+								  const std::vector<size_t> &yInd,
+								  const std::complex<PRISMATIC_FLOAT_PRECISION> *coefficients,
+								  const size_t groupSize,
+								  const size_t k0,
+								  const size_t k1,
+								  std::complex<PRISMATIC_FLOAT_PRECISION> *const *psi,
+								  PRISMATIC_FLOAT_PRECISION *acc)
+{
+	const size_t nx = xInd.size();
+	const PRISMATIC_FLOAT_PRECISION *c_base = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION *>(coefficients);
+	size_t p = 0;
+	for (auto j = 0; j < yInd.size(); ++j)
+	{
+		const S_t *S_row = S_base + yInd[j] * dimx * pixelStride;
+		for (auto i = 0; i < nx; ++i, ++p)
+		{
+			const S_t *S_ptr = S_row + xInd[i] * pixelStride;
+			for (auto g = 0; g < groupSize; ++g)
+			{
+				acc[2 * g] = psi[g][p].real();
+				acc[2 * g + 1] = psi[g][p].imag();
+			}
+			for (auto k = k0; k < k1; ++k)
+			{
+				const PRISMATIC_FLOAT_PRECISION S_r = decode(S_ptr[offset(k)]);
+				const PRISMATIC_FLOAT_PRECISION S_i = decode(S_ptr[offset(k) + 1]);
+				const PRISMATIC_FLOAT_PRECISION *c_ptr = c_base + 2 * k * groupSize;
+				for (auto g = 0; g < groupSize; ++g)
+				{
+					const PRISMATIC_FLOAT_PRECISION c_r = c_ptr[2 * g];
+					const PRISMATIC_FLOAT_PRECISION c_i = c_ptr[2 * g + 1];
+					acc[2 * g] += c_r * S_r - c_i * S_i;
+					acc[2 * g + 1] += c_r * S_i + c_i * S_r;
+				}
+			}
+			for (auto g = 0; g < groupSize; ++g)
+				psi[g][p] = std::complex<PRISMATIC_FLOAT_PRECISION>(acc[2 * g], acc[2 * g + 1]);
+		}
+	}
+}
+
+// dispatches accumulateBeamVectors on the storage format of the permuted S-matrix
+static void accumulateBeamVectors(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+								  const std::vector<size_t> &xInd,
+								  const std::vector<size_t> &yInd,
+								  const std::complex<PRISMATIC_FLOAT_PRECISION> *coefficients,
+								  const size_t groupSize,
+								  const size_t k0,
+								  const size_t k1,
+								  std::complex<PRISMATIC_FLOAT_PRECISION> *const *psi,
+								  PRISMATIC_FLOAT_PRECISION *acc)
+{
+	const size_t numActive = pars.activeBeams.size();
+	if (pars.ScompactFile)
+	{
+		// beams k0..k1-1 all lie in the same block of the file, see buildSignal_CPU_batch
+		const size_t B = PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK;
+		const size_t dimx = pars.imageSizeOutput[1];
+		const PRISMATIC_FLOAT_PRECISION *S_base = static_cast<const PRISMATIC_FLOAT_PRECISION *>(pars.ScompactFile->data()) +
+												  (pars.activeBeams[k0] / B) * pars.imageSizeOutput[0] * dimx * 2 * B;
+		size_t offsets[PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK];
+		for (auto k = k0; k < k1; ++k)
+			offsets[k - k0] = 2 * (pars.activeBeams[k] % B);
+		ListedBeams offset = {offsets, k0};
+		accumulateBeamVectors(S_base, dimx, 2 * B, IdentityDecoder(), offset,
+							  xInd, yInd, coefficients, groupSize, k0, k1, psi, acc);
+		return;
+	}
+	if (pars.meta.scompactPrecision == ScompactPrecision::Full)
+	{
+		const PRISMATIC_FLOAT_PRECISION *S_base = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION *>(&pars.permutedScompact[0]);
+		accumulateBeamVectors(S_base, pars.permutedScompact.get_dimj(), 2 * numActive, IdentityDecoder(), ContiguousBeams(),
+							  xInd, yInd, coefficients, groupSize, k0, k1, psi, acc);
+		return;
+	}
+	const uint16_t *S_base = &pars.permutedScompactReduced[0];
+	const size_t dimx = pars.permutedScompactReduced.get_dimj();
+	switch (pars.meta.scompactPrecision)
+	{
+	case ScompactPrecision::Float16:
+		accumulateBeamVectors(S_base, dimx, 2 * numActive, HalfDecoder(), ContiguousBeams(),
+							  xInd, yInd, coefficients, groupSize, k0, k1, psi, acc);
+		break;
+	case ScompactPrecision::BFloat16:
+		accumulateBeamVectors(S_base, dimx, 2 * numActive, BFloat16Decoder(), ContiguousBeams(),
+							  xInd, yInd, coefficients, groupSize, k0, k1, psi, acc);
+		break;
+	default:
+		accumulateBeamVectors(S_base, dimx, 2 * numActive, Int16Decoder(), ContiguousBeams(),
+							  xInd, yInd, coefficients, groupSize, k0, k1, psi, acc);
+	}
+}
+
+static void getProbePosition(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t N, size_t &ay, size_t &ax)
+{
+	// maps the dispatch index of a probe to its scan position, either row-major or in strips of probeStripWidth columns
+	if ((pars.probeStripWidth == 0) | (pars.probeStripWidth >= pars.xp.size()))
+	{
+		ay = N / pars.xp.size();
+		ax = N % pars.xp.size();
+		return;
+	}
+	const size_t stripSize = pars.probeStripWidth * pars.yp.size();
+	const size_t x0 = (N / stripSize) * pars.probeStripWidth;
+	const size_t width = min(pars.probeStripWidth, pars.xp.size() - x0);
+	ay = (N % stripSize) / width;
+	ax = x0 + (N % stripSize) % width;
+}
+
+void buildSignal_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const size_t Nstart,
+						   const size_t Nstop,
+						   PRISMATIC_FFTW_PLAN &plan,
+						   AlignedArray1D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack)
+{
+	// Builds the output for the probe positions Nstart..Nstop-1 (at most one FFT batch). For each probe
+	// psi = S_window * c, where S_window is the Scompact window (pixels x beams) centered on the probe and
+	// c holds the probe's beam coefficients. Probes whose windows coincide share S_window, so they are
+	// grouped and computed as one complex matrix product S_window * [c_1 ... c_n], reading S_window from
+	// the beam-fastest pars.permutedScompact (see permuteScompact). When the coefficients of a group do not
+	// fit in cache the product is tiled over beams. Each output element still accumulates its beams in
+	// ascending order, so the result matches buildSignal_CPU.
+	// With several probe conditions every probe has one column of coefficients per condition, so each window
+	// is gathered once for all of the conditions. The wave function of probe n and condition c is entry
+	// n * numConditions + c of psi_stack
+	const size_t numProbes = Nstop - Nstart;
+	const size_t numConditions = pars.probeConditions.size();
+	const size_t ny = pars.yVec.size();
+	const size_t nx = pars.xVec.size();
+	const size_t probeSize = ny * nx;
+	const size_t numActive = pars.activeBeams.size();
+
+	// window origin of each probe
+	std::vector<long> windowX(numProbes), windowY(numProbes);
+	for (auto n = 0; n < numProbes; ++n)
+	{
+		size_t ay, ax;
+		getProbePosition(pars, Nstart + n, ay, ax);
+		windowX[n] = (long)round(pars.xp[ax] / pars.pixelSizeOutput[1]);
+		windowY[n] = (long)round(pars.yp[ay] / pars.pixelSizeOutput[0]);
+	}
+	std::vector<size_t> order(numProbes);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&windowX, &windowY](const size_t a, const size_t b) {
+		return (windowY[a] < windowY[b]) | ((windowY[a] == windowY[b]) & (windowX[a] < windowX[b]));
+	});
+
+	memset(&psi_stack[0], 0, sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>) * psi_stack.size());
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> coefficients;
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION> *> psi(numProbes * numConditions);
+	std::vector<PRISMATIC_FLOAT_PRECISION> acc(2 * numProbes * numConditions);
+	std::vector<size_t> xInd(nx), yInd(ny);
+	size_t groupStart = 0;
+	while (groupStart < numProbes)
+	{
+		size_t groupStop = groupStart + 1;
+		while ((groupStop < numProbes) &&
+			   (windowX[order[groupStop]] == windowX[order[groupStart]]) &
+				   (windowY[order[groupStop]] == windowY[order[groupStart]]))
+			++groupStop;
+		const size_t groupSize = groupStop - groupStart;
+		const size_t numColumns = groupSize * numConditions;
+
+		// the second call to fmod here is to make sure the result is positive
+		{
+			const size_t n = order[groupStart];
+			const PRISMATIC_FLOAT_PRECISION x0_round = windowX[n];
+			const PRISMATIC_FLOAT_PRECISION y0_round = windowY[n];
+			for (auto i = 0; i < nx; ++i)
+			{
+				const PRISMATIC_FLOAT_PRECISION a = pars.xVec[i] + x0_round;
+				xInd[i] = fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1] +
+								   fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]),
+							   (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]);
+			}
+			for (auto j = 0; j < ny; ++j)
+			{
+				const PRISMATIC_FLOAT_PRECISION a = pars.yVec[j] + y0_round;
+				yInd[j] = fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0] +
+								   fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]),
+							   (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]);
+			}
+		}
+
+		// coefficient matrix, [beam][probe and condition]. The phase shift of each beam is separable in the probe position
+		coefficients.resize(numActive * numColumns);
+		for (auto g = 0; g < groupSize; ++g)
+		{
+			size_t ay, ax;
+			getProbePosition(pars, Nstart + order[groupStart + g], ay, ax);
+			for (auto c = 0; c < numConditions; ++c)
+			{
+				const size_t column = g * numConditions + c;
+				const std::complex<PRISMATIC_FLOAT_PRECISION> *xCoeffs = &pars.xPhaseCoeffs.at(c, ax, 0);
+				const std::complex<PRISMATIC_FLOAT_PRECISION> *yCoeffs = &pars.yPhaseCoeffs.at(c, ay, 0);
+				for (auto k = 0; k < numActive; ++k)
+					coefficients[k * numColumns + column] = xCoeffs[k] * yCoeffs[k];
+
+				// a reduced precision S-matrix stores each beam divided by its scale
+				if (pars.meta.scompactPrecision != ScompactPrecision::Full)
+				{
+					for (auto k = 0; k < numActive; ++k)
+						coefficients[k * numColumns + column] *= pars.ScompactScale[pars.activeBeams[k]];
+				}
+				psi[column] = &psi_stack[(order[groupStart + g] * numConditions + c) * probeSize];
+			}
+		}
+
+		// reduce the window in tiles of beams whose coefficients stay in cache while the pixels stream past
+		const size_t beamTile = max((size_t)1, (size_t)PRISMATIC_PRISM03_BEAM_TILE_BYTES /
+												   (numColumns * sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>)));
+		for (size_t k0 = 0, k1; k0 < numActive; k0 = k1)
+		{
+			k1 = min(k0 + beamTile, numActive);
+			if (pars.ScompactFile)
+			{
+				// tiles of an out-of-core S-matrix end at the blocks of its file
+				const size_t blockEnd = (pars.activeBeams[k0] / PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK + 1) * PRISMATIC_SCOMPACT_FILE_BEAM_BLOCK;
+				k1 = lower_bound(pars.activeBeams.begin() + k0, pars.activeBeams.begin() + k1, blockEnd) - pars.activeBeams.begin();
+			}
+			accumulateBeamVectors(pars, xInd, yInd, &coefficients[0], numColumns, k0, k1, &psi[0], &acc[0]);
+		}
+		groupStart = groupStop;
+	}
+
+	// one batched FFT for all of the probes, then the per-probe reduction
+	PRISMATIC_FFTW_EXECUTE(plan);
+	std::vector<PRISMATIC_FLOAT_PRECISION> binnedOutput(pars.Ndet);
+	for (auto n = 0; n < numProbes; ++n)
+	{
+		size_t ay, ax;
+		getProbePosition(pars, Nstart + n, ay, ax);
+		for (auto c = 0; c < numConditions; ++c)
+		{
+			formatSignal_CPU(pars, ay, ax, c, ArrayView<2, const std::complex<PRISMATIC_FLOAT_PRECISION>>(
+												  &psi_stack[(n * numConditions + c) * probeSize], {{ny, nx}}),
+							 binnedOutput);
+		}
+	}
+}
+
 void transformIndices(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	// setup some relevant coordinates
@@ -546,6 +931,92 @@ void initializeProbes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 			  });
 }
 
+void initializeProbeConditions(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// The probe conditions of a run only differ in their probes and, through the tilt, in the detector bins, so
+	// these are set up once per condition by substituting its settings into pars.meta. The conditions are visited
+	// last to first, which leaves pars.meta, pars.psiProbeInit, pars.alphaInd and the tilt shifts with the settings
+	// of the first condition
+	pars.conditionProbeInit.clear();
+	pars.conditionAlphaInd.clear();
+	for (auto c = pars.probeConditions.rbegin(); c != pars.probeConditions.rend(); ++c)
+	{
+		pars.meta.probeDefocus = c->probeDefocus;
+		pars.meta.C3 = c->C3;
+		pars.meta.C5 = c->C5;
+		pars.meta.probeSemiangle = c->probeSemiangle;
+		pars.meta.probeXtilt = c->probeXtilt;
+		pars.meta.probeYtilt = c->probeYtilt;
+
+		// perform some necessary setup transformations of the data
+		transformIndices(pars);
+
+		// initialize/compute the probe
+		initializeProbes(pars);
+
+		pars.conditionProbeInit.insert(pars.conditionProbeInit.begin(), pars.psiProbeInit);
+		pars.conditionAlphaInd.insert(pars.conditionAlphaInd.begin(), pars.alphaInd);
+	}
+	pars.xTiltShift = -pars.zTotal * tan(pars.meta.probeXtilt);
+	pars.yTiltShift = -pars.zTotal * tan(pars.meta.probeYtilt);
+}
+
+void setupActiveBeams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// Only the beams inside of the probe aperture contribute to a probe. The coefficient of beam k for the probe
+	// at (xp[ax], yp[ay]) is psiProbeInit(beam) * exp(-2*pi*i*(qx*(xp + xTiltShift) + qy*(yp + yTiltShift))), which
+	// factors into a term per scan column and a term per scan row. Tabulating both turns the per-probe coefficients
+	// into a single complex multiply per beam. With several probe conditions the active beams are those inside of
+	// any of their apertures, and a beam outside of the aperture of one condition has a zero coefficient for it
+	const size_t numConditions = pars.probeConditions.size();
+	pars.activeBeams.clear();
+	for (auto a4 = 0; a4 < pars.beamsIndex.size(); ++a4)
+	{
+		for (auto &probe : pars.conditionProbeInit)
+		{
+			if (abs(probe.at(pars.xyBeams.at(a4, 0), pars.xyBeams.at(a4, 1))) > 0)
+			{
+				pars.activeBeams.push_back(a4);
+				break;
+			}
+		}
+	}
+	const size_t numActive = pars.activeBeams.size();
+	pars.activeBeamsQx = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{numActive}});
+	pars.activeBeamsQy = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{numActive}});
+	pars.activeBeamsAmplitude = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>({{numConditions, numActive}});
+	for (auto k = 0; k < numActive; ++k)
+	{
+		const long yB = pars.xyBeams.at(pars.activeBeams[k], 0);
+		const long xB = pars.xyBeams.at(pars.activeBeams[k], 1);
+		pars.activeBeamsQx[k] = pars.qxaReduce.at(yB, xB);
+		pars.activeBeamsQy[k] = pars.qyaReduce.at(yB, xB);
+		for (auto c = 0; c < numConditions; ++c)
+			pars.activeBeamsAmplitude.at(c, k) = pars.conditionProbeInit[c].at(yB, xB);
+	}
+
+	pars.xPhaseCoeffs = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{numConditions, pars.xp.size(), numActive}});
+	pars.yPhaseCoeffs = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{numConditions, pars.yp.size(), numActive}});
+	for (auto c = 0; c < numConditions; ++c)
+	{
+		const PRISMATIC_FLOAT_PRECISION xTiltShift = -pars.zTotal * tan(pars.probeConditions[c].probeXtilt);
+		const PRISMATIC_FLOAT_PRECISION yTiltShift = -pars.zTotal * tan(pars.probeConditions[c].probeYtilt);
+		for (auto ax = 0; ax < pars.xp.size(); ++ax)
+		{
+			for (auto k = 0; k < numActive; ++k)
+			{
+				pars.xPhaseCoeffs.at(c, ax, k) = pars.activeBeamsAmplitude.at(c, k) *
+												 exp(-2 * pi * i * (pars.activeBeamsQx[k] * (pars.xp[ax] + xTiltShift)));
+			}
+		}
+		for (auto ay = 0; ay < pars.yp.size(); ++ay)
+		{
+			for (auto k = 0; k < numActive; ++k)
+				pars.yPhaseCoeffs.at(c, ay, k) = exp(-2 * pi * i * (pars.activeBeamsQy[k] * (pars.yp[ay] + yTiltShift)));
+		}
+	}
+}
+
 void PRISM03_calcOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	// compute final image
@@ -567,11 +1038,11 @@ void PRISM03_calcOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	// initialize the output to the correct size for the output mode
 	createStack_integrate(pars);
 
-	// perform some necessary setup transformations of the data
-	transformIndices(pars);
+	// perform some necessary setup transformations of the data and compute the probe of each probe condition
+	initializeProbeConditions(pars);
 
-	// initialize/compute the probes
-	initializeProbes(pars);
+	// list the beams inside of the probe aperture and tabulate their phase shifts over the scan grid
+	setupActiveBeams(pars);
 
 #ifdef PRISMATIC_BUILDING_GUI
 	pars.progressbar->signalDescriptionMessage("Computing final output (PRISM)");
@@ -579,6 +1050,10 @@ void PRISM03_calcOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 #endif
 
 	// compute the final PRISM output
+	startOutputStreamer(pars);
+	startDatacubeWriter(pars);
 	buildPRISMOutput(pars);
+	finishDatacubeWriter(pars);
+	finishOutputStreamer(pars);
 }
 } // namespace Prismatic
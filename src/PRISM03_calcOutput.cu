@@ -432,6 +432,8 @@ namespace Prismatic {
 #ifdef PRISMATIC_BUILDING_GUI
 								pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+								if (pars.outputStreamer)
+									pars.outputStreamer->addProbes(1);
 //						buildSignal_CPU(pars, ay, ax, yTiltShift, xTiltShift, alphaInd, PsiProbeInit);
 								++Nstart;
 							}
@@ -461,7 +463,7 @@ namespace Prismatic {
 					}
 					cout << "early_CPU_stop= " << early_CPU_stop << endl;
 					if (dispatcher.getWork(Nstart, Nstop, 1, early_CPU_stop)) { // synchronously get work assignment
-						Array2D <std::complex<PRISMATIC_FLOAT_PRECISION>> psi = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> >(
+						AlignedArray2D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi = Prismatic::uninitialized_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> >(
 								{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
 						unique_lock <mutex> gatekeeper(fftw_plan_lock);
 						PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
@@ -483,6 +485,8 @@ namespace Prismatic {
 #ifdef PRISMATIC_BUILDING_GUI
 								pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+								if (pars.outputStreamer)
+									pars.outputStreamer->addProbes(1);
 								++Nstart;
 							}
 							if (Nstop >= early_CPU_stop) break;
@@ -584,6 +588,8 @@ namespace Prismatic {
 #ifdef PRISMATIC_BUILDING_GUI
 						pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+						if (pars.outputStreamer)
+							pars.outputStreamer->addProbes(1);
 						++Nstart;
 					}
 				}
@@ -611,7 +617,7 @@ namespace Prismatic {
 					}
 //					while (getWorkID(pars, Nstart, Nstop)) { // synchronously get work assignment
 					if(dispatcher.getWork(Nstart, Nstop, 1, early_CPU_stop)) { // synchronously get work assignment
-						Array2D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> > (
+						AlignedArray2D<std::complex<PRISMATIC_FLOAT_PRECISION> > psi = Prismatic::uninitialized_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION> >(
 								{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
 						unique_lock<mutex> gatekeeper(fftw_plan_lock);
 
@@ -634,6 +640,8 @@ namespace Prismatic {
 #ifdef PRISMATIC_BUILDING_GUI
 								pars.progressbar->signalOutputUpdate(Nstart, pars.xp.size() * pars.yp.size());
 #endif
+								if (pars.outputStreamer)
+									pars.outputStreamer->addProbes(1);
 								++Nstart;
 							}
 							if (Nstop >= early_CPU_stop) break;
@@ -28,6 +28,31 @@
 namespace Prismatic
 {
 using namespace std;
+
+// computes the projected potential and compact S-matrix, saving the S-matrix if requested, or loads a saved one
+static void calcOrLoadSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	try
+	{
+		if (pars.meta.filenameLoadSMatrix != "")
+		{
+			if (pars.meta.savePotentialSlices & (pars.fpFlag == 0))
+				cout << "The potential is not computed for a loaded S-matrix, no potential slices will be saved" << endl;
+			loadSMatrix(pars);
+			return;
+		}
+		PRISM01_calcPotential(pars);
+		PRISM02_calcSMatrix(pars);
+		if (pars.meta.filenameSaveSMatrix != "")
+			saveSMatrix(pars);
+	}
+	catch (const std::runtime_error &e)
+	{
+		cout << e.what() << "Terminating" << endl;
+		exit(1);
+	}
+}
+
 Parameters<PRISMATIC_FLOAT_PRECISION> PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 {
 	Parameters<PRISMATIC_FLOAT_PRECISION> prismatic_pars;
@@ -44,17 +69,18 @@ Parameters<PRISMATIC_FLOAT_PRECISION> PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECI
 
 	//        to_xyz(prismatic_pars.atoms, "/Users/ajpryor/Documents/MATLAB/multislice/PRISM/build/test.XYZ", "comment", 5.43,5.43,5.43);
 
-	prismatic_pars.outputFile = H5::H5File(prismatic_pars.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
+	// reuse FFTW plans measured by previous runs on this machine
+	importFFTWWisdom(prismatic_pars.meta);
+
+	prismatic_pars.outputWriter = std::make_shared<OutputWriter>(prismatic_pars.meta.filenameOutput, H5F_ACC_TRUNC, prismatic_pars.meta.swmrInterval > 0);
 	setupOutputFile(prismatic_pars);
-	// compute projected potentials
 	prismatic_pars.fpFlag = 0;
-	PRISM01_calcPotential(prismatic_pars);
+	setupDatacubeAccumulator(prismatic_pars);
+	// compute projected potentials and compact S-matrix, or go straight to the output with a saved S-matrix
+	calcOrLoadSMatrix(prismatic_pars);
 
 	//		prismatic_pars.pot.toMRC_f("debug_potential.mrc");
 
-	// compute compact S-matrix
-	PRISM02_calcSMatrix(prismatic_pars);
-
 	//		Array3D<PRISMATIC_FLOAT_PRECISION> tmp = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{prismatic_pars.Scompact.get_dimk(),prismatic_pars.Scompact.get_dimj(),prismatic_pars.Scompact.get_dimi()}});
 	//		Array3D<PRISMATIC_FLOAT_PRECISION> tmp_r = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{prismatic_pars.Scompact.get_dimk(),prismatic_pars.Scompact.get_dimj(),prismatic_pars.Scompact.get_dimi()}});
 	//		Array3D<PRISMATIC_FLOAT_PRECISION> tmp_i = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{prismatic_pars.Scompact.get_dimk(),prismatic_pars.Scompact.get_dimj(),prismatic_pars.Scompact.get_dimi()}});
@@ -73,7 +99,7 @@ Parameters<PRISMATIC_FLOAT_PRECISION> PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECI
 
 	// compute final output
 	PRISM03_calcOutput(prismatic_pars);
-	prismatic_pars.outputFile.close();
+	closeOutputFile(prismatic_pars);
 
 	// calculate remaining frozen phonon configurations
 	if (prismatic_pars.meta.numFP > 1)
@@ -83,6 +109,9 @@ Parameters<PRISMATIC_FLOAT_PRECISION> PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECI
 		Array4D<PRISMATIC_FLOAT_PRECISION> DPC_CoM_output;
 		if (prismatic_pars.meta.saveDPC_CoM)
 			DPC_CoM_output = prismatic_pars.DPC_CoM;
+		std::shared_ptr<DatacubeAccumulator> datacubeAccumulator = prismatic_pars.datacubeAccumulator;
+		std::shared_ptr<DatacubeMap> datacubeMap = prismatic_pars.datacubeMap;
+		std::shared_ptr<OutputWriter> outputWriter = prismatic_pars.outputWriter;
 		for (auto fp_num = 1; fp_num < prismatic_pars.meta.numFP; ++fp_num)
 		{
 			meta.randomSeed = rand() % 100000;
@@ -91,16 +120,19 @@ Parameters<PRISMATIC_FLOAT_PRECISION> PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECI
 			cout << "Frozen Phonon #" << fp_num << endl;
 			prismatic_pars.meta.toString();
 
-			prismatic_pars.outputFile = H5::H5File(prismatic_pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+			reopenOutputFile(prismatic_pars, outputWriter);
 			prismatic_pars.fpFlag = fp_num;
+			prismatic_pars.datacubeAccumulator = datacubeAccumulator;
+			prismatic_pars.datacubeMap = datacubeMap;
+			prismatic_pars.outputSum = &net_output;
+			prismatic_pars.DPC_CoMSum = &DPC_CoM_output;
 
-			PRISM01_calcPotential(prismatic_pars);
-			PRISM02_calcSMatrix(prismatic_pars);
+			calcOrLoadSMatrix(prismatic_pars);
 			PRISM03_calcOutput(prismatic_pars);
 			net_output += prismatic_pars.output;
 			if (meta.saveDPC_CoM)
 				DPC_CoM_output += prismatic_pars.DPC_CoM;
-			prismatic_pars.outputFile.close();
+			closeOutputFile(prismatic_pars);
 		}
 		// divide to take average
 		for (auto &i : net_output)
@@ -115,109 +147,17 @@ Parameters<PRISMATIC_FLOAT_PRECISION> PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECI
 		}
 	}
 
-	prismatic_pars.outputFile = H5::H5File(prismatic_pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
-
-	if (prismatic_pars.meta.save3DOutput)
-	{
-		PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-		setupVDOutput(prismatic_pars, prismatic_pars.output.get_diml(), dummy);
-		Array3D<PRISMATIC_FLOAT_PRECISION> output_image = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{prismatic_pars.output.get_dimj(), prismatic_pars.output.get_dimk(), prismatic_pars.output.get_dimi()}});
-
-		std::stringstream nameString;
-		nameString << "4DSTEM_simulation/data/realslices/virtual_detector_depth" << getDigitString(0);
-		H5::Group dataGroup = prismatic_pars.outputFile.openGroup(nameString.str());
-
-		std::string dataSetName = "realslice";
-		H5::DataSet VD_data = dataGroup.openDataSet(dataSetName);
-		hsize_t mdims[3] = {prismatic_pars.xp.size(), prismatic_pars.yp.size(), prismatic_pars.Ndet};
-
-		for (auto b = 0; b < prismatic_pars.Ndet; b++)
-		{
-			for (auto y = 0; y < prismatic_pars.output.get_dimk(); ++y)
-			{
-				for (auto x = 0; x < prismatic_pars.output.get_dimj(); ++x)
-				{
-					output_image.at(x, y, b) = prismatic_pars.output.at(0, y, x, b);
-				}
-			}
-		}
-		writeDatacube3D(VD_data, &output_image[0], mdims);
-		VD_data.close();
-		dataGroup.close();
-	}
-
-
-
-
-	if (prismatic_pars.meta.save2DOutput)
-	{
-		size_t lower = std::max((size_t)0, (size_t)(prismatic_pars.meta.integrationAngleMin / prismatic_pars.meta.detectorAngleStep));
-		size_t upper = std::min((size_t)prismatic_pars.detectorAngles.size(), (size_t)(prismatic_pars.meta.integrationAngleMax / prismatic_pars.meta.detectorAngleStep));
-		Array2D<PRISMATIC_FLOAT_PRECISION> prism_image;
-		prism_image = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-			{{prismatic_pars.output.get_dimj(), prismatic_pars.output.get_dimk()}});
-		PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-		setup2DOutput(prismatic_pars, prismatic_pars.output.get_diml(), dummy);
-
-		std::stringstream nameString;
-		nameString << "4DSTEM_simulation/data/realslices/annular_detector_depth" << getDigitString(0);
-		H5::Group dataGroup = prismatic_pars.outputFile.openGroup(nameString.str());
-		H5::DataSet AD_data = dataGroup.openDataSet("realslice");
-		hsize_t mdims[2] = {prismatic_pars.xp.size(), prismatic_pars.yp.size()};
-
-		for (auto y = 0; y < prismatic_pars.output.get_dimk(); ++y)
-		{
-			for (auto x = 0; x < prismatic_pars.output.get_dimj(); ++x)
-			{
-				for (auto b = lower; b < upper; ++b)
-				{
-					prism_image.at(x, y) += prismatic_pars.output.at(0, y, x, b);
-                }
-            }
-        }
-
-		writeRealSlice(AD_data, &prism_image[0], mdims);
-		AD_data.close();
-		dataGroup.close();
-	}
-
+	reopenOutputFile(prismatic_pars, prismatic_pars.outputWriter);
+	writeDatacubeAccumulator(prismatic_pars);
 
-	if (prismatic_pars.meta.saveDPC_CoM)
-	{
-		PRISMATIC_FLOAT_PRECISION dummy = 1.0;
-		setupDPCOutput(prismatic_pars, prismatic_pars.output.get_diml(), dummy);
-
-		//create dummy array to pass to
-		Array3D<PRISMATIC_FLOAT_PRECISION> DPC_slice;
-
-		std::stringstream nameString;
-		nameString << "4DSTEM_simulation/data/realslices/DPC_CoM_depth" << getDigitString(0);
-		H5::Group dataGroup = prismatic_pars.outputFile.openGroup(nameString.str());
-		hsize_t mdims[3] = {prismatic_pars.xp.size(), prismatic_pars.yp.size(), 2};
-
-		DPC_slice = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{prismatic_pars.DPC_CoM.get_dimj(), prismatic_pars.DPC_CoM.get_dimk(), 2}});
-		std::string dataSetName = "realslice";
-		H5::DataSet DPC_data = dataGroup.openDataSet(dataSetName);
-
-		for (auto b = 0; b < prismatic_pars.DPC_CoM.get_dimi(); ++b)
-		{
-			for (auto y = 0; y < prismatic_pars.DPC_CoM.get_dimk(); ++y)
-			{
-				for (auto x = 0; x < prismatic_pars.DPC_CoM.get_dimj(); ++x)
-				{
-					DPC_slice.at(x, y, b) = prismatic_pars.DPC_CoM.at(0, y, x, b);
-				}
-			}
-		}
-
-		writeDatacube3D(DPC_data, &DPC_slice[0], mdims);
-		DPC_data.close();
-		dataGroup.close();
-	}
+	setupRealSliceOutput(prismatic_pars);
+	writeRealSliceOutput(prismatic_pars);
 
 	PRISMATIC_FLOAT_PRECISION dummy = 1.0;
 	writeMetadata(prismatic_pars, dummy);
-	prismatic_pars.outputFile.close();
+	prismatic_pars.outputWriter->close();
+
+	exportFFTWWisdom(prismatic_pars.meta);
 
 #ifdef PRISMATIC_ENABLE_GPU
 	cout << "peak GPU memory usage = " << prismatic_pars.maxGPUMem << '\n';
@@ -190,9 +190,56 @@ StreamingMode transferMethodAutoChooser(Prismatic::Metadata<T> &meta)
 }
 format_output_func_GPU formatOutput_GPU;
 
-#endif
+static void clearProbeSeries(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	const std::vector<ProbeCondition<PRISMATIC_FLOAT_PRECISION>> conditions = meta.getProbeConditions();
+	if (conditions.size() > 1)
+		cout << "Probe condition series are only supported by the CPU codes, using the first probe condition\n";
+	meta.probeDefocus = conditions[0].probeDefocus;
+	meta.C3 = conditions[0].C3;
+	meta.C5 = conditions[0].C5;
+	meta.probeSemiangle = conditions[0].probeSemiangle;
+	meta.probeXtilt = conditions[0].probeXtilt;
+	meta.probeYtilt = conditions[0].probeYtilt;
+	meta.probeDefocusSeries.clear();
+	meta.C3Series.clear();
+	meta.C5Series.clear();
+	meta.probeSemiangleSeries.clear();
+	meta.probeXtiltSeries.clear();
+	meta.probeYtiltSeries.clear();
+}
+#endif //PRISMATIC_ENABLE_GPU
+
 void configure(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 {
+	if (meta.save4DOutput & (meta.format4D != Format4D::HDF5))
+	{
+		const std::string format = meta.format4D == Format4D::Zarr ? "Zarr store" : "npy output";
+		if (meta.datacubeType != DatacubeType::Float)
+		{
+			cout << "The " << format << " holds full precision 4D output only, saving floats\n";
+			meta.datacubeType = DatacubeType::Float;
+		}
+		if (meta.compression4D != Compression4D::None)
+		{
+			cout << "The " << format << " is not compressed, "
+				 << (meta.format4D == Format4D::Zarr ? "compress the datacubes when converting the store instead\n" : "saving uncompressed 4D output\n");
+			meta.compression4D = Compression4D::None;
+		}
+		// the frozen phonons are summed in the store or the mapped arrays themselves
+		meta.fpAccumulation4D = FPAccumulation::Disk;
+	}
+	if ((meta.datacubeType != DatacubeType::Float) & (meta.numFP > 1) & (meta.fpAccumulation4D == FPAccumulation::Disk))
+	{
+		cout << "Quantized 4D output cannot be summed in the output file, accumulating the frozen phonons in memory instead\n";
+		meta.fpAccumulation4D = FPAccumulation::Auto;
+	}
+	if ((meta.numaPolicy == NUMAPolicy::FirstTouch) & (meta.affinityPolicy == AffinityPolicy::None))
+	{
+		// pages only end up near the workers that use them if the touching threads and the workers run on the same cores
+		cout << "First-touch NUMA placement needs pinned worker threads, using scatter thread affinity\n";
+		meta.affinityPolicy = AffinityPolicy::Scatter;
+	}
 	// std::cout << "Formatting" << std::endl;
 	formatOutput_CPU = formatOutput_CPU_integrate;
 #ifdef PRISMATIC_ENABLE_GPU
@@ -201,6 +248,11 @@ void configure(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 	if (meta.algorithm == Algorithm::PRISM)
 	{
 		std::cout << "Execution plan: PRISM\n";
+		if ((meta.filenameLoadSMatrix != "") & (!meta.energySeries.empty()))
+		{
+			cout << "A loaded S-matrix fixes the electron energy, the energy series is ignored\n";
+			meta.energySeries.clear();
+		}
 		execute_plan = PRISM_entry;
 #ifdef PRISMATIC_ENABLE_GPU
 		if (meta.transferMode == Prismatic::StreamingMode::Auto)
@@ -208,6 +260,17 @@ void configure(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 			meta.transferMode = transferMethodAutoChooser(meta);
 		}
 		std::cout << "Using GPU codes" << '\n';
+		if (meta.scompactPrecision != Prismatic::ScompactPrecision::Full)
+		{
+			cout << "Reduced precision S-matrix storage is only supported by the CPU codes, using full precision\n";
+			meta.scompactPrecision = Prismatic::ScompactPrecision::Full;
+		}
+		if (meta.filenameScompact != "")
+		{
+			cout << "Out-of-core S-matrix storage is only supported by the CPU codes, keeping it in memory\n";
+			meta.filenameScompact = "";
+		}
+		clearProbeSeries(meta);
 		if (meta.transferMode == Prismatic::StreamingMode::Stream)
 		{
 			cout << "Using streaming method\n";
@@ -224,6 +287,11 @@ void configure(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 #else
 		fill_Scompact = fill_Scompact_CPUOnly;
 		buildPRISMOutput = buildPRISMOutput_CPUOnly;
+		if ((meta.filenameScompact != "") & (meta.scompactPrecision != Prismatic::ScompactPrecision::Full))
+		{
+			cout << "Out-of-core S-matrix storage is always full precision\n";
+			meta.scompactPrecision = Prismatic::ScompactPrecision::Full;
+		}
 #endif //PRISMATIC_ENABLE_GPU
 	}
 	else if (meta.algorithm == Algorithm::Multislice)
@@ -232,6 +300,7 @@ void configure(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 		execute_plan = Multislice_entry;
 #ifdef PRISMATIC_ENABLE_GPU
 		std::cout << "Using GPU codes" << '\n';
+		clearProbeSeries(meta);
 		if (meta.transferMode == Prismatic::StreamingMode::Auto)
 		{
 			meta.transferMode = transferMethodAutoChooser(meta);
@@ -0,0 +1,52 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+// prismatic-convert-store: copies the 4D output of a run with --4D-format zarr from its directory store into the
+// HDF5 output file, giving the same EMD layout as a run that writes the datacubes directly.
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "datacubeStore.h"
+
+using namespace std;
+int main(int argc, const char **argv)
+{
+	if ((argc < 2) | (argc > 3))
+	{
+		cout << "Usage: prismatic-convert-store output.h5 [store]\n"
+			 << "Copies the 4D output in the directory store (default: output.h5.zarr) into the datacube groups of output.h5\n";
+		return 1;
+	}
+	const string filename(argv[1]);
+	const string root = (argc == 3) ? string(argv[2]) : filename + ".zarr";
+	try
+	{
+		H5::H5File file(filename.c_str(), H5F_ACC_RDWR);
+		const size_t converted = Prismatic::DatacubeStore::convertToEMD(root, file);
+		file.close();
+		cout << "Copied " << converted << " datacube(s) from " << root << " into " << filename << endl;
+	}
+	catch (const std::runtime_error &e)
+	{
+		cout << e.what();
+		return 1;
+	}
+	catch (const H5::Exception &e)
+	{
+		cout << "Unable to convert " << root << " into " << filename << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,123 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "datacubeAccumulator.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <sstream>
+#include <iostream>
+#ifdef __linux__
+#include <unistd.h>
+#endif //__linux__
+
+namespace Prismatic
+{
+
+extern std::mutex write4D_lock; // utility.cpp, serializes all access to the HDF5 library
+
+DatacubeAccumulator::DatacubeAccumulator(const size_t memoryBytes, const std::string &scratchPrefix)
+	: memoryBytes(memoryBytes), scratchPrefix(scratchPrefix), usedMemory(0)
+{
+}
+
+void DatacubeAccumulator::add(H5::H5File file, const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP)
+{
+	accumulate(file, nameString, mdims, offset, buffer, numFP);
+}
+
+void DatacubeAccumulator::add(H5::H5File file, const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP)
+{
+	accumulate(file, nameString, mdims, offset, buffer, numFP);
+}
+
+template <class T>
+void DatacubeAccumulator::accumulate(H5::H5File &file, const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP)
+{
+	const std::string name = getDatacubeName(nameString);
+	Datacube &cube = getDatacube(file, name);
+	if ((mdims[2] != cube.dims[2]) | (mdims[3] != cube.dims[3]) | (offset[0] >= cube.dims[0]) | (offset[1] >= cube.dims[1]))
+		throw std::runtime_error("4D output frame does not match the datacube " + name);
+
+	// each probe position is owned by a single thread, so no lock is needed here
+	PRISMATIC_FLOAT_PRECISION *frame = cube.ptr + (offset[0] * cube.dims[1] + offset[1]) * cube.dims[2] * cube.dims[3];
+	restrideFrame(buffer, mdims, numFP, frame, true);
+}
+
+DatacubeAccumulator::Datacube &DatacubeAccumulator::getDatacube(H5::H5File &file, const std::string &name)
+{
+	std::unique_lock<std::mutex> gatekeeper(lock);
+	auto it = datacubes.find(name);
+	if (it != datacubes.end())
+		return *it->second;
+
+	std::unique_ptr<Datacube> cube(new Datacube);
+	{
+		std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+		file.openDataSet(name + "/datacube").getSpace().getSimpleExtentDims(cube->dims);
+	}
+	const size_t numElements = cube->dims[0] * cube->dims[1] * cube->dims[2] * cube->dims[3];
+	const size_t bytes = numElements * sizeof(PRISMATIC_FLOAT_PRECISION);
+	if (usedMemory + bytes <= memoryBytes)
+	{
+		cube->data.resize(numElements, 0);
+		cube->ptr = &cube->data[0];
+		usedMemory += bytes;
+	}
+	else
+	{
+		std::stringstream filename;
+		filename << scratchPrefix << datacubes.size();
+		cube->mapped.reset(new MappedFile(filename.str(), bytes));
+		cube->ptr = (PRISMATIC_FLOAT_PRECISION *)cube->mapped->data();
+		std::cout << "Accumulating 4D output " << name << " in scratch file " << filename.str() << std::endl;
+	}
+	return *datacubes.insert(std::make_pair(name, std::move(cube))).first->second;
+}
+
+void DatacubeAccumulator::write(H5::H5File file, const DatacubeEncoding &encoding)
+{
+	std::unique_lock<std::mutex> gatekeeper(lock);
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+	for (auto &cube : datacubes)
+	{
+		DatacubeHandles handles = encoding.open(file, cube.first);
+		const hsize_t *dims = cube.second->dims;
+		const hsize_t rows = encoding.isFullPrecision() ? dims[0] : 1;
+		const size_t rowSize = dims[1] * dims[2] * dims[3];
+		for (hsize_t ax = 0; ax < dims[0]; ax += rows)
+		{
+			hsize_t count[4] = {rows, dims[1], dims[2], dims[3]};
+			hsize_t offset[4] = {ax, 0, 0, 0};
+			encoding.write(handles, count, offset, cube.second->ptr + ax * rowSize);
+		}
+		cube.second.reset(); // release the memory before the next one is written
+	}
+	datacubes.clear();
+	usedMemory = 0;
+	file.flush(H5F_SCOPE_LOCAL);
+}
+
+size_t getAccumulatorMemoryLimit()
+{
+#ifdef __linux__
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	if ((pages > 0) & (pageSize > 0))
+		return (size_t)pages * (size_t)pageSize / 2;
+#endif //__linux__
+	return std::numeric_limits<size_t>::max();
+}
+
+} // namespace Prismatic
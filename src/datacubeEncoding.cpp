@@ -0,0 +1,168 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "datacubeEncoding.h"
+#include "reducedPrecision.h"
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+namespace Prismatic
+{
+
+DatacubeEncoding::DatacubeEncoding(const Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+	: type(meta.datacubeType), scale(meta.datacubeScale)
+{
+}
+
+H5::DataType DatacubeEncoding::getFileType() const
+{
+	switch (type)
+	{
+	case DatacubeType::Float16:
+	{
+		// IEEE binary16, as h5py and numpy define float16
+		H5::FloatType half(H5::PredType::IEEE_F32LE);
+		half.setFields(15, 10, 5, 0, 10);
+		half.setSize(2);
+		half.setEbias(15);
+		return half;
+	}
+	case DatacubeType::UInt16:
+		return H5::PredType::NATIVE_UINT16;
+	case DatacubeType::UInt8:
+		return H5::PredType::NATIVE_UINT8;
+	default:
+		return (sizeof(PRISMATIC_FLOAT_PRECISION) == sizeof(float)) ? H5::PredType::NATIVE_FLOAT : H5::PredType::NATIVE_DOUBLE;
+	}
+}
+
+void DatacubeEncoding::setup(H5::Group &group, H5::DataSet &datacube, const hsize_t *scanDims) const
+{
+	if (isFullPrecision())
+		return;
+	if (hasFrameScales())
+	{
+		H5::DataSpace mspace(2, scanDims);
+		group.createDataSet("frame_scale", H5::PredType::NATIVE_FLOAT, mspace);
+		group.createDataSet("frame_offset", H5::PredType::NATIVE_FLOAT, mspace);
+		return;
+	}
+	H5::DataSpace scalar(H5S_SCALAR);
+	const float globalScale = (float)scale;
+	const float globalOffset = 0;
+	datacube.createAttribute("scale", H5::PredType::NATIVE_FLOAT, scalar).write(H5::PredType::NATIVE_FLOAT, &globalScale);
+	datacube.createAttribute("offset", H5::PredType::NATIVE_FLOAT, scalar).write(H5::PredType::NATIVE_FLOAT, &globalOffset);
+}
+
+DatacubeHandles DatacubeEncoding::open(H5::H5File &file, const std::string &name, const H5::DSetAccPropList &dapl) const
+{
+	DatacubeHandles handles;
+	handles.datacube = file.openDataSet(name + "/datacube", dapl);
+	if (hasFrameScales())
+	{
+		handles.frameScale = file.openDataSet(name + "/frame_scale");
+		handles.frameOffset = file.openDataSet(name + "/frame_offset");
+	}
+	return handles;
+}
+
+void DatacubeEncoding::write(DatacubeHandles &handles, const hsize_t *count, const hsize_t *offset, const float *data) const
+{
+	encodeAndWrite(handles, count, offset, data, H5::PredType::NATIVE_FLOAT);
+}
+
+void DatacubeEncoding::write(DatacubeHandles &handles, const hsize_t *count, const hsize_t *offset, const double *data) const
+{
+	encodeAndWrite(handles, count, offset, data, H5::PredType::NATIVE_DOUBLE);
+}
+
+template <class T>
+void DatacubeEncoding::encodeAndWrite(DatacubeHandles &handles, const hsize_t *count, const hsize_t *offset, const T *data, const H5::PredType &nativeType) const
+{
+	H5::DataSpace fspace = handles.datacube.getSpace();
+	H5::DataSpace mspace(4, count);
+	fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	if (isFullPrecision())
+	{
+		handles.datacube.write(data, nativeType, mspace, fspace);
+		return;
+	}
+
+	const size_t numFrames = count[0] * count[1];
+	const size_t frameSize = count[2] * count[3];
+	const size_t elementSize = (type == DatacubeType::UInt8) ? 1 : 2;
+	const T maxLevel = (type == DatacubeType::UInt8) ? 255 : 65535;
+	std::vector<unsigned char> encoded(numFrames * frameSize * elementSize);
+	std::vector<float> frameScales(numFrames);
+	std::vector<float> frameOffsets(numFrames);
+	for (auto f = 0; f < numFrames; ++f)
+	{
+		const T *in = data + f * frameSize;
+		T frameScale = scale;
+		T frameOffset = 0;
+		if (frameScale == 0)
+		{
+			// float16 keeps its relative precision at any magnitude, so only the maximum is normalized,
+			// the integer types spread their levels between the minimum and maximum of the frame
+			const auto range = std::minmax_element(in, in + frameSize);
+			if (type == DatacubeType::Float16)
+			{
+				frameScale = std::max(std::abs(*range.first), std::abs(*range.second));
+			}
+			else
+			{
+				frameOffset = *range.first;
+				frameScale = (*range.second - *range.first) / maxLevel;
+			}
+			if (frameScale == 0)
+				frameScale = 1;
+		}
+		frameScales[f] = (float)frameScale;
+		frameOffsets[f] = (float)frameOffset;
+
+		const T invScale = 1 / frameScale;
+		if (type == DatacubeType::Float16)
+		{
+			uint16_t *out = (uint16_t *)&encoded[0] + f * frameSize;
+			for (auto i = 0; i < frameSize; ++i)
+				out[i] = floatToHalf((float)(in[i] * invScale));
+		}
+		else if (type == DatacubeType::UInt16)
+		{
+			uint16_t *out = (uint16_t *)&encoded[0] + f * frameSize;
+			for (auto i = 0; i < frameSize; ++i)
+				out[i] = (uint16_t)std::min(maxLevel, std::max((T)0, std::round((in[i] - frameOffset) * invScale)));
+		}
+		else
+		{
+			uint8_t *out = (uint8_t *)&encoded[0] + f * frameSize;
+			for (auto i = 0; i < frameSize; ++i)
+				out[i] = (uint8_t)std::min(maxLevel, std::max((T)0, std::round((in[i] - frameOffset) * invScale)));
+		}
+	}
+	handles.datacube.write(&encoded[0], getFileType(), mspace, fspace);
+
+	if (hasFrameScales())
+	{
+		H5::DataSpace scaleSpace = handles.frameScale.getSpace();
+		H5::DataSpace scaleMspace(2, count);
+		scaleSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		handles.frameScale.write(&frameScales[0], H5::PredType::NATIVE_FLOAT, scaleMspace, scaleSpace);
+		handles.frameOffset.write(&frameOffsets[0], H5::PredType::NATIVE_FLOAT, scaleMspace, scaleSpace);
+	}
+}
+
+} // namespace Prismatic
@@ -0,0 +1,104 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+
+#include "datacubeMap.h"
+#include "datacubeEncoding.h"
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+namespace Prismatic
+{
+
+// header of a version 1.0 .npy file for a C ordered array, padded so that the data starts at a multiple of 64 bytes
+static std::string getNpyHeader(const hsize_t *shape, const size_t ndims)
+{
+	std::stringstream ss;
+	ss << "{'descr': '" << getByteOrderChar() << 'f' << sizeof(PRISMATIC_FLOAT_PRECISION)
+	   << "', 'fortran_order': False, 'shape': (";
+	for (auto d = 0; d < ndims; ++d)
+		ss << shape[d] << ", ";
+	ss << "), }";
+	std::string dict = ss.str();
+	const size_t prefix = 10;
+	dict.append(63 - (prefix + dict.size()) % 64, ' ');
+	dict += '\n';
+
+	std::string header("\x93NUMPY\x01\x00", 8);
+	header += (char)(dict.size() & 0xff);
+	header += (char)(dict.size() >> 8);
+	return header + dict;
+}
+
+DatacubeMap::DatacubeMap(const std::string &basename) : basename(basename) {}
+
+std::string DatacubeMap::getFilename(const std::string &name) const
+{
+	return basename + "_" + name.substr(name.find_last_of('/') + 1) + ".npy";
+}
+
+void DatacubeMap::create(const std::string &name, const hsize_t *dims)
+{
+	// a sparse frame is a single row, which needs no reordering
+	const hsize_t shape[4] = {dims[0], dims[1], dims[2] == 1 ? dims[2] : dims[3], dims[2] == 1 ? dims[3] : dims[2]};
+	const std::string header = getNpyHeader(shape, 4);
+	const size_t bytes = header.size() + dims[0] * dims[1] * dims[2] * dims[3] * sizeof(PRISMATIC_FLOAT_PRECISION);
+
+	Array &array = arrays[name.substr(name.find_last_of('/') + 1)];
+	array.mapped.reset(new MappedFile(getFilename(name), bytes, false));
+	char *p = (char *)array.mapped->data();
+	std::memcpy(p, header.data(), header.size());
+	array.data = (PRISMATIC_FLOAT_PRECISION *)(p + header.size());
+	std::copy(dims, dims + 4, array.dims);
+}
+
+void DatacubeMap::writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP, const bool accumulate) const
+{
+	writeFrame(nameString, mdims, offset, buffer, numFP, accumulate);
+}
+
+void DatacubeMap::writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP, const bool accumulate) const
+{
+	writeFrame(nameString, mdims, offset, buffer, numFP, accumulate);
+}
+
+template <class T>
+void DatacubeMap::writeFrame(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP, const bool accumulate) const
+{
+	const auto it = arrays.find(nameString.substr(nameString.find_last_of('/') + 1));
+	if (it == arrays.end())
+		throw std::runtime_error("No mapped 4D output for " + nameString + "\n");
+	const Array &array = it->second;
+	const size_t frameSize = mdims[2] * mdims[3];
+	if ((frameSize != array.dims[2] * array.dims[3]) | (offset[0] >= array.dims[0]) | (offset[1] >= array.dims[1]))
+		throw std::runtime_error("A 4D frame does not fit the mapped output " + getFilename(nameString) + "\n");
+
+	//frames are copied in the order they are computed, dividing by num FP and adding the frozen phonon sets in place
+	PRISMATIC_FLOAT_PRECISION *frame = array.data + (offset[0] * array.dims[1] + offset[1]) * frameSize;
+	if (accumulate)
+	{
+		for (auto i = 0; i < frameSize; i++)
+			frame[i] += (PRISMATIC_FLOAT_PRECISION)(buffer[i] / numFP);
+	}
+	else
+	{
+		for (auto i = 0; i < frameSize; i++)
+			frame[i] = (PRISMATIC_FLOAT_PRECISION)(buffer[i] / numFP);
+	}
+}
+
+} // namespace Prismatic
@@ -0,0 +1,91 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+
+#include "datacubeMask.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+
+namespace Prismatic
+{
+
+// reads a text file of nqx rows with nqy values each, nonzero values select a pixel
+static std::vector<bool> readMaskFile(const std::string &filename, const size_t nqx, const size_t nqy)
+{
+	std::ifstream f(filename);
+	if (!f)
+		throw std::runtime_error("Unable to open the 4D mask file " + filename + "\n");
+	std::vector<bool> selected;
+	selected.reserve(nqx * nqy);
+	double value;
+	while (f >> value)
+		selected.push_back(value != 0);
+	if (!f.eof())
+		throw std::runtime_error("Error reading the 4D mask file " + filename + "\n");
+	if (selected.size() != nqx * nqy)
+	{
+		std::stringstream ss;
+		ss << "The 4D mask file " << filename << " has " << selected.size() << " values, but the 4D output has "
+		   << nqx << " x " << nqy << " pixels\n";
+		throw std::runtime_error(ss.str());
+	}
+	return selected;
+}
+
+DatacubeMask::DatacubeMask(const Metadata<PRISMATIC_FLOAT_PRECISION> &meta, const ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> &qx,
+						   const ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> &qy, const PRISMATIC_FLOAT_PRECISION lambda)
+{
+	const size_t nqx = qx.get_dimi();
+	const size_t nqy = qy.get_dimi();
+	std::vector<bool> fromFile;
+	if (meta.filenameMask4D != "")
+		fromFile = readMaskFile(meta.filenameMask4D, nqx, nqy);
+
+	indptr.reserve(nqx + 1);
+	indptr.push_back(0);
+	for (auto i = 0; i < nqx; ++i)
+	{
+		for (auto j = 0; j < nqy; ++j)
+		{
+			const PRISMATIC_FLOAT_PRECISION alpha = std::sqrt(qx.at(i) * qx.at(i) + qy.at(j) * qy.at(j)) * lambda;
+			bool keep = (!fromFile.empty()) && fromFile[i * nqy + j];
+			for (auto a = 0; (a + 1 < meta.maskAnnuli4D.size()) & (!keep); a += 2)
+				keep = (alpha >= meta.maskAnnuli4D[a]) & (alpha < meta.maskAnnuli4D[a + 1]);
+			if (keep)
+			{
+				indices.push_back(j);
+				sources.push_back(j * nqx + i);
+			}
+		}
+		indptr.push_back(indices.size());
+	}
+	if (sources.empty())
+		throw std::runtime_error("The 4D mask does not select any pixels\n");
+}
+
+void DatacubeMask::write(H5::Group &group) const
+{
+	hsize_t indptrDims[1] = {indptr.size()};
+	hsize_t indicesDims[1] = {indices.size()};
+	H5::DataSpace indptrSpace(1, indptrDims);
+	H5::DataSpace indicesSpace(1, indicesDims);
+	H5::DataSet indptrData = group.createDataSet("mask_indptr", H5::PredType::NATIVE_UINT64, indptrSpace);
+	H5::DataSet indicesData = group.createDataSet("mask_indices", H5::PredType::NATIVE_UINT64, indicesSpace);
+	indptrData.write(&indptr[0], H5::PredType::NATIVE_UINT64);
+	indicesData.write(&indices[0], H5::PredType::NATIVE_UINT64);
+}
+
+} // namespace Prismatic
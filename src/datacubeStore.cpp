@@ -0,0 +1,280 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "datacubeStore.h"
+#include "datacubeEncoding.h"
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif //__linux__
+
+namespace Prismatic
+{
+
+static std::string getTypeString(const size_t bytes)
+{
+	return std::string(1, getByteOrderChar()) + 'f' + (char)('0' + bytes);
+}
+
+static void writeTextFile(const std::string &filename, const std::string &text)
+{
+	std::ofstream f(filename, std::ios::trunc);
+	if (!(f << text))
+		throw std::runtime_error("Unable to write " + filename + "\n");
+}
+
+#ifdef __linux__
+static void makeDirectory(const std::string &path)
+{
+	if ((mkdir(path.c_str(), 0755) != 0) && (errno != EEXIST))
+		throw std::runtime_error("Unable to create the directory " + path + "\n");
+}
+
+static void removeFiles(const std::string &path)
+{
+	DIR *dir = opendir(path.c_str());
+	if (dir == nullptr)
+		return;
+	while (struct dirent *entry = readdir(dir))
+	{
+		const std::string name(entry->d_name);
+		if ((name != ".") & (name != ".."))
+			unlink((path + "/" + name).c_str());
+	}
+	closedir(dir);
+}
+
+static bool readAll(const int fd, char *data, size_t bytes, off_t position)
+{
+	while (bytes > 0)
+	{
+		const ssize_t n = pread(fd, data, bytes, position);
+		if (n <= 0)
+			return false;
+		data += n;
+		bytes -= n;
+		position += n;
+	}
+	return true;
+}
+
+static bool writeAll(const int fd, const char *data, size_t bytes, off_t position)
+{
+	while (bytes > 0)
+	{
+		const ssize_t n = pwrite(fd, data, bytes, position);
+		if (n <= 0)
+			return false;
+		data += n;
+		bytes -= n;
+		position += n;
+	}
+	return true;
+}
+#endif //__linux__
+
+DatacubeStore::DatacubeStore(const std::string &root, const size_t chunkX, const size_t chunkY)
+	: root(root), chunkX(std::max((size_t)1, chunkX)), chunkY(std::max((size_t)1, chunkY))
+{
+#ifndef __linux__
+	throw std::runtime_error("The directory store for the 4D output is only supported on Linux\n");
+#endif //__linux__
+}
+
+std::string DatacubeStore::getArrayPath(const std::string &nameString) const
+{
+	return root + "/" + nameString.substr(nameString.find_last_of('/') + 1);
+}
+
+void DatacubeStore::create(const std::string &name, const hsize_t *dims) const
+{
+#ifdef __linux__
+	makeDirectory(root);
+	writeTextFile(root + "/.zgroup", "{\n    \"zarr_format\": 2\n}\n");
+	const std::string path = getArrayPath(name);
+	makeDirectory(path);
+	removeFiles(path);
+
+	std::stringstream ss;
+	ss << "{\n"
+	   << "    \"chunks\": [" << chunkX << ", " << chunkY << ", " << dims[2] << ", " << dims[3] << "],\n"
+	   << "    \"compressor\": null,\n"
+	   << "    \"dtype\": \"" << getTypeString(sizeof(PRISMATIC_FLOAT_PRECISION)) << "\",\n"
+	   << "    \"fill_value\": 0.0,\n"
+	   << "    \"filters\": null,\n"
+	   << "    \"order\": \"C\",\n"
+	   << "    \"shape\": [" << dims[0] << ", " << dims[1] << ", " << dims[2] << ", " << dims[3] << "],\n"
+	   << "    \"zarr_format\": 2\n"
+	   << "}\n";
+	writeTextFile(path + "/.zarray", ss.str());
+#endif //__linux__
+}
+
+void DatacubeStore::writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP, const bool accumulate) const
+{
+	writeFrame(nameString, mdims, offset, buffer, numFP, accumulate);
+}
+
+void DatacubeStore::writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP, const bool accumulate) const
+{
+	writeFrame(nameString, mdims, offset, buffer, numFP, accumulate);
+}
+
+template <class T>
+void DatacubeStore::writeFrame(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP, const bool accumulate) const
+{
+#ifdef __linux__
+	const size_t frameSize = mdims[2] * mdims[3];
+
+	std::vector<T> finalBuffer(frameSize);
+	restrideFrame(buffer, mdims, numFP, &finalBuffer[0]);
+
+	std::stringstream ss;
+	ss << getArrayPath(nameString) << '/' << offset[0] / chunkX << '.' << offset[1] / chunkY << ".0.0";
+	const std::string filename = ss.str();
+	const size_t frameBytes = frameSize * sizeof(T);
+	const off_t chunkBytes = (off_t)(chunkX * chunkY * frameBytes);
+	const off_t position = (off_t)(((offset[0] % chunkX) * chunkY + offset[1] % chunkY) * frameBytes);
+
+	const int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		throw std::runtime_error("Unable to open " + filename + "\n");
+
+	// chunks at the edge of the scan are padded to the full chunk size. Only ever growing the file is safe
+	// while other threads write to it
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	if (ok && (st.st_size < chunkBytes))
+		ok = ftruncate(fd, chunkBytes) == 0;
+
+	//add frozen phonon set
+	if (ok & accumulate)
+	{
+		std::vector<T> readBuffer(frameSize);
+		ok = readAll(fd, (char *)&readBuffer[0], frameBytes, position);
+		for (auto i = 0; i < frameSize; i++)
+			finalBuffer[i] += readBuffer[i];
+	}
+	ok = ok && writeAll(fd, (const char *)&finalBuffer[0], frameBytes, position);
+	close(fd);
+	if (!ok)
+		throw std::runtime_error("Unable to write a 4D frame to " + filename + "\n");
+#endif //__linux__
+}
+
+// reads the list of integers of key from a .zarray manifest
+static std::vector<hsize_t> readManifestList(const std::string &text, const std::string &key)
+{
+	std::vector<hsize_t> values;
+	const size_t start = text.find('[', text.find("\"" + key + "\""));
+	const size_t stop = text.find(']', start);
+	if ((start == std::string::npos) | (stop == std::string::npos))
+		return values;
+	std::stringstream ss(text.substr(start + 1, stop - start - 1));
+	hsize_t value;
+	char separator;
+	while (ss >> value)
+	{
+		values.push_back(value);
+		ss >> separator;
+	}
+	return values;
+}
+
+// reads the string value of key from a .zarray manifest
+static std::string readManifestString(const std::string &text, const std::string &key)
+{
+	const size_t colon = text.find(':', text.find("\"" + key + "\""));
+	const size_t start = text.find('"', colon);
+	const size_t stop = text.find('"', start + 1);
+	if ((colon == std::string::npos) | (start == std::string::npos) | (stop == std::string::npos))
+		return "";
+	return text.substr(start + 1, stop - start - 1);
+}
+
+size_t DatacubeStore::convertToEMD(const std::string &root, H5::H5File &file)
+{
+	H5::Group datacubes = file.openGroup("4DSTEM_simulation/data/datacubes");
+	size_t converted = 0;
+	for (hsize_t n = 0; n < datacubes.getNumObjs(); ++n)
+	{
+		const std::string name = datacubes.getObjnameByIdx(n);
+		const std::string path = root + "/" + name;
+		std::ifstream f(path + "/.zarray");
+		if (!f)
+			continue;
+		std::stringstream manifest;
+		manifest << f.rdbuf();
+		const std::vector<hsize_t> shape = readManifestList(manifest.str(), "shape");
+		const std::vector<hsize_t> chunks = readManifestList(manifest.str(), "chunks");
+		const std::string dtype = readManifestString(manifest.str(), "dtype");
+		if ((shape.size() != 4) | (chunks.size() != 4) | (dtype.size() != 3))
+			throw std::runtime_error("Unable to read the manifest " + path + "/.zarray\n");
+
+		// the stored byte order is converted by the HDF5 library
+		const bool little = dtype[0] == '<';
+		const bool single = dtype[2] == '4';
+		const H5::PredType &memType = single ? (little ? H5::PredType::IEEE_F32LE : H5::PredType::IEEE_F32BE)
+											 : (little ? H5::PredType::IEEE_F64LE : H5::PredType::IEEE_F64BE);
+		const H5::PredType &fileType = single ? H5::PredType::NATIVE_FLOAT : H5::PredType::NATIVE_DOUBLE;
+
+		H5::Group group = datacubes.openGroup(name);
+		if (H5Lexists(group.getId(), "datacube", H5P_DEFAULT) > 0)
+			throw std::runtime_error("The group " + name + " already has a datacube\n");
+		H5::DSetCreatPropList plist;
+		hsize_t chunkDims[4];
+		for (auto d = 0; d < 4; ++d)
+			chunkDims[d] = std::max((hsize_t)1, std::min(chunks[d], shape[d]));
+		plist.setChunk(4, chunkDims);
+		H5::DataSpace fspace(4, &shape[0]);
+		H5::DataSet datacube = group.createDataSet("datacube", fileType, fspace, plist);
+
+		const size_t chunkBytes = chunks[0] * chunks[1] * chunks[2] * chunks[3] * (single ? 4 : 8);
+		std::vector<char> buffer(chunkBytes);
+		H5::DataSpace mspace(4, &chunks[0]);
+		for (hsize_t a = 0; a * chunks[0] < shape[0]; ++a)
+		{
+			for (hsize_t b = 0; b * chunks[1] < shape[1]; ++b)
+			{
+				// missing chunks were never written and hold the fill value
+				std::stringstream ss;
+				ss << path << '/' << a << '.' << b << ".0.0";
+				std::ifstream chunk(ss.str(), std::ios::binary);
+				std::fill(buffer.begin(), buffer.end(), 0);
+				if (chunk)
+					chunk.read(&buffer[0], chunkBytes);
+
+				const hsize_t offset[4] = {a * chunks[0], b * chunks[1], 0, 0};
+				const hsize_t count[4] = {std::min(chunks[0], shape[0] - offset[0]), std::min(chunks[1], shape[1] - offset[1]), shape[2], shape[3]};
+				const hsize_t origin[4] = {0, 0, 0, 0};
+				fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+				mspace.selectHyperslab(H5S_SELECT_SET, count, origin);
+				datacube.write(&buffer[0], memType, mspace, fspace);
+			}
+		}
+		++converted;
+	}
+	return converted;
+}
+
+} // namespace Prismatic
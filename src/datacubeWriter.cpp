@@ -0,0 +1,308 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "datacubeWriter.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace Prismatic
+{
+
+extern std::mutex write4D_lock; // utility.cpp, serializes all access to the HDF5 library
+
+static const H5::PredType &nativeType()
+{
+	return (sizeof(PRISMATIC_FLOAT_PRECISION) == sizeof(float)) ? H5::PredType::NATIVE_FLOAT : H5::PredType::NATIVE_DOUBLE;
+}
+
+// the HDF5 documentation recommends a prime number of hash slots, about 100 times the number of cached chunks
+static size_t getChunkCacheSlots(const size_t numChunks)
+{
+	size_t slots = std::max((size_t)521, 100 * numChunks) | 1;
+	while (true)
+	{
+		bool prime = true;
+		for (size_t d = 3; d * d <= slots; d += 2)
+		{
+			if (slots % d == 0)
+			{
+				prime = false;
+				break;
+			}
+		}
+		if (prime)
+			return slots;
+		slots += 2;
+	}
+}
+
+DatacubeWriter::DatacubeWriter(H5::H5File file, const DatacubeEncoding &encoding, const bool accumulate, const size_t queueBytes)
+	: file(file), encoding(encoding), accumulate(accumulate), queueBytes(queueBytes), queuedBytes(0), finished(false), assembledBytes(0)
+{
+	worker = std::thread(&DatacubeWriter::run, this);
+}
+
+DatacubeWriter::~DatacubeWriter()
+{
+	if (worker.joinable())
+	{
+		try
+		{
+			finish();
+		}
+		catch (const std::runtime_error &e)
+		{
+		}
+	}
+}
+
+void DatacubeWriter::push(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP)
+{
+	enqueue(nameString, mdims, offset, buffer, numFP);
+}
+
+void DatacubeWriter::push(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP)
+{
+	enqueue(nameString, mdims, offset, buffer, numFP);
+}
+
+template <class T>
+void DatacubeWriter::enqueue(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP)
+{
+	Frame frame;
+	frame.name = getDatacubeName(nameString);
+	frame.ax = offset[0];
+	frame.ay = offset[1];
+	frame.dimx = mdims[2];
+	frame.dimy = mdims[3];
+
+	frame.data.resize(mdims[2] * mdims[3]);
+	restrideFrame(buffer, mdims, numFP, &frame.data[0]);
+
+	const size_t bytes = frame.data.size() * sizeof(PRISMATIC_FLOAT_PRECISION);
+	std::unique_lock<std::mutex> gatekeeper(lock);
+	notFull.wait(gatekeeper, [this, bytes]() { return queue.empty() | (queuedBytes + bytes <= queueBytes) | !error.empty(); });
+	if (!error.empty())
+		return; // reported by finish
+	queuedBytes += bytes;
+	queue.push_back(std::move(frame));
+	gatekeeper.unlock();
+	notEmpty.notify_one();
+}
+
+void DatacubeWriter::run()
+{
+	std::unique_lock<std::mutex> gatekeeper(lock);
+	while (true)
+	{
+		notEmpty.wait(gatekeeper, [this]() { return (!queue.empty()) | finished; });
+		if (queue.empty())
+			break; // finished and drained
+		Frame frame = std::move(queue.front());
+		queue.pop_front();
+		queuedBytes -= frame.data.size() * sizeof(PRISMATIC_FLOAT_PRECISION);
+		const bool failed = !error.empty();
+		gatekeeper.unlock();
+		notFull.notify_all();
+		if (!failed)
+		{
+			try
+			{
+				store(frame);
+			}
+			catch (const H5::Exception &e)
+			{
+				gatekeeper.lock();
+				error = "Unable to write 4D output frame to " + frame.name + ": " + e.getDetailMsg();
+				gatekeeper.unlock();
+				notFull.notify_all();
+			}
+			catch (const std::runtime_error &e)
+			{
+				gatekeeper.lock();
+				error = e.what();
+				gatekeeper.unlock();
+				notFull.notify_all();
+			}
+		}
+		gatekeeper.lock();
+	}
+	gatekeeper.unlock();
+
+	// bands that did not receive all of their frames are written frame by frame
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock, std::defer_lock);
+	try
+	{
+		for (auto &target : targets)
+		{
+			for (auto &band : target.second.bands)
+				writeBand(target.second, band.first, band.second);
+		}
+	}
+	catch (const H5::Exception &e)
+	{
+		if (error.empty())
+			error = "Unable to write 4D output: " + e.getDetailMsg();
+	}
+	writeGatekeeper.lock();
+	targets.clear(); // closes the datasets
+}
+
+void DatacubeWriter::store(Frame &frame)
+{
+	auto it = targets.find(frame.name);
+	if (it == targets.end())
+	{
+		Target target;
+		std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+		H5::DataSet dataset = file.openDataSet(frame.name + "/datacube");
+		dataset.getSpace().getSimpleExtentDims(target.dims);
+		hsize_t chunk[4] = {1, 1, target.dims[2], target.dims[3]};
+		H5::DSetCreatPropList plist = dataset.getCreatePlist();
+		if (plist.getLayout() == H5D_CHUNKED)
+			plist.getChunk(4, chunk);
+
+		// size the bands so that they are written in large contiguous blocks of whole scan rows,
+		// and whole rows of chunks so that every chunk is compressed once
+		const size_t rowBytes = target.dims[0] * target.dims[2] * target.dims[3] * sizeof(PRISMATIC_FLOAT_PRECISION);
+		const hsize_t budgetRows = queueBytes / 4 / std::max((size_t)1, rowBytes);
+		target.bandRows = std::min(target.dims[1], std::max(chunk[1], budgetRows / chunk[1] * chunk[1]));
+
+		// cache the chunks of one band, so that the frozen phonon passes read and write each chunk once
+		const size_t chunkBytes = chunk[0] * chunk[1] * chunk[2] * chunk[3] * sizeof(PRISMATIC_FLOAT_PRECISION);
+		const size_t numChunks = ((target.dims[0] + chunk[0] - 1) / chunk[0]) * ((target.bandRows + chunk[1] - 1) / chunk[1]);
+		H5::DSetAccPropList dapl;
+		dapl.setChunkCache(getChunkCacheSlots(numChunks), std::max((size_t)1 << 20, numChunks * chunkBytes), 1.0);
+		dataset.close();
+		target.handles = encoding.open(file, frame.name, dapl);
+		writeGatekeeper.unlock();
+		it = targets.insert(std::make_pair(frame.name, std::move(target))).first;
+	}
+	Target &target = it->second;
+	if ((frame.dimx != target.dims[2]) | (frame.dimy != target.dims[3]) | (frame.ax >= target.dims[0]) | (frame.ay >= target.dims[1]))
+		throw std::runtime_error("4D output frame does not match the datacube " + frame.name);
+
+	const hsize_t firstRow = frame.ay / target.bandRows * target.bandRows;
+	const hsize_t numRows = std::min(target.bandRows, target.dims[1] - firstRow);
+	const size_t frameSize = frame.data.size();
+	Band &band = target.bands[firstRow];
+	if (band.data.empty())
+	{
+		band.data.assign(target.dims[0] * numRows * frameSize, 0);
+		band.received.assign(target.dims[0] * numRows, false);
+		band.numReceived = 0;
+		assembledBytes += band.data.size() * sizeof(PRISMATIC_FLOAT_PRECISION);
+	}
+	const size_t index = frame.ax * numRows + (frame.ay - firstRow);
+	std::copy(frame.data.begin(), frame.data.end(), band.data.begin() + index * frameSize);
+	if (!band.received[index])
+	{
+		band.received[index] = true;
+		++band.numReceived;
+	}
+	if (band.numReceived == band.received.size())
+	{
+		assembledBytes -= band.data.size() * sizeof(PRISMATIC_FLOAT_PRECISION);
+		writeBand(target, firstRow, band);
+		target.bands.erase(firstRow);
+	}
+
+	// probes dispatched in strips fill many bands at once, write out partial ones to stay within the budget
+	while (assembledBytes > queueBytes)
+		flushFullestBand();
+}
+
+void DatacubeWriter::flushFullestBand()
+{
+	Target *fullestTarget = nullptr;
+	std::map<hsize_t, Band>::iterator fullest;
+	for (auto &target : targets)
+	{
+		for (auto it = target.second.bands.begin(); it != target.second.bands.end(); ++it)
+		{
+			if ((fullestTarget == nullptr) || (it->second.numReceived > fullest->second.numReceived))
+			{
+				fullestTarget = &target.second;
+				fullest = it;
+			}
+		}
+	}
+	if (fullestTarget == nullptr)
+	{
+		assembledBytes = 0;
+		return;
+	}
+	assembledBytes -= fullest->second.data.size() * sizeof(PRISMATIC_FLOAT_PRECISION);
+	writeBand(*fullestTarget, fullest->first, fullest->second);
+	fullestTarget->bands.erase(fullest);
+}
+
+void DatacubeWriter::writeBand(Target &target, const hsize_t firstRow, Band &band)
+{
+	const hsize_t numRows = band.received.size() / target.dims[0];
+	const size_t frameSize = target.dims[2] * target.dims[3];
+	if (band.numReceived == band.received.size())
+	{
+		hsize_t count[4] = {target.dims[0], numRows, target.dims[2], target.dims[3]};
+		hsize_t offset[4] = {0, firstRow, 0, 0};
+		writeBlock(target, count, offset, &band.data[0]);
+		return;
+	}
+	for (auto index = 0; index < band.received.size(); ++index)
+	{
+		if (!band.received[index])
+			continue;
+		hsize_t count[4] = {1, 1, target.dims[2], target.dims[3]};
+		hsize_t offset[4] = {index / numRows, firstRow + index % numRows, 0, 0};
+		writeBlock(target, count, offset, &band.data[index * frameSize]);
+	}
+}
+
+void DatacubeWriter::writeBlock(Target &target, const hsize_t *count, const hsize_t *offset, PRISMATIC_FLOAT_PRECISION *data)
+{
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+
+	//add frozen phonon set, only done in full precision
+	if (accumulate)
+	{
+		H5::DataSpace fspace = target.handles.datacube.getSpace();
+		H5::DataSpace mspace(4, count);
+		fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		const size_t n = count[0] * count[1] * count[2] * count[3];
+		std::vector<PRISMATIC_FLOAT_PRECISION> readBuffer(n);
+		target.handles.datacube.read(&readBuffer[0], nativeType(), mspace, fspace);
+		for (auto i = 0; i < n; i++)
+			data[i] += readBuffer[i];
+	}
+	encoding.write(target.handles, count, offset, data);
+}
+
+void DatacubeWriter::finish()
+{
+	{
+		std::unique_lock<std::mutex> gatekeeper(lock);
+		finished = true;
+	}
+	notEmpty.notify_all();
+	worker.join();
+	{
+		std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+		file.flush(H5F_SCOPE_LOCAL);
+	}
+	if (!error.empty())
+		throw std::runtime_error(error);
+}
+
+} // namespace Prismatic
@@ -22,6 +22,8 @@
 #include "params.h"
 #include "go.h"
 #include "parseInput.h"
+#include "PRISM01_calcPotential.h"
+#include "utility.h"
 
 namespace Prismatic
 {
@@ -30,8 +32,26 @@ void go(Metadata<PRISMATIC_FLOAT_PRECISION> meta)
 	// configure simulation behavior
 	Prismatic::configure(meta);
 
-	// execute simulation
-	Prismatic::execute_plan(meta);
+	// execute simulation, once per energy of an energy series
+	if (meta.energySeries.empty())
+	{
+		Prismatic::execute_plan(meta);
+	}
+	else
+	{
+		for (auto n = 0; n < meta.energySeries.size(); ++n)
+		{
+			Metadata<PRISMATIC_FLOAT_PRECISION> energyMeta(meta);
+			energyMeta.E0 = meta.energySeries[n];
+			energyMeta.filenameOutput = getSeriesFilename(meta.filenameOutput, "energy", n);
+			if (meta.filenameSaveSMatrix != "")
+				energyMeta.filenameSaveSMatrix = getSeriesFilename(meta.filenameSaveSMatrix, "energy", n);
+			std::cout << "Energy series #" << n << ": E0 = " << energyMeta.E0 / 1000 << " keV, output file "
+					  << energyMeta.filenameOutput << std::endl;
+			Prismatic::execute_plan(energyMeta);
+		}
+		Prismatic::clearPotentialCache();
+	}
 
 #ifdef _WIN32
 	char *appdata = getenv("APPDATA");
@@ -0,0 +1,56 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "mappedStorage.h"
+#include <stdexcept>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif //__linux__
+
+namespace Prismatic
+{
+
+MappedFile::MappedFile(const std::string &filename, const size_t bytes, const bool scratch) : ptr(nullptr), bytes(bytes)
+{
+#ifdef __linux__
+	int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, scratch ? 0600 : 0644);
+	if (fd < 0)
+		throw std::runtime_error("Unable to create " + filename + "\n");
+	if (scratch)
+		unlink(filename.c_str()); // scratch space, the blocks are freed when the mapping is released
+	if (ftruncate(fd, (off_t)bytes) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("Unable to resize " + filename + "\n");
+	}
+	void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // the mapping keeps the file alive
+	if (p == MAP_FAILED)
+		throw std::runtime_error("Unable to map " + filename + "\n");
+	ptr = p;
+#else
+	throw std::runtime_error("Memory-mapped scratch files are only supported on Linux\n");
+#endif //__linux__
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef __linux__
+	if (ptr != nullptr)
+		munmap(ptr, bytes);
+#endif //__linux__
+}
+
+} // namespace Prismatic
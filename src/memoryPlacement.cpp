@@ -0,0 +1,205 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "memoryPlacement.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif //__linux__
+
+namespace Prismatic
+{
+
+#ifdef __linux__
+// values from <numaif.h>, defined here so that libnuma is not a build requirement
+#define PRISMATIC_MPOL_INTERLEAVE 3
+#define PRISMATIC_MPOL_MF_MOVE (1 << 1)
+
+struct CPUTopology
+{
+	std::vector<int> compact; // allowed CPUs in numerical order
+	std::vector<int> scatter; // allowed CPUs round-robin across sockets
+	size_t numNodes;
+};
+
+static int readSysfsInt(const std::string &filename, const int fallback)
+{
+	std::ifstream f(filename);
+	int value;
+	if (f >> value)
+		return value;
+	return fallback;
+}
+
+static CPUTopology detectTopology()
+{
+	CPUTopology topo;
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+	{
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed))
+				topo.compact.push_back(cpu);
+		}
+	}
+
+	// group the allowed CPUs by physical package and deal them out one socket at a time
+	std::vector<std::pair<int, int>> packages; // (package, cpu)
+	for (auto &cpu : topo.compact)
+	{
+		std::stringstream ss;
+		ss << "/sys/devices/system/cpu/cpu" << cpu << "/topology/physical_package_id";
+		packages.push_back(std::make_pair(readSysfsInt(ss.str(), 0), cpu));
+	}
+	std::stable_sort(packages.begin(), packages.end(),
+					 [](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first < b.first; });
+	std::vector<std::vector<int>> perPackage;
+	int lastPackage = -1;
+	for (auto &p : packages)
+	{
+		if (p.first != lastPackage)
+		{
+			perPackage.push_back(std::vector<int>());
+			lastPackage = p.first;
+		}
+		perPackage.back().push_back(p.second);
+	}
+	for (size_t idx = 0; topo.scatter.size() < topo.compact.size(); ++idx)
+	{
+		for (auto &cpus : perPackage)
+		{
+			if (idx < cpus.size())
+				topo.scatter.push_back(cpus[idx]);
+		}
+	}
+
+	topo.numNodes = 0;
+	while (true)
+	{
+		std::stringstream ss;
+		ss << "/sys/devices/system/node/node" << topo.numNodes;
+		if (access(ss.str().c_str(), F_OK) != 0)
+			break;
+		++topo.numNodes;
+	}
+	topo.numNodes = std::max((size_t)1, topo.numNodes);
+	return topo;
+}
+
+static const CPUTopology &getTopology()
+{
+	static const CPUTopology topo = detectTopology();
+	return topo;
+}
+
+static bool pinThread(pthread_t handle, const size_t threadID, const AffinityPolicy policy)
+{
+	const CPUTopology &topo = getTopology();
+	const std::vector<int> &order = (policy == AffinityPolicy::Scatter) ? topo.scatter : topo.compact;
+	if (order.empty())
+		return false;
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(order[threadID % order.size()], &cpuset);
+	return pthread_setaffinity_np(handle, sizeof(cpuset), &cpuset) == 0;
+}
+#endif //__linux__
+
+void pinCurrentThread(const size_t threadID, const Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+#ifdef __linux__
+	if (meta.affinityPolicy == AffinityPolicy::None)
+		return;
+	if (!pinThread(pthread_self(), threadID, meta.affinityPolicy))
+		std::cout << "Unable to set CPU affinity for thread #" << threadID << std::endl;
+#endif //__linux__
+}
+
+void placeZeroedBuffer(void *ptr, const size_t bytes, const Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+#ifdef __linux__
+	if ((!meta.useHugePages) & (meta.numaPolicy == NUMAPolicy::Default))
+		return;
+
+	// only whole pages that lie entirely inside of the buffer can be advised or moved
+	const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t start = ((size_t)ptr + pageSize - 1) / pageSize * pageSize;
+	const size_t stop = ((size_t)ptr + bytes) / pageSize * pageSize;
+	if (stop <= start)
+		return;
+	char *alignedPtr = (char *)start;
+	const size_t alignedBytes = stop - start;
+
+#ifdef MADV_HUGEPAGE
+	if (meta.useHugePages)
+		madvise(alignedPtr, alignedBytes, MADV_HUGEPAGE);
+#endif //MADV_HUGEPAGE
+
+	const CPUTopology &topo = getTopology();
+	if (topo.numNodes < 2)
+		return;
+
+	if (meta.numaPolicy == NUMAPolicy::Interleave)
+	{
+		// migrate the already touched pages round-robin across all nodes
+		const size_t bitsPerWord = 8 * sizeof(unsigned long);
+		std::vector<unsigned long> nodemask(topo.numNodes / bitsPerWord + 1, 0);
+		for (size_t node = 0; node < topo.numNodes; ++node)
+			nodemask[node / bitsPerWord] |= 1UL << (node % bitsPerWord);
+		if (syscall(SYS_mbind, alignedPtr, alignedBytes, PRISMATIC_MPOL_INTERLEAVE,
+					&nodemask[0], nodemask.size() * bitsPerWord + 1, PRISMATIC_MPOL_MF_MOVE) != 0)
+		{
+			std::cout << "Unable to interleave memory across NUMA nodes" << std::endl;
+		}
+	}
+	else if (meta.numaPolicy == NUMAPolicy::FirstTouch)
+	{
+		// The contents are zero, so the pages can be released and faulted back in as fresh zero pages.
+		// Each thread, pinned like the worker with the same index (configure turns on thread affinity for
+		// first-touch), faults in the contiguous block that worker is most likely to use, so the pages
+		// are allocated on its node.
+		if (madvise(alignedPtr, alignedBytes, MADV_DONTNEED) != 0)
+			return;
+		const size_t numPages = alignedBytes / pageSize;
+		const size_t numThreads = std::max((size_t)1, std::min(meta.numThreads, numPages));
+		std::vector<std::thread> workers;
+		workers.reserve(numThreads);
+		for (size_t t = 0; t < numThreads; ++t)
+		{
+			workers.push_back(std::thread([&meta, alignedPtr, pageSize, numPages, numThreads, t]() {
+				pinCurrentThread(t, meta);
+				const size_t firstPage = numPages * t / numThreads;
+				const size_t lastPage = numPages * (t + 1) / numThreads;
+				for (size_t page = firstPage; page < lastPage; ++page)
+					*(volatile char *)(alignedPtr + page * pageSize) = 0;
+			}));
+		}
+		for (auto &t : workers)
+			t.join();
+	}
+#endif //__linux__
+}
+
+} // namespace Prismatic
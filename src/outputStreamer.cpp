@@ -0,0 +1,115 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+
+#include "outputStreamer.h"
+#include <iostream>
+#include <algorithm>
+#include "params.h"
+#include "utility.h"
+
+namespace Prismatic
+{
+
+extern std::mutex write4D_lock; // utility.cpp, serializes all access to the HDF5 library
+
+OutputStreamer::OutputStreamer(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t interval)
+	: pars(pars), interval(std::max((size_t)1, interval)), probesDone(0), finished(false), failed(false)
+{
+	worker = std::thread(&OutputStreamer::run, this);
+}
+
+OutputStreamer::~OutputStreamer()
+{
+	if (worker.joinable())
+		finish();
+}
+
+void OutputStreamer::run()
+{
+	std::unique_lock<std::mutex> gatekeeper(lock);
+	while (!wake.wait_for(gatekeeper, interval, [this]() { return finished; }))
+	{
+		gatekeeper.unlock();
+		refresh(probesDone);
+		gatekeeper.lock();
+	}
+}
+
+void OutputStreamer::finish()
+{
+	{
+		std::unique_lock<std::mutex> gatekeeper(lock);
+		finished = true;
+	}
+	wake.notify_all();
+	worker.join();
+	refresh(pars.xp.size() * pars.yp.size());
+}
+
+void OutputStreamer::refresh(const size_t probes)
+{
+	if (failed)
+		return;
+
+	// fraction of the probe positions of all frozen phonon passes that are done
+	const size_t numProbes = pars.xp.size() * pars.yp.size();
+	const double progress = (double)(pars.fpFlag * numProbes + std::min(probes, numProbes)) / (double)(pars.meta.numFP * numProbes);
+
+	// after the first pass, the images are the running average over the passes that have reached each probe position.
+	// Positions the current pass has not computed yet are still zero in pars.output and keep the previous average
+	Array4D<PRISMATIC_FLOAT_PRECISION> output, DPC_CoM;
+	const bool average = (pars.fpFlag > 0) & (pars.outputSum != nullptr);
+	if (average)
+	{
+		output = *pars.outputSum;
+		if (pars.meta.saveDPC_CoM)
+			DPC_CoM = *pars.DPC_CoMSum;
+		const size_t numPositions = output.get_diml() * output.get_dimk() * output.get_dimj();
+		const size_t Ndet = output.get_dimi();
+		for (auto n = 0; n < numPositions; ++n)
+		{
+			bool done = false;
+			for (auto b = 0; (!done) & (b < Ndet); ++b)
+				done = pars.output[n * Ndet + b] != 0;
+			const PRISMATIC_FLOAT_PRECISION numPasses = done ? pars.fpFlag + 1 : pars.fpFlag;
+			for (auto b = 0; b < Ndet; ++b)
+				output[n * Ndet + b] = (output[n * Ndet + b] + pars.output[n * Ndet + b]) / numPasses;
+			if (pars.meta.saveDPC_CoM)
+			{
+				for (auto b = 0; b < 2; ++b)
+					DPC_CoM[n * 2 + b] = (DPC_CoM[n * 2 + b] + pars.DPC_CoM[n * 2 + b]) / numPasses;
+			}
+		}
+	}
+
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+	try
+	{
+		if (average)
+			writeRealSliceOutput(pars, output, DPC_CoM);
+		else
+			writeRealSliceOutput(pars);
+		pars.outputWriter->getFile().openDataSet("progress").write(&progress, H5::PredType::NATIVE_DOUBLE);
+		pars.outputWriter->getFile().flush(H5F_SCOPE_LOCAL);
+	}
+	catch (const H5::Exception &e)
+	{
+		// the output is still written at the end of the run
+		std::cout << "Unable to refresh the streamed output, it is no longer updated during the run" << std::endl;
+		failed = true;
+	}
+}
+
+} // namespace Prismatic
@@ -0,0 +1,119 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "outputWriter.h"
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Prismatic
+{
+
+static H5::FileAccPropList getFileAccess(const bool swmr)
+{
+	H5::FileAccPropList fapl;
+	if (swmr)
+		fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+	return fapl;
+}
+
+OutputWriter::OutputWriter(const std::string &filename, const unsigned int flags, const bool swmr)
+	: file(filename.c_str(), flags, H5::FileCreatPropList::DEFAULT, getFileAccess(swmr))
+{
+}
+
+OutputWriter::~OutputWriter()
+{
+	try
+	{
+		close();
+	}
+	catch (const H5::Exception &e)
+	{
+	}
+}
+
+void OutputWriter::writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const float *buffer, const float numFP, const bool accumulate, const DatacubeEncoding &encoding)
+{
+	writeFrame(nameString, mdims, offset, buffer, numFP, accumulate, encoding, H5::PredType::NATIVE_FLOAT);
+}
+
+void OutputWriter::writeDatacube4D(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const double *buffer, const double numFP, const bool accumulate, const DatacubeEncoding &encoding)
+{
+	writeFrame(nameString, mdims, offset, buffer, numFP, accumulate, encoding, H5::PredType::NATIVE_DOUBLE);
+}
+
+template <class T>
+void OutputWriter::writeFrame(const std::string &nameString, const hsize_t *mdims, const hsize_t *offset, const T *buffer, const T numFP, const bool accumulate, const DatacubeEncoding &encoding, const H5::PredType &type)
+{
+	const size_t frameSize = mdims[0] * mdims[1] * mdims[2] * mdims[3];
+
+	//restride outside of the lock
+	std::vector<T> finalBuffer(frameSize);
+	restrideFrame(buffer, mdims, numFP, &finalBuffer[0]);
+
+	//lock the whole file access/writing procedure in only one location
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+	Datacube &cube = getDatacube(nameString, mdims, encoding);
+	if (!encoding.isFullPrecision())
+	{
+		encoding.write(cube.handles, mdims, offset, &finalBuffer[0]);
+		return;
+	}
+	cube.fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
+
+	//add frozen phonon set
+	if (accumulate)
+	{
+		std::vector<T> readBuffer(frameSize);
+		cube.handles.datacube.read(&readBuffer[0], type, cube.mspace, cube.fspace);
+		for (auto i = 0; i < frameSize; i++)
+			finalBuffer[i] += readBuffer[i];
+	}
+	cube.handles.datacube.write(&finalBuffer[0], type, cube.mspace, cube.fspace);
+}
+
+OutputWriter::Datacube &OutputWriter::getDatacube(const std::string &nameString, const hsize_t *mdims, const DatacubeEncoding &encoding)
+{
+	const std::string name = getDatacubeName(nameString);
+	auto it = datacubes.find(name);
+	if (it != datacubes.end())
+		return it->second;
+
+	Datacube cube;
+	cube.handles = encoding.open(file, name);
+	cube.fspace = cube.handles.datacube.getSpace();
+	cube.mspace = H5::DataSpace(4, mdims); //rank = 4
+	return datacubes.insert(std::make_pair(name, cube)).first->second;
+}
+
+void OutputWriter::startSWMR()
+{
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+	if (H5Fstart_swmr_write(file.getId()) < 0)
+		throw std::runtime_error("Unable to switch the output file to SWMR mode\n");
+}
+
+void OutputWriter::close()
+{
+	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+	datacubes.clear();
+	if (file.getId() > 0)
+	{
+		file.flush(H5F_SCOPE_LOCAL);
+		file.close();
+	}
+}
+
+} // namespace Prismatic
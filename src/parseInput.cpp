@@ -78,6 +78,13 @@ void printHelp()
               << "* -C3 value : microscope C3 aberration constant (in Angstrom) (default: " << defaults.C3 << ")\n"
               << "* -C5 value : microscope C5 aberration constant (in Angstrom) (default: " << defaults.C5 << ")\n"
               << "* --probe-semiangle (-sa) value : maximum probe semiangle (in mrad) (default: " << 1000 * defaults.probeSemiangle << ")\n"
+              << "* --probe-defocus-series (-dfs) v1,v2,... : list of probe defoci (in Angstroms) to simulate in one run. Every combination of the probe series is evaluated in the same pass, sharing the S-matrix (PRISM) or the transmission slices (multislice). CPU only (default: none)\n"
+              << "* --C3-series (-C3s) v1,v2,... : list of C3 values (in Angstroms) to simulate in one run (default: none)\n"
+              << "* --C5-series (-C5s) v1,v2,... : list of C5 values (in Angstroms) to simulate in one run (default: none)\n"
+              << "* --probe-semiangle-series (-sas) v1,v2,... : list of probe semiangles (in mrad) to simulate in one run (default: none)\n"
+              << "* --probe-xtilt-series (-txs) v1,v2,... : list of probe X tilts (in mrad) to simulate in one run (default: none)\n"
+              << "* --probe-ytilt-series (-tys) v1,v2,... : list of probe Y tilts (in mrad) to simulate in one run (default: none)\n"
+              << "* --energy-series (-Es) v1,v2,... : list of electron energies (in keV) to simulate, each written to its own output file with an _energyNNNN suffix. The potential of each frozen phonon configuration is computed once and reused for every energy (default: none)\n"
               << "* --scan-window-x (-wx) min max : size of the window to scan the probe in X (in fractional coordinates between 0 and 1) (default: " << defaults.scanWindowXMin << " " << defaults.scanWindowXMax << ")\n"
               << "* --scan-window-y (-wy) min max : size of the window to scan the probe in Y (in fractional coordinates between 0 and 1) (default: " << defaults.scanWindowYMin << " " << defaults.scanWindowYMax << ")\n"
               << "* --scan-window-xr (-wxr) min max : size of the window to scan the probe in X (in Angstroms) (defaults to fractional coordinates) "
@@ -92,10 +99,32 @@ void printHelp()
               << "* --save-4D-output (-4D) bool=false : Also save the 4D output at the detector for each probe (4D output mode) (default: Off)\n"
               << "* --4D-crop (-4DC) bool=false : Crop the 4D output smaller than the anti-aliasing boundary (default: Off)\n"
               << "* --4D-amax (-4DA) value: If --4D-crop, the maximum angle to which the output is cropped (in mrad) (default: 100)\n"
+              << "* --4D-bin (-4Db) N: sums N x N blocks of pixels of each (cropped) pattern of the 4D output. Pixels beyond the last full block are dropped (default: 1)\n"
+              << "* --4D-fp-accumulation (-4Dfp) a/m/f/d: where the 4D output of the frozen phonon configurations is summed before it is written, either (a)uto, in (m)emory, in a memory-mapped scratch (f)ile, or in the output file on (d)isk, which reads it back and rewrites it for every configuration. Auto uses memory for up to half of the RAM and scratch files beyond (default: auto)\n"
+              << "* --4D-chunk (-4Dch) nx ny: number of scan positions in x and y stored together in one HDF5 chunk of the 4D output (default: 1 1)\n"
+              << "* --4D-format (-4Dfmt) h5/zarr/npy: writes the 4D output into the HDF5 file, or into an uncompressed Zarr directory store next to it (output file name + .zarr) with one file per chunk, which the compute threads write in parallel. prismatic-convert-store copies the store into the HDF5 file. npy writes each datacube to a memory-mapped .npy file next to the output, with the axes (rx, ry, qy, qx) (default: h5)\n"
+              << "* --4D-compression (-4Dz) n/d/l/b: compression of the 4D output chunks, either (n)one, shuffle and (d)eflate, shuffle and (l)z4, or (b)itshuffle with LZ4. LZ4 and bitshuffle need the HDF5 filter plugins and fall back to deflate without them (default: none)\n"
+              << "* --4D-compression-level (-4Dzl) level: deflate compression level from 1 to 9 (default: 4)\n"
+              << "* --4D-type (-4Dt) f/f16/u16/u8: element type of the 4D output, either (f)ull precision, float16, or quantized to uint16 or uint8 with a scale and offset (default: f)\n"
+              << "* --4D-scale (-4Ds) value: intensity per stored unit of the float16/uint16/uint8 4D output, saved as attributes of the datacube. 0 picks a scale and offset for each frame from its range and saves them in the frame_scale and frame_offset datasets (default: 0)\n"
+              << "* --4D-mask-annuli (-4Dma) inner1,outer1,inner2,outer2,...: stores only the 4D output pixels within these annuli (in mrad), together with a sparse index of the stored pixels (default: full frames)\n"
+              << "* --4D-mask-file (-4Dmf) filename: text file with one row of values per qx pixel of the 4D output, the pixels with nonzero values are stored together with a sparse index. Combined with --4D-mask-annuli, pixels selected by either are stored (default: none)\n"
+              << "* --4D-queue (-4Dq) MB: memory for 4D frames waiting to be written by the asynchronous writer thread, 0 writes synchronously from the compute threads (default: 256)\n"
+              << "* --swmr-interval (-swmr) seconds: keeps the output file open in HDF5 SWMR mode during the run and refreshes the partial 2D, 3D and DPC images, the 4D output written so far and the progress dataset of the file at this interval, so that it can be read while the simulation runs. 0 writes the output when the run ends (default: 0)\n"
               << "* --save-DPC-CoM (-DPC) bool=false : Also save the DPC Center of Mass calculation (default: Off)\n"
               << "* --save-real-space-coords (-rsc) bool=false : Also save the real space coordinates of the probe dimensions (default: Off)\n"
               << "* --save-potential-slices (-ps) bool=false : Also save the calculated potential slices (default: Off)\n"
-              << "* --nyquist-sampling (-nqs) bool=false : Set number of probe positions at Nyquist sampling limit (default: Off)]\n";
+              << "* --nyquist-sampling (-nqs) bool=false : Set number of probe positions at Nyquist sampling limit (default: Off)]\n"
+              << "* --fftw-planning (-fpm) m/p/e : rigor of the FFTW planner used for the worker FFT plans, either (m)easure, (p)atient, or (e)xhaustive. Wisdom from a slower mode is reused by later runs in faster modes (default: measure)\n"
+              << "* --fftw-wisdom (-fw) bool=true : import and export FFTW wisdom so that plans are measured only once per machine (default: On)\n"
+              << "* --fftw-wisdom-file (-fwf) filename : FFTW wisdom cache file (default: per-user cache directory, keyed by FFTW version, precision, and CPU model)\n"
+              << "* --numa-policy (-numa) d/f/i : placement of the potential, transmission, and S-matrix pages on multi-socket machines, either (d)efault, parallel (f)irst-touch, or (i)nterleaved (default: default)\n"
+              << "* --thread-affinity (-ta) n/c/s : pin CPU worker threads to cores, either (n)one, (c)ompact, or (s)catter across sockets (default: none)\n"
+              << "* --huge-pages (-hp) bool=false : request transparent huge pages for the large arrays (default: Off)\n"
+              << "* --scompact-precision (-sp) full/fp16/bf16/int16 : storage format of the compact S-matrix in PRISM, 16-bit formats halve its memory. CPU only (default: full)\n"
+              << "* --scompact-file (-sf) filename : keep the compact S-matrix in a memory-mapped scratch file instead of RAM, for cells whose S-matrix does not fit in memory. CPU only (default: in memory)\n"
+              << "* --save-smatrix (-ss) filename : save the compact S-matrix of every frozen phonon configuration to an HDF5 file for reuse by later PRISM runs (default: not saved)\n"
+              << "* --load-smatrix (-ls) filename : load a compact S-matrix saved by --save-smatrix instead of computing the potential and S-matrix. The cell, energy, pixel size, interpolation factors, and beam cutoff must match the saved run (default: computed)\n";
 }
 
 // string white-space trimming utility functions courtesy of https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring
@@ -167,6 +196,18 @@ bool validateFilename(const std::string str)
     return f.good();
 }
 
+// writes a probe setting series as a comma separated list, converting from internal units by factor
+static void writeValueList(std::ofstream &f, const std::string &option,
+                           const std::vector<PRISMATIC_FLOAT_PRECISION> &values, const PRISMATIC_FLOAT_PRECISION factor)
+{
+    if (values.empty())
+        return;
+    f << option << ':';
+    for (auto j = 0; j < values.size(); ++j)
+        f << (j == 0 ? "" : ",") << values[j] * factor;
+    f << '\n';
+}
+
 bool writeParamFile(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
                     const std::string param_filename)
 {
@@ -225,12 +266,88 @@ bool writeParamFile(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     //between the two.
     f << "--probe-xtilt:" << meta.probeXtilt * 1000 << '\n';
     f << "--probe-ytilt:" << meta.probeYtilt * 1000 << '\n';
+    writeValueList(f, "--probe-defocus-series", meta.probeDefocusSeries, 1);
+    writeValueList(f, "--C3-series", meta.C3Series, 1);
+    writeValueList(f, "--C5-series", meta.C5Series, 1);
+    writeValueList(f, "--probe-semiangle-series", meta.probeSemiangleSeries, 1000);
+    writeValueList(f, "--probe-xtilt-series", meta.probeXtiltSeries, 1000);
+    writeValueList(f, "--probe-ytilt-series", meta.probeYtiltSeries, 1000);
+    writeValueList(f, "--energy-series", meta.energySeries, (PRISMATIC_FLOAT_PRECISION)0.001);
     f << "--scan-window-x:" << meta.scanWindowXMin << ' ' << meta.scanWindowXMax << '\n';
     f << "--scan-window-y:" << meta.scanWindowYMin << ' ' << meta.scanWindowYMax << '\n';
     f << "--scan-window-xr:" << meta.scanWindowXMin_r << ' ' << meta.scanWindowXMax_r << '\n';
     f << "--scan-window-yr:" << meta.scanWindowYMin_r << ' ' << meta.scanWindowYMax_r << '\n';
     f << "--random-seed:" << meta.randomSeed << '\n';
     f << "--4D-amax:" << meta.crop4Damax << '\n';
+    f << "--4D-bin:" << meta.bin4D << '\n';
+    f << "--4D-queue:" << meta.writerQueueMB << '\n';
+    if (meta.fpAccumulation4D == FPAccumulation::Memory)
+    {
+        f << "--4D-fp-accumulation:m\n";
+    }
+    else if (meta.fpAccumulation4D == FPAccumulation::File)
+    {
+        f << "--4D-fp-accumulation:f\n";
+    }
+    else if (meta.fpAccumulation4D == FPAccumulation::Disk)
+    {
+        f << "--4D-fp-accumulation:d\n";
+    }
+    else
+    {
+        f << "--4D-fp-accumulation:a\n";
+    }
+    if (meta.format4D == Format4D::Zarr)
+    {
+        f << "--4D-format:zarr\n";
+    }
+    else if (meta.format4D == Format4D::Npy)
+    {
+        f << "--4D-format:npy\n";
+    }
+    else
+    {
+        f << "--4D-format:h5\n";
+    }
+    f << "--4D-chunk:" << meta.chunk4DX << ' ' << meta.chunk4DY << '\n';
+    if (meta.compression4D == Compression4D::Deflate)
+    {
+        f << "--4D-compression:d\n";
+    }
+    else if (meta.compression4D == Compression4D::LZ4)
+    {
+        f << "--4D-compression:l\n";
+    }
+    else if (meta.compression4D == Compression4D::Bitshuffle)
+    {
+        f << "--4D-compression:b\n";
+    }
+    else
+    {
+        f << "--4D-compression:n\n";
+    }
+    f << "--4D-compression-level:" << meta.compressionLevel4D << '\n';
+    if (meta.datacubeType == DatacubeType::Float16)
+    {
+        f << "--4D-type:f16\n";
+    }
+    else if (meta.datacubeType == DatacubeType::UInt16)
+    {
+        f << "--4D-type:u16\n";
+    }
+    else if (meta.datacubeType == DatacubeType::UInt8)
+    {
+        f << "--4D-type:u8\n";
+    }
+    else
+    {
+        f << "--4D-type:f\n";
+    }
+    f << "--4D-scale:" << meta.datacubeScale << '\n';
+    writeValueList(f, "--4D-mask-annuli", meta.maskAnnuli4D, 1000);
+    if (meta.filenameMask4D != "")
+        f << "--4D-mask-file:" << meta.filenameMask4D << '\n';
+    f << "--swmr-interval:" << meta.swmrInterval << '\n';
     if (meta.includeThermalEffects)
     {
         f << "--thermal-effects:1\n";
@@ -307,6 +424,82 @@ bool writeParamFile(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     {
         f << "--nyquist-sampling:0\n";
     }
+    if (meta.fftwPlanningMode == FFTWPlanningMode::Exhaustive)
+    {
+        f << "--fftw-planning:e\n";
+    }
+    else if (meta.fftwPlanningMode == FFTWPlanningMode::Patient)
+    {
+        f << "--fftw-planning:p\n";
+    }
+    else
+    {
+        f << "--fftw-planning:m\n";
+    }
+    if (meta.useFFTWWisdom)
+    {
+        f << "--fftw-wisdom:1\n";
+    }
+    else
+    {
+        f << "--fftw-wisdom:0\n";
+    }
+    if (meta.fftwWisdomFile != "")
+        f << "--fftw-wisdom-file:" << meta.fftwWisdomFile << '\n';
+    if (meta.numaPolicy == NUMAPolicy::Interleave)
+    {
+        f << "--numa-policy:i\n";
+    }
+    else if (meta.numaPolicy == NUMAPolicy::FirstTouch)
+    {
+        f << "--numa-policy:f\n";
+    }
+    else
+    {
+        f << "--numa-policy:d\n";
+    }
+    if (meta.affinityPolicy == AffinityPolicy::Scatter)
+    {
+        f << "--thread-affinity:s\n";
+    }
+    else if (meta.affinityPolicy == AffinityPolicy::Compact)
+    {
+        f << "--thread-affinity:c\n";
+    }
+    else
+    {
+        f << "--thread-affinity:n\n";
+    }
+    if (meta.useHugePages)
+    {
+        f << "--huge-pages:1\n";
+    }
+    else
+    {
+        f << "--huge-pages:0\n";
+    }
+    if (meta.scompactPrecision == ScompactPrecision::Float16)
+    {
+        f << "--scompact-precision:fp16\n";
+    }
+    else if (meta.scompactPrecision == ScompactPrecision::BFloat16)
+    {
+        f << "--scompact-precision:bf16\n";
+    }
+    else if (meta.scompactPrecision == ScompactPrecision::Int16)
+    {
+        f << "--scompact-precision:int16\n";
+    }
+    else
+    {
+        f << "--scompact-precision:full\n";
+    }
+    if (meta.filenameScompact != "")
+        f << "--scompact-file:" << meta.filenameScompact << '\n';
+    if (meta.filenameSaveSMatrix != "")
+        f << "--save-smatrix:" << meta.filenameSaveSMatrix << '\n';
+    if (meta.filenameLoadSMatrix != "")
+        f << "--load-smatrix:" << meta.filenameLoadSMatrix << '\n';
 
 #ifdef PRISMATIC_ENABLE_GPU
     if (meta.alsoDoCPUWork)
@@ -1089,6 +1282,90 @@ bool parse_sa(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+// parses a comma separated list of numbers, converting them to internal units by dividing by factor
+static bool parseValueList(const std::string &list, std::vector<PRISMATIC_FLOAT_PRECISION> &values,
+                           const PRISMATIC_FLOAT_PRECISION factor)
+{
+    values.clear();
+    std::stringstream ss(list);
+    std::string token;
+    while (std::getline(ss, token, ','))
+    {
+        char *end;
+        const double value = strtod(token.c_str(), &end);
+        if (token.empty() | (*end != '\0'))
+            return false;
+        values.push_back((PRISMATIC_FLOAT_PRECISION)value / factor);
+    }
+    return !values.empty();
+}
+
+static bool parse_series(std::vector<PRISMATIC_FLOAT_PRECISION> &values, const PRISMATIC_FLOAT_PRECISION factor,
+                         const std::string &flag, const std::string &units, int &argc, const char ***argv)
+{
+    if ((argc < 2) || !parseValueList(std::string((*argv)[1]), values, factor))
+    {
+        cout << "Invalid list provided for " << flag << " (syntax is " << flag << " value1,value2,... (in " << units << "))\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+}
+
+bool parse_dfs(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    return parse_series(meta.probeDefocusSeries, 1, "-dfs", "Angstroms", argc, argv);
+};
+
+bool parse_C3s(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    return parse_series(meta.C3Series, 1, "-C3s", "Angstroms", argc, argv);
+};
+
+bool parse_C5s(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    return parse_series(meta.C5Series, 1, "-C5s", "Angstroms", argc, argv);
+};
+
+bool parse_sas(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    return parse_series(meta.probeSemiangleSeries, 1000, "-sas", "mrad", argc, argv);
+};
+
+bool parse_txs(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    return parse_series(meta.probeXtiltSeries, 1000, "-txs", "mrad", argc, argv);
+};
+
+bool parse_tys(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    return parse_series(meta.probeYtiltSeries, 1000, "-tys", "mrad", argc, argv);
+};
+
+bool parse_Es(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (!parse_series(meta.energySeries, 1, "-Es", "keV", argc, argv))
+        return false;
+    for (auto &E : meta.energySeries)
+    {
+        if (E <= 0)
+        {
+            cout << "Invalid energy " << E << " provided for -Es (syntax is -Es value1,value2,... (in keV))\n";
+            return false;
+        }
+        E *= 1000; // same conversion as -E
+    }
+    return true;
+};
+
 bool parse_wx(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
               int &argc, const char ***argv)
 {
@@ -1344,6 +1621,296 @@ bool parse_4DA(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_4Db(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No bin size provided for -4Db (syntax is -4Db N)\n";
+        return false;
+    }
+    const int bin = atoi((*argv)[1]);
+    if (bin < 1)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -4Db (syntax is -4Db N)\n";
+        return false;
+    }
+    meta.bin4D = bin;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dq(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No queue size provided for -4Dq (syntax is -4Dq MB)\n";
+        return false;
+    }
+    if (((meta.writerQueueMB = atoi((*argv)[1])) == 0) & (std::string((*argv)[1]) != "0"))
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -4Dq (syntax is -4Dq MB)\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dfp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No mode provided for -4Dfp (syntax is -4Dfp mode). Choices are (a)uto, (m)emory, (f)ile, or (d)isk\n";
+        return false;
+    }
+    std::string mode = std::string((*argv)[1]);
+    if (mode == "a" | mode == "auto")
+    {
+        meta.fpAccumulation4D = Prismatic::FPAccumulation::Auto;
+    }
+    else if (mode == "m" | mode == "memory")
+    {
+        meta.fpAccumulation4D = Prismatic::FPAccumulation::Memory;
+    }
+    else if (mode == "f" | mode == "file")
+    {
+        meta.fpAccumulation4D = Prismatic::FPAccumulation::File;
+    }
+    else if (mode == "d" | mode == "disk")
+    {
+        meta.fpAccumulation4D = Prismatic::FPAccumulation::Disk;
+    }
+    else
+    {
+        cout << "Unrecognized 4D accumulation mode \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dch(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (argc < 3)
+    {
+        cout << "Chunk size not provided for -4Dch (syntax is -4Dch nx ny)\n";
+        return false;
+    }
+    if (((meta.chunk4DX = atoi((*argv)[1])) == 0) | ((meta.chunk4DY = atoi((*argv)[2])) == 0))
+    {
+        cout << "Invalid value \"" << (*argv)[1] << " " << (*argv)[2] << "\" provided for -4Dch (syntax is -4Dch nx ny)\n";
+        return false;
+    }
+    argc -= 3;
+    argv[0] += 3;
+    return true;
+};
+
+bool parse_4Dfmt(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                 int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No format provided for -4Dfmt (syntax is -4Dfmt format). Choices are h5, zarr or npy\n";
+        return false;
+    }
+    std::string format = std::string((*argv)[1]);
+    if (format == "h5" | format == "hdf5")
+    {
+        meta.format4D = Prismatic::Format4D::HDF5;
+    }
+    else if (format == "zarr")
+    {
+        meta.format4D = Prismatic::Format4D::Zarr;
+    }
+    else if (format == "npy")
+    {
+        meta.format4D = Prismatic::Format4D::Npy;
+    }
+    else
+    {
+        cout << "Unrecognized 4D output format \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dz(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No compression provided for -4Dz (syntax is -4Dz compression). Choices are (n)one, (d)eflate, (l)z4, or (b)itshuffle\n";
+        return false;
+    }
+    std::string compression = std::string((*argv)[1]);
+    if (compression == "n" | compression == "none")
+    {
+        meta.compression4D = Prismatic::Compression4D::None;
+    }
+    else if (compression == "d" | compression == "deflate")
+    {
+        meta.compression4D = Prismatic::Compression4D::Deflate;
+    }
+    else if (compression == "l" | compression == "lz4")
+    {
+        meta.compression4D = Prismatic::Compression4D::LZ4;
+    }
+    else if (compression == "b" | compression == "bitshuffle")
+    {
+        meta.compression4D = Prismatic::Compression4D::Bitshuffle;
+    }
+    else
+    {
+        cout << "Unrecognized 4D compression \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dzl(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No level provided for -4Dzl (syntax is -4Dzl level)\n";
+        return false;
+    }
+    meta.compressionLevel4D = atoi((*argv)[1]);
+    if ((meta.compressionLevel4D < 1) | (meta.compressionLevel4D > 9))
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -4Dzl, the level must be between 1 and 9\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dt(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No type provided for -4Dt (syntax is -4Dt type). Choices are f, f16, u16, or u8\n";
+        return false;
+    }
+    std::string type = std::string((*argv)[1]);
+    if (type == "f" | type == "float")
+    {
+        meta.datacubeType = Prismatic::DatacubeType::Float;
+    }
+    else if (type == "f16" | type == "float16")
+    {
+        meta.datacubeType = Prismatic::DatacubeType::Float16;
+    }
+    else if (type == "u16" | type == "uint16")
+    {
+        meta.datacubeType = Prismatic::DatacubeType::UInt16;
+    }
+    else if (type == "u8" | type == "uint8")
+    {
+        meta.datacubeType = Prismatic::DatacubeType::UInt8;
+    }
+    else
+    {
+        cout << "Unrecognized 4D output type \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Ds(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No scale provided for -4Ds (syntax is -4Ds scale)\n";
+        return false;
+    }
+    meta.datacubeScale = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[1]);
+    if ((meta.datacubeScale < 0) | ((meta.datacubeScale == 0) & (std::string((*argv)[1]) != "0")))
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -4Ds (syntax is -4Ds scale)\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4Dma(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (!parse_series(meta.maskAnnuli4D, 1000, "-4Dma", "mrad", argc, argv))
+        return false;
+    if (meta.maskAnnuli4D.size() % 2 != 0)
+    {
+        cout << "Odd number of angles provided for -4Dma (syntax is -4Dma inner1,outer1,inner2,outer2,... (in mrad))\n";
+        return false;
+    }
+    for (auto a = 0; a < meta.maskAnnuli4D.size(); a += 2)
+    {
+        if ((meta.maskAnnuli4D[a] < 0) | (meta.maskAnnuli4D[a] >= meta.maskAnnuli4D[a + 1]))
+        {
+            cout << "Invalid annulus " << meta.maskAnnuli4D[a] * 1000 << " to " << meta.maskAnnuli4D[a + 1] * 1000 << " mrad provided for -4Dma\n";
+            return false;
+        }
+    }
+    return true;
+};
+
+bool parse_4Dmf(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filename provided for -4Dmf (syntax is -4Dmf filename)\n";
+        return false;
+    }
+    if (!validateFilename(std::string((*argv)[1])))
+    {
+        cout << "Unable to open the 4D mask file " << (*argv)[1] << '\n';
+        return false;
+    }
+    meta.filenameMask4D = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_swmr(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No interval provided for -swmr (syntax is -swmr seconds)\n";
+        return false;
+    }
+    const int interval = atoi((*argv)[1]);
+    if ((interval < 0) | ((interval == 0) & (std::string((*argv)[1]) != "0")))
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -swmr (syntax is -swmr seconds)\n";
+        return false;
+    }
+    meta.swmrInterval = interval;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_dpc(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
                int &argc, const char ***argv)
 {
@@ -1400,6 +1967,218 @@ bool parse_ps(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_fpm(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No planning mode provided for -fpm (syntax is -fpm mode). Choices are (m)easure, (p)atient, or (e)xhaustive\n";
+        return false;
+    }
+    std::string mode = std::string((*argv)[1]);
+    if (mode == "m" | mode == "measure")
+    {
+        meta.fftwPlanningMode = Prismatic::FFTWPlanningMode::Measure;
+    }
+    else if (mode == "p" | mode == "patient")
+    {
+        meta.fftwPlanningMode = Prismatic::FFTWPlanningMode::Patient;
+    }
+    else if (mode == "e" | mode == "exhaustive")
+    {
+        meta.fftwPlanningMode = Prismatic::FFTWPlanningMode::Exhaustive;
+    }
+    else
+    {
+        cout << "Unrecognized FFTW planning mode \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_fw(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -fw (syntax is -fw bool)\n";
+        return false;
+    }
+    meta.useFFTWWisdom = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_fwf(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filename provided for -fwf (syntax is -fwf filename)\n";
+        return false;
+    }
+    meta.fftwWisdomFile = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_numa(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+                int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No policy provided for -numa (syntax is -numa policy). Choices are (d)efault, (f)irst-touch, or (i)nterleave\n";
+        return false;
+    }
+    std::string policy = std::string((*argv)[1]);
+    if (policy == "d" | policy == "default")
+    {
+        meta.numaPolicy = Prismatic::NUMAPolicy::Default;
+    }
+    else if (policy == "f" | policy == "first-touch")
+    {
+        meta.numaPolicy = Prismatic::NUMAPolicy::FirstTouch;
+    }
+    else if (policy == "i" | policy == "interleave")
+    {
+        meta.numaPolicy = Prismatic::NUMAPolicy::Interleave;
+    }
+    else
+    {
+        cout << "Unrecognized NUMA policy \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_ta(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No policy provided for -ta (syntax is -ta policy). Choices are (n)one, (c)ompact, or (s)catter\n";
+        return false;
+    }
+    std::string policy = std::string((*argv)[1]);
+    if (policy == "n" | policy == "none")
+    {
+        meta.affinityPolicy = Prismatic::AffinityPolicy::None;
+    }
+    else if (policy == "c" | policy == "compact")
+    {
+        meta.affinityPolicy = Prismatic::AffinityPolicy::Compact;
+    }
+    else if (policy == "s" | policy == "scatter")
+    {
+        meta.affinityPolicy = Prismatic::AffinityPolicy::Scatter;
+    }
+    else
+    {
+        cout << "Unrecognized thread affinity policy \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_hp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -hp (syntax is -hp bool)\n";
+        return false;
+    }
+    meta.useHugePages = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_sp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No format provided for -sp (syntax is -sp format). Choices are full, fp16, bf16, or int16\n";
+        return false;
+    }
+    std::string format = std::string((*argv)[1]);
+    if (format == "full")
+    {
+        meta.scompactPrecision = Prismatic::ScompactPrecision::Full;
+    }
+    else if (format == "fp16")
+    {
+        meta.scompactPrecision = Prismatic::ScompactPrecision::Float16;
+    }
+    else if (format == "bf16")
+    {
+        meta.scompactPrecision = Prismatic::ScompactPrecision::BFloat16;
+    }
+    else if (format == "int16")
+    {
+        meta.scompactPrecision = Prismatic::ScompactPrecision::Int16;
+    }
+    else
+    {
+        cout << "Unrecognized S-matrix precision \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_sf(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filename provided for -sf (syntax is -sf filename)\n";
+        return false;
+    }
+    meta.filenameScompact = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_ss(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filename provided for -ss (syntax is -ss filename)\n";
+        return false;
+    }
+    meta.filenameSaveSMatrix = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_ls(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filename provided for -ls (syntax is -ls filename)\n";
+        return false;
+    }
+    meta.filenameLoadSMatrix = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parseInputs(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
                  int &argc, const char ***argv)
 {
@@ -1455,6 +2234,13 @@ static std::map<std::string, parseFunction> parser{
     {"--probe-ytilt", parse_ty}, {"-ty", parse_ty},
     {"--probe-defocus", parse_df}, {"-df", parse_df},
     {"-C3", parse_C3}, {"-C5", parse_C5},
+    {"--probe-defocus-series", parse_dfs}, {"-dfs", parse_dfs},
+    {"--C3-series", parse_C3s}, {"-C3s", parse_C3s},
+    {"--C5-series", parse_C5s}, {"-C5s", parse_C5s},
+    {"--probe-semiangle-series", parse_sas}, {"-sas", parse_sas},
+    {"--probe-xtilt-series", parse_txs}, {"-txs", parse_txs},
+    {"--probe-ytilt-series", parse_tys}, {"-tys", parse_tys},
+    {"--energy-series", parse_Es}, {"-Es", parse_Es},
     {"--probe-semiangle", parse_sa}, {"-sa", parse_sa},
     {"--scan-window-y", parse_wy}, {"-wy", parse_wy},
     {"--scan-window-x", parse_wx}, {"-wx", parse_wx},
@@ -1469,10 +2255,32 @@ static std::map<std::string, parseFunction> parser{
     {"--save-4D-output", parse_4D}, {"-4D", parse_4D},
     {"--4D-crop", parse_4DC}, {"-4DC", parse_4DC},
     {"--4D-amax", parse_4DA}, {"-4DA", parse_4DA},
+    {"--4D-bin", parse_4Db}, {"-4Db", parse_4Db},
+    {"--4D-queue", parse_4Dq}, {"-4Dq", parse_4Dq},
+    {"--4D-fp-accumulation", parse_4Dfp}, {"-4Dfp", parse_4Dfp},
+    {"--4D-chunk", parse_4Dch}, {"-4Dch", parse_4Dch},
+    {"--4D-format", parse_4Dfmt}, {"-4Dfmt", parse_4Dfmt},
+    {"--4D-compression", parse_4Dz}, {"-4Dz", parse_4Dz},
+    {"--4D-compression-level", parse_4Dzl}, {"-4Dzl", parse_4Dzl},
+    {"--4D-type", parse_4Dt}, {"-4Dt", parse_4Dt},
+    {"--4D-scale", parse_4Ds}, {"-4Ds", parse_4Ds},
+    {"--4D-mask-annuli", parse_4Dma}, {"-4Dma", parse_4Dma},
+    {"--4D-mask-file", parse_4Dmf}, {"-4Dmf", parse_4Dmf},
+    {"--swmr-interval", parse_swmr}, {"-swmr", parse_swmr},
     {"--save-DPC-CoM", parse_dpc}, {"-DPC", parse_dpc},
     {"--save-real-space-coords", parse_rsc}, {"-rsc", parse_rsc},
     {"--save-potential-slices", parse_ps}, {"-ps", parse_ps},
-    {"--nyquist-sampling", parse_nqs}, {"-nqs", parse_nqs}};
+    {"--nyquist-sampling", parse_nqs}, {"-nqs", parse_nqs},
+    {"--fftw-planning", parse_fpm}, {"-fpm", parse_fpm},
+    {"--fftw-wisdom", parse_fw}, {"-fw", parse_fw},
+    {"--fftw-wisdom-file", parse_fwf}, {"-fwf", parse_fwf},
+    {"--numa-policy", parse_numa}, {"-numa", parse_numa},
+    {"--thread-affinity", parse_ta}, {"-ta", parse_ta},
+    {"--huge-pages", parse_hp}, {"-hp", parse_hp},
+    {"--scompact-precision", parse_sp}, {"-sp", parse_sp},
+    {"--scompact-file", parse_sf}, {"-sf", parse_sf},
+    {"--save-smatrix", parse_ss}, {"-ss", parse_ss},
+    {"--load-smatrix", parse_ls}, {"-ls", parse_ls}};
 bool parseInput(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
                 int &argc, const char ***argv)
 {
@@ -78,36 +78,36 @@ Array2D<PRISMATIC_FLOAT_PRECISION> projPot(const size_t &Z,
 	}
 	ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> sub(sub_data, {{sub_data.size()}});
 
-	std::pair<Array2D<PRISMATIC_FLOAT_PRECISION>, Array2D<PRISMATIC_FLOAT_PRECISION>> meshx = meshgrid(xr, sub * dx);
-	std::pair<Array2D<PRISMATIC_FLOAT_PRECISION>, Array2D<PRISMATIC_FLOAT_PRECISION>> meshy = meshgrid(yr, sub * dy);
-
-	ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> xv = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{meshx.first.size()}});
-	ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> yv = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{meshy.first.size()}});
+	// supersampled coordinates, xv = xr + sub * dx over all pairs -- computed directly rather than
+	// through meshgrid(xr, sub * dx), which would build three temporaries per axis
+	ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> xv = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{xr.size() * sub.size()}});
+	ArrayND<1, std::vector<PRISMATIC_FLOAT_PRECISION>> yv = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{yr.size() * sub.size()}});
 	{
 		auto t_x = xv.begin();
-		for (auto j = 0; j < meshx.first.get_dimj(); ++j)
+		for (auto j = 0; j < xr.size(); ++j)
 		{
-			for (auto i = 0; i < meshx.first.get_dimi(); ++i)
+			for (auto i = 0; i < sub.size(); ++i)
 			{
-				*t_x++ = meshx.first.at(j, i) + meshx.second.at(j, i);
+				const PRISMATIC_FLOAT_PRECISION offset = sub[i] * dx;
+				*t_x++ = xr[j] + offset;
 			}
 		}
 	}
 
 	{
 		auto t_y = yv.begin();
-		for (auto j = 0; j < meshy.first.get_dimj(); ++j)
+		for (auto j = 0; j < yr.size(); ++j)
 		{
-			for (auto i = 0; i < meshy.first.get_dimi(); ++i)
+			for (auto i = 0; i < sub.size(); ++i)
 			{
-				*t_y++ = meshy.first.at(j, i) + meshy.second.at(j, i);
+				const PRISMATIC_FLOAT_PRECISION offset = sub[i] * dy;
+				*t_y++ = yr[j] + offset;
 			}
 		}
 	}
 
 	std::pair<Array2D<PRISMATIC_FLOAT_PRECISION>, Array2D<PRISMATIC_FLOAT_PRECISION>> meshxy = meshgrid(yv, xv);
 	ArrayND<2, std::vector<PRISMATIC_FLOAT_PRECISION>> r2 = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{yv.size(), xv.size()}});
-	ArrayND<2, std::vector<PRISMATIC_FLOAT_PRECISION>> r = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{yv.size(), xv.size()}});
 
 	{
 		auto t_y = r2.begin();
@@ -120,10 +120,7 @@ Array2D<PRISMATIC_FLOAT_PRECISION> projPot(const size_t &Z,
 		}
 	}
 
-	for (auto i = 0; i < r.size(); ++i)
-		r[i] = sqrt(r2[i]);
 	// construct potential
-	ArrayND<2, std::vector<PRISMATIC_FLOAT_PRECISION>> potSS = ones_ND<2, PRISMATIC_FLOAT_PRECISION>({{r2.get_dimj(), r2.get_dimi()}});
 
 	// get the relevant table values
 	std::vector<PRISMATIC_FLOAT_PRECISION> ap;
@@ -135,16 +132,17 @@ Array2D<PRISMATIC_FLOAT_PRECISION> projPot(const size_t &Z,
 
 	// compute the potential
 	using namespace boost::math;
-	std::transform(r.begin(), r.end(),
-				   r2.begin(), potSS.begin(), [&ap, &term1, &term2](const PRISMATIC_FLOAT_PRECISION &r_t, const PRISMATIC_FLOAT_PRECISION &r2_t) {
-					   return term1 * (ap[0] *
-										   cyl_bessel_k(0, 2 * pi * sqrt(ap[1]) * r_t) +
-									   ap[2] * cyl_bessel_k(0, 2 * pi * sqrt(ap[3]) * r_t) +
-									   ap[4] * cyl_bessel_k(0, 2 * pi * sqrt(ap[5]) * r_t)) +
-							  term2 * (ap[6] / ap[7] * exp(-pow(pi, 2) / ap[7] * r2_t) +
-									   ap[8] / ap[9] * exp(-pow(pi, 2) / ap[9] * r2_t) +
-									   ap[10] / ap[11] * exp(-pow(pi, 2) / ap[11] * r2_t));
-				   });
+	// r = sqrt(r2) is evaluated inside of the same pass rather than stored as another array
+	ArrayND<2, std::vector<PRISMATIC_FLOAT_PRECISION>> potSS = r2.transform_fused([&ap, &term1, &term2](const PRISMATIC_FLOAT_PRECISION &r2_t) {
+		const PRISMATIC_FLOAT_PRECISION r_t = sqrt(r2_t);
+		return term1 * (ap[0] *
+							cyl_bessel_k(0, 2 * pi * sqrt(ap[1]) * r_t) +
+						ap[2] * cyl_bessel_k(0, 2 * pi * sqrt(ap[3]) * r_t) +
+						ap[4] * cyl_bessel_k(0, 2 * pi * sqrt(ap[5]) * r_t)) +
+			   term2 * (ap[6] / ap[7] * exp(-pow(pi, 2) / ap[7] * r2_t) +
+						ap[8] / ap[9] * exp(-pow(pi, 2) / ap[9] * r2_t) +
+						ap[10] / ap[11] * exp(-pow(pi, 2) / ap[11] * r2_t));
+	});
 
 	// integrate
 	ArrayND<2, std::vector<PRISMATIC_FLOAT_PRECISION>> pot = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{yr.size(), xr.size()}});
@@ -17,15 +17,22 @@
 #include "configure.h"
 #include "H5Cpp.h"
 #include <string>
+#include <fstream>
+#include <functional>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #ifdef _WIN32
 #include <io.h>
+#include <direct.h>
+#include <process.h>
 #define access _access_s
 #else
 #include <unistd.h>
 #endif
 #include <mutex>
 #include <thread>
+#include <limits>
 
 namespace Prismatic
 {
@@ -117,12 +124,195 @@ PRISMATIC_FLOAT_PRECISION computeRfactor(Prismatic::Array2D<std::complex<PRISMAT
 	return diffs / accum;
 }
 
-int nyquistProbes(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, size_t dim)
+int nyquistProbes(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t dim)
 {
 	int nProbes = ceil(4 * (pars.meta.probeSemiangle / pars.lambda) * pars.tiledCellDim[dim]);
 	return nProbes;
 }
 
+size_t getCacheAlignedProbeBlock(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numProbes)
+{
+	// smallest number of consecutive probes whose entries in output (Ndet bins) and DPC_CoM (2 values)
+	// span whole cache lines. Both arrays are line aligned (see Array4D), so the blocks of the first
+	// layer never share a line between workers. The later layers of a probe condition series start
+	// wherever the previous layer ends, so their block edges are only line aligned when the layer size is
+	// a multiple of the line size
+	const size_t cacheLine = 64;
+	auto gcd = [](size_t a, size_t b) {
+		while (b != 0)
+		{
+			size_t tmp = a % b;
+			a = b;
+			b = tmp;
+		}
+		return a;
+	};
+	size_t block = cacheLine / gcd(cacheLine, pars.Ndet * sizeof(PRISMATIC_FLOAT_PRECISION));
+	if (pars.meta.saveDPC_CoM)
+	{
+		size_t blockDPC = cacheLine / gcd(cacheLine, 2 * sizeof(PRISMATIC_FLOAT_PRECISION));
+		block = block / gcd(block, blockDPC) * blockDPC;
+	}
+
+	// don't starve the workers on small scans
+	if (block * pars.meta.numThreads > numProbes)
+		block = 1;
+	return block;
+}
+
+unsigned int getFFTWPlanningFlag(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	switch (meta.fftwPlanningMode)
+	{
+	case FFTWPlanningMode::Exhaustive:
+		return FFTW_EXHAUSTIVE;
+	case FFTWPlanningMode::Patient:
+		return FFTW_PATIENT;
+	default:
+		return FFTW_MEASURE;
+	}
+}
+
+// wisdom is only valid for the FFTW build and processor it was measured on, so the cache
+// file name encodes the FFTW version, the floating point precision, and the CPU model
+static std::string getCPUModelString()
+{
+	std::string model = "unknown";
+#ifndef _WIN32
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line))
+	{
+		if (line.compare(0, 10, "model name") == 0)
+		{
+			size_t colon_pos = line.find(':');
+			if (colon_pos != std::string::npos)
+				model = line.substr(colon_pos + 1);
+			break;
+		}
+	}
+#else
+	char *identifier = getenv("PROCESSOR_IDENTIFIER");
+	if (identifier != NULL)
+		model = std::string(identifier);
+#endif //_WIN32
+	return model;
+}
+
+static std::string sanitizeFilenameToken(const std::string &token)
+{
+	std::string result;
+	for (auto &c : token)
+	{
+		result += (isalnum(c) | (c == '.') | (c == '-')) ? c : '_';
+	}
+	return result;
+}
+
+static void makeDirectory(const std::string &path)
+{
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif //_WIN32
+}
+
+std::string getFFTWWisdomFilename(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	if (meta.fftwWisdomFile != "")
+		return meta.fftwWisdomFile;
+
+	std::string cacheDir;
+#ifdef _WIN32
+	char *localappdata = getenv("LOCALAPPDATA");
+	if (localappdata == NULL)
+		return "";
+	cacheDir = std::string(localappdata) + "\\prismatic";
+	makeDirectory(cacheDir);
+	cacheDir += "\\";
+#else
+	char *xdg_cache = getenv("XDG_CACHE_HOME");
+	char *home = getenv("HOME");
+	if (xdg_cache != NULL && std::string(xdg_cache) != "")
+	{
+		cacheDir = std::string(xdg_cache);
+	}
+	else if (home != NULL)
+	{
+		cacheDir = std::string(home) + "/.cache";
+		makeDirectory(cacheDir);
+	}
+	else
+	{
+		return "";
+	}
+	cacheDir += "/prismatic";
+	makeDirectory(cacheDir);
+	cacheDir += "/";
+#endif //_WIN32
+
+	std::stringstream ss;
+	ss << cacheDir << "fftw_wisdom_" << sanitizeFilenameToken(std::string(PRISMATIC_FFTW_VERSION))
+	   << "_" << PRISMATIC_FFTW_PRECISION_STRING
+	   << "_" << std::hex << std::hash<std::string>()(getCPUModelString()) << ".dat";
+	return ss.str();
+}
+
+bool importFFTWWisdom(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	if (!meta.useFFTWWisdom)
+		return false;
+	std::string filename = getFFTWWisdomFilename(meta);
+	if ((filename == "") || (testExist(filename) != 0))
+		return false;
+
+	std::unique_lock<std::mutex> gatekeeper(fftw_plan_lock);
+	if (PRISMATIC_FFTW_IMPORT_WISDOM_FROM_FILENAME(filename.c_str()) == 0)
+	{
+		std::cout << "Unable to read FFTW wisdom from " << filename << ", plans will be measured from scratch" << std::endl;
+		return false;
+	}
+	std::cout << "Imported FFTW wisdom from " << filename << std::endl;
+	return true;
+}
+
+bool exportFFTWWisdom(const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	if (!meta.useFFTWWisdom)
+		return false;
+	std::string filename = getFFTWWisdomFilename(meta);
+	if (filename == "")
+		return false;
+
+	// many short jobs may share one cache file, so write to a private file first and
+	// move it into place to avoid another process importing a partially written file
+	std::stringstream tmp_name;
+#ifdef _WIN32
+	tmp_name << filename << "." << _getpid() << ".tmp";
+#else
+	tmp_name << filename << "." << getpid() << ".tmp";
+#endif //_WIN32
+
+	std::unique_lock<std::mutex> gatekeeper(fftw_plan_lock);
+	if (PRISMATIC_FFTW_EXPORT_WISDOM_TO_FILENAME(tmp_name.str().c_str()) == 0)
+	{
+		std::cout << "Unable to write FFTW wisdom to " << filename << std::endl;
+		return false;
+	}
+	gatekeeper.unlock();
+#ifdef _WIN32
+	remove(filename.c_str());
+#endif //_WIN32
+	if (rename(tmp_name.str().c_str(), filename.c_str()) != 0)
+	{
+		remove(tmp_name.str().c_str());
+		std::cout << "Unable to write FFTW wisdom to " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
 std::string remove_extension(const std::string &filename)
 {
 	size_t lastdot = filename.find_last_of(".");
@@ -177,10 +367,10 @@ int testExist(const std::string &filename)
 	return answer;
 }
 
-void setupOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars)
+void setupOutputFile(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	//create main groups
-	H5::Group simulation(pars.outputFile.createGroup("/4DSTEM_simulation"));
+	H5::Group simulation(pars.outputWriter->getFile().createGroup("/4DSTEM_simulation"));
 
 	//set version attributes
 	int maj_data = 0;
@@ -222,10 +412,92 @@ void setupOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars)
 	H5::Group comments(metadata_0.createGroup("comments"));
 }
 
+// HDF5 filters that are registered by dynamically loaded plugins
+#define PRISMATIC_H5Z_FILTER_LZ4 32004
+#define PRISMATIC_H5Z_FILTER_BITSHUFFLE 32008
+
+static void setDatacubeCreateProperties(H5::DSetCreatPropList &plist, const hsize_t *chunkDims, const Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> &meta, const bool verbose)
+{
+	plist.setChunk(4, chunkDims);
+
+	// chunks are only allocated when they are first written. No fill value is written either, the first
+	// frozen phonon pass writes every frame before any of them is read back
+	plist.setAllocTime(H5D_ALLOC_TIME_INCR);
+	plist.setFillTime(H5D_FILL_TIME_NEVER);
+
+	Prismatic::Compression4D compression = meta.compression4D;
+	if ((compression == Prismatic::Compression4D::LZ4) & (H5Zfilter_avail(PRISMATIC_H5Z_FILTER_LZ4) <= 0))
+	{
+		if (verbose)
+			std::cout << "The HDF5 LZ4 filter plugin is not available, compressing the 4D output with deflate instead" << std::endl;
+		compression = Prismatic::Compression4D::Deflate;
+	}
+	if ((compression == Prismatic::Compression4D::Bitshuffle) & (H5Zfilter_avail(PRISMATIC_H5Z_FILTER_BITSHUFFLE) <= 0))
+	{
+		if (verbose)
+			std::cout << "The HDF5 bitshuffle filter plugin is not available, compressing the 4D output with deflate instead" << std::endl;
+		compression = Prismatic::Compression4D::Deflate;
+	}
+
+	switch (compression)
+	{
+	case Prismatic::Compression4D::Deflate:
+		plist.setShuffle();
+		plist.setDeflate(meta.compressionLevel4D);
+		break;
+	case Prismatic::Compression4D::LZ4:
+		plist.setShuffle();
+		plist.setFilter(PRISMATIC_H5Z_FILTER_LZ4, H5Z_FLAG_OPTIONAL);
+		break;
+	case Prismatic::Compression4D::Bitshuffle:
+	{
+		// the first three values are filled in by the plugin, then automatic block size and LZ4 compression
+		const unsigned int values[5] = {0, 0, 0, 0, 2};
+		plist.setFilter(PRISMATIC_H5Z_FILTER_BITSHUFFLE, H5Z_FLAG_OPTIONAL, 5, values);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+template <class Store>
+static void createStoreArray(Store &store, const std::string &name, const hsize_t *dims)
+{
+	try
+	{
+		store.create(name, dims);
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cout << e.what() << "Terminating" << std::endl;
+		exit(1);
+	}
+}
+
+//coordinates of the columns and rows of the frames handed to writeDatacube4D, centred and binned like the frames
+//themselves, see get4DOutputFrame
+static void get4DOutputCoordinates(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+								   Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> &qx,
+								   Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> &qy)
+{
+	const bool multislice = pars.meta.algorithm == Prismatic::Algorithm::Multislice;
+	size_t qyInd_max, qxInd_max, ny, nx;
+	get4DOutputRegion(pars, multislice ? pars.imageSize[0] : pars.qy.get_dimi(), multislice ? pars.imageSize[1] : pars.qx.get_dimi(),
+					  qyInd_max, qxInd_max, ny, nx);
+	std::vector<PRISMATIC_FLOAT_PRECISION> qx_full(nx), qy_full(ny);
+	for (auto i = 0; i < nx; ++i)
+		qx_full[i] = ((long)i - (long)qxInd_max) * pars.qx.at(1);
+	for (auto j = 0; j < ny; ++j)
+		qy_full[j] = ((long)j - (long)qyInd_max) * pars.qy.at(1);
+	qx = binCoordinates(&qx_full[0], nx, pars.meta.bin4D);
+	qy = binCoordinates(&qy_full[0], ny, pars.meta.bin4D);
+}
+
 //use dummy variable to overload float/double dependence
-void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy)
+void setup4DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy)
 {
-	H5::Group datacubes = pars.outputFile.openGroup("4DSTEM_simulation/data/datacubes");
+	H5::Group datacubes = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/datacubes");
 
 	//shared properties
 	std::string base_name = "CBED_array_depth";
@@ -234,100 +506,31 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	data_dims[0] = {pars.xp.size()};
 	data_dims[1] = {pars.yp.size()};
 	hsize_t chunkDims[4];
-	chunkDims[0] = chunkDims[1] = {1};
+	chunkDims[0] = {std::max((size_t)1, std::min(pars.meta.chunk4DX, pars.xp.size()))};
+	chunkDims[1] = {std::max((size_t)1, std::min(pars.meta.chunk4DY, pars.yp.size()))};
 	hsize_t rx_dim[1] = {pars.xp.size()};
 	hsize_t ry_dim[1] = {pars.yp.size()};
 	hsize_t qx_dim[1];
 	hsize_t qy_dim[1];
 
+	//coordinates of the columns and rows of the stored frames
 	Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> qx;
 	Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> qy;
-	long offset_qx;
-	long offset_qy;
-
-    size_t qxInd_max = 0;
-    size_t qyInd_max = 0;
-
-    if(pars.meta.crop4DOutput)
-    {
-
-        PRISMATIC_FLOAT_PRECISION qMax = pars.meta.crop4Damax / pars.lambda;
-
-        for(auto i = 0; i < pars.qx.get_dimi(); i++)
-        {
-            if(pars.qx.at(i) < qMax)
-            {
-                qxInd_max++;
-            }
-            else
-            {
-                break;
-            }
-        }
-
-        for(auto j = 0; j < pars.qy.get_dimi(); j++)
-        {
-            if(pars.qy.at(j) < qMax)
-            {
-                qyInd_max++;
-            }
-            else
-            {
-                break;
-            }
-        }
-
-        qxInd_max *= 2;
-        qyInd_max *= 2;
-        //TODO: Figure out how to correctly sit the dimension offset for a cropped image
-        offset_qx = 0;
-        offset_qy = 0;
-    }
-    else
-    {
-        if (pars.meta.algorithm == Prismatic::Algorithm::Multislice)
-        {
-            qxInd_max = pars.psiProbeInit.get_dimi() / 2;
-            qyInd_max = pars.psiProbeInit.get_dimj() / 2;
-            offset_qx = pars.psiProbeInit.get_dimi() / 4;
-            offset_qy = pars.psiProbeInit.get_dimj() / 4;
-        }
-        else
-        {
-            qxInd_max = pars.qx.get_dimi();
-            qyInd_max = pars.qy.get_dimi();
-            offset_qx = 0;
-            offset_qy = 0;
-        }
-    }
+	get4DOutputCoordinates(pars, qx, qy);
+	qx_dim[0] = data_dims[2] = chunkDims[2] = {qx.get_dimi()};
+	qy_dim[0] = data_dims[3] = chunkDims[3] = {qy.get_dimi()};
 
-	if (pars.meta.algorithm == Prismatic::Algorithm::Multislice)
-	{
-		data_dims[2] = {qxInd_max};
-		data_dims[3] = {qyInd_max};
-		qx_dim[0] = {qxInd_max};
-		qy_dim[0] = {qyInd_max};
-		qx = fftshift(pars.qx);
-		qy = fftshift(pars.qy);
-		chunkDims[2] = {qxInd_max};
-		chunkDims[3] = {qyInd_max};
-	}
-	else
+	if (pars.datacubeMask)
 	{
-		data_dims[2] = {qxInd_max};
-		data_dims[3] = {qyInd_max};
-		qx_dim[0] = {qxInd_max};
-		qy_dim[0] = {qyInd_max};
-		qx = pars.qx;
-		qy = pars.qy;
-		chunkDims[2] = {qxInd_max};
-		chunkDims[3] = {qyInd_max};
+		//sparse output, each frame is one row of the masked pixels
+		data_dims[2] = chunkDims[2] = {1};
+		data_dims[3] = chunkDims[3] = {pars.datacubeMask->size()};
 	}
 
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group CBED_slice_n(datacubes.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -342,14 +545,29 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		int mgroup = 0;
 		metadata_group.write(H5::PredType::NATIVE_INT, &mgroup);
 
-		//setup data set chunking properties
+		//setup data set chunking and compression properties
 		H5::DSetCreatPropList plist;
-		plist.setChunk(4, chunkDims);
+		setDatacubeCreateProperties(plist, chunkDims, pars.meta, n == 0);
 
-		//create dataset
-		H5::DataSpace mspace(4, data_dims); //rank is 4
-		H5::DataSet CBED_data = CBED_slice_n.createDataSet("datacube", H5::PredType::NATIVE_FLOAT, mspace, plist);
-		mspace.close();
+		//create dataset, or its array in the directory store or the mapped npy file
+		if (pars.datacubeStore)
+		{
+			createStoreArray(*pars.datacubeStore, nth_name, data_dims);
+		}
+		else if (pars.datacubeMap)
+		{
+			createStoreArray(*pars.datacubeMap, nth_name, data_dims);
+		}
+		else
+		{
+			H5::DataSpace mspace(4, data_dims); //rank is 4
+			DatacubeEncoding encoding(pars.meta);
+			H5::DataSet CBED_data = CBED_slice_n.createDataSet("datacube", encoding.getFileType(), mspace, plist);
+			mspace.close();
+			encoding.setup(CBED_slice_n, CBED_data, data_dims);
+		}
+		if (pars.datacubeMask)
+			pars.datacubeMask->write(CBED_slice_n);
 
 		//write dimensions
 		H5::DataSpace str_name_ds(H5S_SCALAR);
@@ -370,10 +588,10 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim3_fspace = dim3.getSpace();
 		H5::DataSpace dim4_fspace = dim4.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
-		dim3.write(&qx[offset_qx], H5::PredType::NATIVE_FLOAT, dim3_mspace, dim3_fspace);
-		dim4.write(&qy[offset_qy], H5::PredType::NATIVE_FLOAT, dim4_mspace, dim4_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
+		dim3.write(&qx[0], H5::PredType::NATIVE_FLOAT, dim3_mspace, dim3_fspace);
+		dim4.write(&qy[0], H5::PredType::NATIVE_FLOAT, dim4_mspace, dim4_fspace);
 
 		//dimension attributes
 		const H5std_string dim1_name_str("R_x");
@@ -413,9 +631,9 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 };
 
 //use dummy variable to overload float/double dependence
-void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy)
+void setup4DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy)
 {
-	H5::Group datacubes = pars.outputFile.openGroup("4DSTEM_simulation/data/datacubes");
+	H5::Group datacubes = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/datacubes");
 
 	//shared properties
 	std::string base_name = "CBED_array_depth";
@@ -424,48 +642,30 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	data_dims[0] = {pars.xp.size()};
 	data_dims[1] = {pars.yp.size()};
 	hsize_t chunkDims[4];
-	chunkDims[0] = chunkDims[1] = {1};
+	chunkDims[0] = {std::max((size_t)1, std::min(pars.meta.chunk4DX, pars.xp.size()))};
+	chunkDims[1] = {std::max((size_t)1, std::min(pars.meta.chunk4DY, pars.yp.size()))};
 	hsize_t rx_dim[1] = {pars.xp.size()};
 	hsize_t ry_dim[1] = {pars.yp.size()};
 	hsize_t qx_dim[1];
 	hsize_t qy_dim[1];
+	//coordinates of the columns and rows of the stored frames
 	Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> qx;
 	Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> qy;
-	long offset_qx;
-	long offset_qy;
+	get4DOutputCoordinates(pars, qx, qy);
+	qx_dim[0] = data_dims[2] = chunkDims[2] = {qx.get_dimi()};
+	qy_dim[0] = data_dims[3] = chunkDims[3] = {qy.get_dimi()};
 
-	if (pars.meta.algorithm == Prismatic::Algorithm::Multislice)
+	if (pars.datacubeMask)
 	{
-		data_dims[2] = {pars.psiProbeInit.get_dimi() / 2};
-		data_dims[3] = {pars.psiProbeInit.get_dimj() / 2};
-		qx_dim[0] = {pars.psiProbeInit.get_dimi() / 2};
-		qy_dim[0] = {pars.psiProbeInit.get_dimj() / 2};
-		qx = fftshift(pars.qx);
-		qy = fftshift(pars.qy);
-		offset_qx = pars.psiProbeInit.get_dimi() / 4;
-		offset_qy = pars.psiProbeInit.get_dimj() / 4;
-		chunkDims[2] = {pars.psiProbeInit.get_dimi() / 2};
-		chunkDims[3] = {pars.psiProbeInit.get_dimj() / 2};
-	}
-	else
-	{
-		data_dims[2] = {pars.qx.get_dimi()};
-		data_dims[3] = {pars.qy.get_dimi()};
-		qx_dim[0] = {pars.qx.get_dimi()};
-		qy_dim[0] = {pars.qy.get_dimi()};
-		qx = pars.qx;
-		qy = pars.qy;
-		offset_qx = 0;
-		offset_qy = 0;
-		chunkDims[2] = {pars.qx.get_dimi()};
-		chunkDims[3] = {pars.qy.get_dimi()};
-		//std::cout << "Probe size: " << pars.psiProbeInit.get_dimi() << std::endl;
+		//sparse output, each frame is one row of the masked pixels
+		data_dims[2] = chunkDims[2] = {1};
+		data_dims[3] = chunkDims[3] = {pars.datacubeMask->size()};
 	}
 
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group CBED_slice_n(datacubes.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -482,12 +682,27 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 
 		//set chunk properties
 		H5::DSetCreatPropList plist;
-		plist.setChunk(4, chunkDims);
+		setDatacubeCreateProperties(plist, chunkDims, pars.meta, n == 0);
 
-		//create dataset
-		H5::DataSpace mspace(4, data_dims); //rank is 4
-		H5::DataSet CBED_data = CBED_slice_n.createDataSet("datacube", H5::PredType::NATIVE_DOUBLE, mspace, plist);
-		mspace.close();
+		//create dataset, or its array in the directory store or the mapped npy file
+		if (pars.datacubeStore)
+		{
+			createStoreArray(*pars.datacubeStore, nth_name, data_dims);
+		}
+		else if (pars.datacubeMap)
+		{
+			createStoreArray(*pars.datacubeMap, nth_name, data_dims);
+		}
+		else
+		{
+			H5::DataSpace mspace(4, data_dims); //rank is 4
+			DatacubeEncoding encoding(pars.meta);
+			H5::DataSet CBED_data = CBED_slice_n.createDataSet("datacube", encoding.getFileType(), mspace, plist);
+			mspace.close();
+			encoding.setup(CBED_slice_n, CBED_data, data_dims);
+		}
+		if (pars.datacubeMask)
+			pars.datacubeMask->write(CBED_slice_n);
 
 		//write dimensions
 		H5::DataSpace str_name_ds(H5S_SCALAR);
@@ -508,10 +723,10 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim3_fspace = dim3.getSpace();
 		H5::DataSpace dim4_fspace = dim4.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
-		dim3.write(&qx[offset_qx], H5::PredType::NATIVE_DOUBLE, dim3_mspace, dim3_fspace);
-		dim4.write(&qy[offset_qy], H5::PredType::NATIVE_DOUBLE, dim4_mspace, dim4_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
+		dim3.write(&qx[0], H5::PredType::NATIVE_DOUBLE, dim3_mspace, dim3_fspace);
+		dim4.write(&qy[0], H5::PredType::NATIVE_DOUBLE, dim4_mspace, dim4_fspace);
 
 		//dimension attributes
 		const H5std_string dim1_name_str("R_x");
@@ -550,9 +765,9 @@ void setup4DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	datacubes.close();
 };
 
-void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy)
+void setupVDOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy)
 {
-	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 
 	//shared properties
 	std::string base_name = "virtual_detector_depth";
@@ -569,7 +784,7 @@ void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group VD_slice_n(realslices.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -606,9 +821,9 @@ void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim2_fspace = dim2.getSpace();
 		H5::DataSpace dim3_fspace = dim3.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
-		dim3.write(&pars.detectorAngles[0], H5::PredType::NATIVE_FLOAT, dim3_mspace, dim3_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
+		dim3.write(pars.detectorAngles.view().begin(), H5::PredType::NATIVE_FLOAT, dim3_mspace, dim3_fspace);
 		//dimension attributes
 		const H5std_string dim1_name_str("R_x");
 		const H5std_string dim2_name_str("R_y");
@@ -640,9 +855,9 @@ void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	realslices.close();
 };
 
-void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy)
+void setupVDOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy)
 {
-	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 
 	//shared properties
 	std::string base_name = "virtual_detector_depth";
@@ -659,7 +874,7 @@ void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group VD_slice_n(realslices.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -696,9 +911,9 @@ void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim2_fspace = dim2.getSpace();
 		H5::DataSpace dim3_fspace = dim3.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
-		dim3.write(&pars.detectorAngles[0], H5::PredType::NATIVE_DOUBLE, dim3_mspace, dim3_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
+		dim3.write(pars.detectorAngles.view().begin(), H5::PredType::NATIVE_DOUBLE, dim3_mspace, dim3_fspace);
 
 		//dimension attributes
 		const H5std_string dim1_name_str("R_x");
@@ -731,9 +946,9 @@ void setupVDOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	realslices.close();
 };
 
-void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy)
+void setup2DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy)
 {
-	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 
 	//shared properties
 	std::string base_name = "annular_detector_depth";
@@ -748,7 +963,7 @@ void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group annular_slice_n(realslices.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -787,8 +1002,8 @@ void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim1_fspace = dim1.getSpace();
 		H5::DataSpace dim2_fspace = dim2.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
 
 		//dimension attributes
 		const H5std_string dim1_name_str("R_x");
@@ -815,9 +1030,9 @@ void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	realslices.close();
 };
 
-void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy)
+void setup2DOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy)
 {
-	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 
 	//shared properties
 	std::string base_name = "annular_detector_depth";
@@ -832,7 +1047,7 @@ void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group annular_slice_n(realslices.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -871,8 +1086,8 @@ void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim1_fspace = dim1.getSpace();
 		H5::DataSpace dim2_fspace = dim2.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
 
 		//dimension attributes
 		const H5std_string dim1_name_str("R_x");
@@ -899,9 +1114,9 @@ void setup2DOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	realslices.close();
 };
 
-void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const float dummy)
+void setupDPCOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const float dummy)
 {
-	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 
 	//shared properties
 	std::string base_name = "DPC_CoM_depth";
@@ -918,7 +1133,7 @@ void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group DPC_CoM_slice_n(realslices.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -953,8 +1168,8 @@ void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim1_fspace = dim1.getSpace();
 		H5::DataSpace dim2_fspace = dim2.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_FLOAT, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_FLOAT, dim2_mspace, dim2_fspace);
 
 		H5::DataSet dim3 = DPC_CoM_slice_n.createDataSet("dim3", strdatatype, dim3_mspace);
 		H5std_string dpc_x("DPC_CoM_x");
@@ -990,9 +1205,9 @@ void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	realslices.close();
 };
 
-void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const size_t numLayers, const double dummy)
+void setupDPCOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t numLayers, const double dummy)
 {
-	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
 
 	//shared properties
 	std::string base_name = "DPC_CoM_depth";
@@ -1009,7 +1224,7 @@ void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 	for (auto n = 0; n < numLayers; n++)
 	{
 		//create slice group
-		std::string nth_name = base_name + getDigitString(n);
+		std::string nth_name = base_name + getLayerString(pars, n, numLayers);
 		H5::Group DPC_CoM_slice_n(realslices.createGroup(nth_name.c_str()));
 
 		//write group type attribute
@@ -1044,8 +1259,8 @@ void setupDPCOutput(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, const
 		H5::DataSpace dim1_fspace = dim1.getSpace();
 		H5::DataSpace dim2_fspace = dim2.getSpace();
 
-		dim1.write(&pars.xp[0], H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
-		dim2.write(&pars.yp[0], H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
+		dim1.write(pars.xp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim1_mspace, dim1_fspace);
+		dim2.write(pars.yp.view().begin(), H5::PredType::NATIVE_DOUBLE, dim2_mspace, dim2_fspace);
 
 		H5::DataSet dim3 = DPC_CoM_slice_n.createDataSet("dim3", strdatatype, dim3_mspace);
 		H5std_string dpc_x("DPC_CoM_x");
@@ -1128,102 +1343,333 @@ void writeDatacube3D(H5::DataSet dataset, const double *buffer, const hsize_t *m
 };
 
 //for 4D writes, need to first read the data set and then add; this way, FP are accounted for
-void writeDatacube4D(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, float *buffer, const hsize_t *mdims, const hsize_t *offset, const float numFP, const std::string nameString)
+template <class T>
+static void routeDatacube4D(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const T *buffer, const hsize_t *mdims, const hsize_t *offset, const T numFP, const std::string &nameString)
+{
+	//the directory store is written from the calling thread without any lock
+	if (pars.datacubeStore)
+	{
+		try
+		{
+			pars.datacubeStore->writeDatacube4D(nameString, mdims, offset, buffer, numFP, pars.fpFlag > 0);
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cout << e.what() << "Terminating" << std::endl;
+			exit(1);
+		}
+		return;
+	}
+
+	//so are the mapped npy files
+	if (pars.datacubeMap)
+	{
+		try
+		{
+			pars.datacubeMap->writeDatacube4D(nameString, mdims, offset, buffer, numFP, pars.fpFlag > 0);
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cout << e.what() << "Terminating" << std::endl;
+			exit(1);
+		}
+		return;
+	}
+
+	//frozen phonons summed in memory are written once at the end
+	if (pars.datacubeAccumulator)
+	{
+		pars.datacubeAccumulator->add(pars.outputWriter->getFile(), nameString, mdims, offset, buffer, numFP);
+		return;
+	}
+
+	//hand the frame to the writer thread if there is one
+	if (pars.datacubeWriter)
+	{
+		pars.datacubeWriter->push(nameString, mdims, offset, buffer, numFP);
+		return;
+	}
+
+	pars.outputWriter->writeDatacube4D(nameString, mdims, offset, buffer, numFP, pars.fpFlag > 0, DatacubeEncoding(pars.meta));
+}
+
+template <class T>
+static void writeMaskedDatacube4D(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const T *buffer, const hsize_t *offset, const T numFP, const std::string &nameString)
+{
+	//a sparse frame is a single row of the masked pixels, which the writers store without restriding
+	std::vector<T> masked(pars.datacubeMask->size());
+	pars.datacubeMask->gather(buffer, &masked[0]);
+	const hsize_t maskedDims[4] = {1, 1, 1, masked.size()};
+	routeDatacube4D(pars, &masked[0], maskedDims, offset, numFP, nameString);
+}
+
+void writeDatacube4D(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const float *buffer, const hsize_t *mdims, const hsize_t *offset, const float numFP, const std::string nameString)
 {
-	//lock the whole file access/writing procedure in only one location
-	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
-
-    H5::Group dataGroup = pars.outputFile.openGroup(nameString);
-    H5::DataSet dataset = dataGroup.openDataSet("datacube");
-
-    //set up file and memory spaces
-    H5::DataSpace fspace = dataset.getSpace();
-
-    H5::DataSpace mspace(4, mdims); //rank = 4
-
-    fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
-
-    //divide by num FP
-    for (auto i = 0; i < mdims[0] * mdims[1] * mdims[2] * mdims[3]; i++)
-        buffer[i] /= numFP;
-
-    //restride the dataset so that qx and qy are flipped
-    float *finalBuffer = (float *)malloc(mdims[0] * mdims[1] * mdims[2] * mdims[3] * sizeof(float));
-    for (auto i = 0; i < mdims[2]; i++)
-    {
-        for (auto j = 0; j < mdims[3]; j++)
-        {
-            finalBuffer[i * mdims[3] + j] = buffer[j * mdims[2] + i];
-        }
-    }
-
-    //add frozen phonon set
-    float *readBuffer = (float *)malloc(mdims[0] * mdims[1] * mdims[2] * mdims[3] * sizeof(float));
-    dataset.read(&readBuffer[0], H5::PredType::NATIVE_FLOAT, mspace, fspace);
-    for (auto i = 0; i < mdims[0] * mdims[1] * mdims[2] * mdims[3]; i++)
-        finalBuffer[i] += readBuffer[i];
-    free(readBuffer);
-		
-    dataset.write(finalBuffer, H5::PredType::NATIVE_FLOAT, mspace, fspace);
-    free(finalBuffer);
-    fspace.close();
-    mspace.close();
-    dataset.flush(H5F_SCOPE_LOCAL);
-    dataset.close();
-    dataGroup.flush(H5F_SCOPE_LOCAL);
-    dataGroup.close();
-    pars.outputFile.flush(H5F_SCOPE_LOCAL);
-
-	writeGatekeeper.unlock();
+	if (pars.datacubeMask)
+		writeMaskedDatacube4D(pars, buffer, offset, numFP, nameString);
+	else
+		routeDatacube4D(pars, buffer, mdims, offset, numFP, nameString);
 };
 
-void writeDatacube4D(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, double *buffer, const hsize_t *mdims, const hsize_t *offset, const double numFP, const std::string nameString)
+void writeDatacube4D(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const double *buffer, const hsize_t *mdims, const hsize_t *offset, const double numFP, const std::string nameString)
 {
-	//lock the whole file access/writing procedure in only one location
-	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
+	if (pars.datacubeMask)
+		writeMaskedDatacube4D(pars, buffer, offset, numFP, nameString);
+	else
+		routeDatacube4D(pars, buffer, mdims, offset, numFP, nameString);
+};
 
-	H5::Group dataGroup = pars.outputFile.openGroup(nameString);
-	H5::DataSet dataset = dataGroup.openDataSet("datacube");
+void setupDatacubeMask(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	pars.datacubeMask.reset();
+	if ((!pars.meta.save4DOutput) | (pars.meta.maskAnnuli4D.empty() & (pars.meta.filenameMask4D == "")))
+		return;
 
-	//set up file and memory spaces
-	H5::DataSpace fspace = dataset.getSpace();
-	H5::DataSpace mspace(4, mdims); //rank = 4
+	Prismatic::Array1D<PRISMATIC_FLOAT_PRECISION> binnedQx, binnedQy;
+	get4DOutputCoordinates(pars, binnedQx, binnedQy);
+
+	try
+	{
+		pars.datacubeMask = std::make_shared<Prismatic::DatacubeMask>(pars.meta, binnedQx, binnedQy, pars.lambda);
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cout << e.what() << "Terminating" << std::endl;
+		exit(1);
+	}
+	if (pars.fpFlag == 0)
+		std::cout << "The 4D output stores " << pars.datacubeMask->size() << " of the " << binnedQx.size() * binnedQy.size() << " pixels of each pattern" << std::endl;
+}
+
+void setupDatacubeStore(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	pars.datacubeStore.reset();
+	if (!pars.meta.save4DOutput)
+		return;
+
+	//the mapped files are created with the output and kept by the entry functions for the later frozen phonon passes
+	if ((pars.meta.format4D == Prismatic::Format4D::Npy) & (pars.fpFlag == 0))
+	{
+		const std::string &filename = pars.meta.filenameOutput;
+		const size_t dot = filename.find_last_of('.');
+		const size_t slash = filename.find_last_of('/');
+		const bool extension = (dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash + 1));
+		pars.datacubeMap = std::make_shared<Prismatic::DatacubeMap>(extension ? filename.substr(0, dot) : filename);
+	}
+	if (pars.meta.format4D != Prismatic::Format4D::Zarr)
+		return;
+	try
+	{
+		pars.datacubeStore = std::make_shared<Prismatic::DatacubeStore>(pars.meta.filenameOutput + ".zarr",
+																		std::min(pars.meta.chunk4DX, pars.xp.size()), std::min(pars.meta.chunk4DY, pars.yp.size()));
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cout << e.what() << "Terminating" << std::endl;
+		exit(1);
+	}
+}
+
+void startDatacubeWriter(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if ((!pars.meta.save4DOutput) | (pars.meta.writerQueueMB == 0) | (pars.datacubeAccumulator != nullptr) | (pars.datacubeStore != nullptr) | (pars.datacubeMap != nullptr))
+		return;
+	// the first frozen phonon pass writes into the freshly created datasets, the later ones add to them
+	pars.datacubeWriter = std::make_shared<DatacubeWriter>(pars.outputWriter->getFile(), DatacubeEncoding(pars.meta), pars.fpFlag > 0, pars.meta.writerQueueMB << 20);
+}
+
+void finishDatacubeWriter(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if (!pars.datacubeWriter)
+		return;
+	std::shared_ptr<DatacubeWriter> writer = pars.datacubeWriter;
+	pars.datacubeWriter.reset();
+	try
+	{
+		writer->finish();
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::cout << e.what() << std::endl;
+		std::cout << "Terminating" << std::endl;
+		exit(1);
+	}
+}
+
+void setupDatacubeAccumulator(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if ((!pars.meta.save4DOutput) | (pars.meta.numFP < 2) | (pars.meta.fpAccumulation4D == Prismatic::FPAccumulation::Disk))
+		return;
+	size_t memoryBytes = getAccumulatorMemoryLimit();
+	if (pars.meta.fpAccumulation4D == Prismatic::FPAccumulation::Memory)
+		memoryBytes = std::numeric_limits<size_t>::max();
+	else if (pars.meta.fpAccumulation4D == Prismatic::FPAccumulation::File)
+		memoryBytes = 0;
+	pars.datacubeAccumulator = std::make_shared<DatacubeAccumulator>(memoryBytes, pars.meta.filenameOutput + ".4D_scratch");
+}
+
+void writeDatacubeAccumulator(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if (!pars.datacubeAccumulator)
+		return;
+	pars.datacubeAccumulator->write(pars.outputWriter->getFile(), DatacubeEncoding(pars.meta));
+	pars.datacubeAccumulator.reset();
+}
+
+void setupRealSliceOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//a streamed output creates them when the run starts
+	H5::Group realslices = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/data/realslices");
+	const size_t numLayers = pars.output.get_diml();
+	const std::string layer = getLayerString(pars, 0, numLayers);
+	auto exists = [&](const std::string &name) { return H5Lexists(realslices.getId(), (name + layer).c_str(), H5P_DEFAULT) > 0; };
+
+	PRISMATIC_FLOAT_PRECISION dummy = 1.0;
+	if (pars.meta.save3DOutput && !exists("virtual_detector_depth"))
+		setupVDOutput(pars, numLayers, dummy);
+	if (pars.meta.save2DOutput && !exists("annular_detector_depth"))
+		setup2DOutput(pars, numLayers, dummy);
+	if (pars.meta.saveDPC_CoM && !exists("DPC_CoM_depth"))
+		setupDPCOutput(pars, numLayers, dummy);
+}
 
-	fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
+void writeRealSliceOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	writeRealSliceOutput(pars, pars.output, pars.DPC_CoM);
+}
 
-	//divide by num FP
-	for (auto i = 0; i < mdims[0] * mdims[1] * mdims[2] * mdims[3]; i++)
-		buffer[i] /= numFP;
+void writeRealSliceOutput(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						  const Prismatic::Array4D<PRISMATIC_FLOAT_PRECISION> &output,
+						  const Prismatic::Array4D<PRISMATIC_FLOAT_PRECISION> &DPC_CoM)
+{
+	H5::H5File &file = pars.outputWriter->getFile();
+	const size_t numLayers = output.get_diml();
 
-	//restride the dataset so that qx and qy are flipped
-	double *finalBuffer = (double *)malloc(mdims[0] * mdims[1] * mdims[2] * mdims[3] * sizeof(double));
-	for (auto i = 0; i < mdims[2]; i++)
+	if (pars.meta.save3DOutput)
 	{
-		for (auto j = 0; j < mdims[3]; j++)
+		Prismatic::Array3D<PRISMATIC_FLOAT_PRECISION> output_image = Prismatic::zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{output.get_dimj(), output.get_dimk(), output.get_dimi()}});
+		hsize_t mdims[3] = {pars.xp.size(), pars.yp.size(), pars.Ndet};
+
+		// one layer per probe condition and depth
+		for (auto j = 0; j < numLayers; j++)
 		{
-			finalBuffer[i * mdims[3] + j] = buffer[j * mdims[2] + i];
+			for (auto b = 0; b < output.get_dimi(); b++)
+			{
+				for (auto y = 0; y < output.get_dimk(); ++y)
+				{
+					for (auto x = 0; x < output.get_dimj(); ++x)
+					{
+						output_image.at(x, y, b) = output.at(j, y, x, b);
+					}
+				}
+			}
+			H5::DataSet VD_data = file.openDataSet("4DSTEM_simulation/data/realslices/virtual_detector_depth" + getLayerString(pars, j, numLayers) + "/realslice");
+			writeDatacube3D(VD_data, &output_image[0], mdims);
 		}
 	}
 
-	//add frozen phonon set
-	double *readBuffer = (double *)malloc(mdims[0] * mdims[1] * mdims[2] * mdims[3] * sizeof(double));
-	dataset.read(&readBuffer[0], H5::PredType::NATIVE_DOUBLE, mspace, fspace);
-	for (auto i = 0; i < mdims[0] * mdims[1] * mdims[2] * mdims[3]; i++)
-		finalBuffer[i] += readBuffer[i];
-	free(readBuffer);
-
-	dataset.write(finalBuffer, H5::PredType::NATIVE_DOUBLE, mspace, fspace);
-	free(finalBuffer);
-    fspace.close();
-    mspace.close();
-    dataset.flush(H5F_SCOPE_LOCAL);
-    dataset.close();
-    dataGroup.flush(H5F_SCOPE_LOCAL);
-    dataGroup.close();
-    pars.outputFile.flush(H5F_SCOPE_LOCAL);
-    
-	writeGatekeeper.unlock();
-};
+	if (pars.meta.save2DOutput)
+	{
+		size_t lower = std::max((size_t)0, (size_t)(pars.meta.integrationAngleMin / pars.meta.detectorAngleStep));
+		size_t upper = std::min((size_t)pars.detectorAngles.size(), (size_t)(pars.meta.integrationAngleMax / pars.meta.detectorAngleStep));
+		hsize_t mdims[2] = {pars.xp.size(), pars.yp.size()};
+
+		for (auto j = 0; j < numLayers; j++)
+		{
+			//initialize the image of each layer to prevent overflow of value
+			Prismatic::Array2D<PRISMATIC_FLOAT_PRECISION> prism_image = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{output.get_dimj(), output.get_dimk()}});
+			for (auto y = 0; y < output.get_dimk(); ++y)
+			{
+				for (auto x = 0; x < output.get_dimj(); ++x)
+				{
+					for (auto b = lower; b < upper; ++b)
+					{
+						prism_image.at(x, y) += output.at(j, y, x, b);
+					}
+				}
+			}
+			H5::DataSet AD_data = file.openDataSet("4DSTEM_simulation/data/realslices/annular_detector_depth" + getLayerString(pars, j, numLayers) + "/realslice");
+			writeRealSlice(AD_data, &prism_image[0], mdims);
+		}
+	}
+
+	if (pars.meta.saveDPC_CoM)
+	{
+		Prismatic::Array3D<PRISMATIC_FLOAT_PRECISION> DPC_slice = Prismatic::zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{DPC_CoM.get_dimj(), DPC_CoM.get_dimk(), 2}});
+		hsize_t mdims[3] = {pars.xp.size(), pars.yp.size(), 2};
+
+		for (auto j = 0; j < numLayers; j++)
+		{
+			for (auto b = 0; b < DPC_CoM.get_dimi(); ++b)
+			{
+				for (auto y = 0; y < DPC_CoM.get_dimk(); ++y)
+				{
+					for (auto x = 0; x < DPC_CoM.get_dimj(); ++x)
+					{
+						DPC_slice.at(x, y, b) = DPC_CoM.at(j, y, x, b);
+					}
+				}
+			}
+			H5::DataSet DPC_data = file.openDataSet("4DSTEM_simulation/data/realslices/DPC_CoM_depth" + getLayerString(pars, j, numLayers) + "/realslice");
+			writeDatacube3D(DPC_data, &DPC_slice[0], mdims);
+		}
+	}
+}
+
+void startOutputStreamer(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if (pars.meta.swmrInterval == 0)
+		return;
+
+	//no objects can be created in SWMR mode, so everything the run writes to the file is created first. The images are
+	//written once as well, which allocates their storage. The progress is a dataset rather than an attribute of the
+	//file, since SWMR readers can only refresh datasets
+	if (pars.fpFlag == 0)
+	{
+		setupRealSliceOutput(pars);
+		writeRealSliceOutput(pars);
+		PRISMATIC_FLOAT_PRECISION dummy = 1.0;
+		writeMetadata(pars, dummy);
+		hsize_t one[1] = {1};
+		const double progress = 0;
+		H5::DataSpace progress_space(1, one);
+		pars.outputWriter->getFile().createDataSet("progress", H5::PredType::NATIVE_DOUBLE, progress_space).write(&progress, H5::PredType::NATIVE_DOUBLE);
+		try
+		{
+			pars.outputWriter->startSWMR();
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cout << e.what() << "Terminating" << std::endl;
+			exit(1);
+		}
+		std::cout << "Streaming the output to " << pars.meta.filenameOutput << " in SWMR mode, refreshed every " << pars.meta.swmrInterval << " s" << std::endl;
+	}
+	pars.outputStreamer = std::make_shared<Prismatic::OutputStreamer>(pars, pars.meta.swmrInterval);
+}
+
+void finishOutputStreamer(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if (!pars.outputStreamer)
+		return;
+	std::shared_ptr<Prismatic::OutputStreamer> streamer = pars.outputStreamer;
+	pars.outputStreamer.reset();
+	streamer->finish();
+}
+
+void closeOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if (pars.meta.swmrInterval == 0)
+		pars.outputWriter->close();
+}
+
+void reopenOutputFile(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const std::shared_ptr<Prismatic::OutputWriter> &outputWriter)
+{
+	if (pars.meta.swmrInterval > 0)
+		pars.outputWriter = outputWriter;
+	else
+		pars.outputWriter = std::make_shared<Prismatic::OutputWriter>(pars.meta.filenameOutput, H5F_ACC_RDWR);
+}
 
 void writeStringArray(H5::DataSet dataset, H5std_string *string_array, const hsize_t elements)
 {
@@ -1252,10 +1698,33 @@ std::string getDigitString(int digit)
 	return output;
 };
 
-void writeMetadata(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, float dummy)
+std::string getSeriesFilename(const std::string &filename, const std::string &tag, const size_t n)
+{
+	// inserts e.g. "_energy0002" in front of the extension
+	const size_t dot = filename.find_last_of('.');
+	const size_t slash = filename.find_last_of("/\\");
+	const std::string suffix = "_" + tag + getDigitString(n);
+	if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+		return filename + suffix;
+	return filename.substr(0, dot) + suffix + filename.substr(dot);
+};
+
+std::string getLayerString(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t n, const size_t numLayers)
+{
+	// with several probe conditions the output layers are ordered depth fastest, then condition
+	const size_t numConditions = pars.probeConditions.size();
+	if (numConditions < 2)
+		return getDigitString(n);
+	const size_t numDepths = numLayers / numConditions;
+	return getDigitString(n % numDepths) + "_condition" + getDigitString(n / numDepths);
+};
+
+void writeMetadata(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, float dummy)
 {
 	//set up group
-	H5::Group metadata = pars.outputFile.openGroup("4DSTEM_simulation/metadata/metadata_0/original");
+	H5::Group metadata = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/metadata/metadata_0/original");
+	if (H5Lexists(metadata.getId(), "simulation_parameters", H5P_DEFAULT) > 0)
+		return; // a streamed output writes it when the run starts
 	H5::Group sim_params = metadata.createGroup("simulation_parameters");
 
 	//write all parameters as attributes
@@ -1436,13 +1905,34 @@ void writeMetadata(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, float
 	cellBuffer[2] = pars.meta.cellDim[2];
 	cell_dim_attr.write(H5::PredType::NATIVE_FLOAT, cellBuffer);
 
+	// one row of defocus, C3, C5, semiangle, x tilt and y tilt per probe condition, in the units of the scalars
+	if (pars.probeConditions.size() > 1)
+	{
+		hsize_t conditions_dims[2] = {pars.probeConditions.size(), 6};
+		H5::DataSpace conditions_ds(2, conditions_dims);
+		H5::Attribute conditions_attr = sim_params.createAttribute("probe_conditions", H5::PredType::NATIVE_FLOAT, conditions_ds);
+		std::vector<PRISMATIC_FLOAT_PRECISION> conditionBuffer;
+		for (auto &c : pars.probeConditions)
+		{
+			conditionBuffer.push_back(c.probeDefocus);
+			conditionBuffer.push_back(c.C3);
+			conditionBuffer.push_back(c.C5);
+			conditionBuffer.push_back(c.probeSemiangle * 1000);
+			conditionBuffer.push_back(c.probeXtilt * 1000);
+			conditionBuffer.push_back(c.probeYtilt * 1000);
+		}
+		conditions_attr.write(H5::PredType::NATIVE_FLOAT, &conditionBuffer[0]);
+	}
+
 	metadata.close();
 };
 
-void writeMetadata(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, double dummy)
+void writeMetadata(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, double dummy)
 {
 	//set up group
-	H5::Group metadata = pars.outputFile.openGroup("4DSTEM_simulation/metadata/metadata_0/original");
+	H5::Group metadata = pars.outputWriter->getFile().openGroup("4DSTEM_simulation/metadata/metadata_0/original");
+	if (H5Lexists(metadata.getId(), "simulation_parameters", H5P_DEFAULT) > 0)
+		return; // a streamed output writes it when the run starts
 	H5::Group sim_params = metadata.createGroup("simulation_parameters");
 
 	//write all parameters as attributes
@@ -1623,6 +2113,25 @@ void writeMetadata(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, double
 	cellBuffer[2] = pars.meta.cellDim[2];
 	cell_dim_attr.write(H5::PredType::NATIVE_DOUBLE, cellBuffer);
 
+	// one row of defocus, C3, C5, semiangle, x tilt and y tilt per probe condition, in the units of the scalars
+	if (pars.probeConditions.size() > 1)
+	{
+		hsize_t conditions_dims[2] = {pars.probeConditions.size(), 6};
+		H5::DataSpace conditions_ds(2, conditions_dims);
+		H5::Attribute conditions_attr = sim_params.createAttribute("probe_conditions", H5::PredType::NATIVE_DOUBLE, conditions_ds);
+		std::vector<PRISMATIC_FLOAT_PRECISION> conditionBuffer;
+		for (auto &c : pars.probeConditions)
+		{
+			conditionBuffer.push_back(c.probeDefocus);
+			conditionBuffer.push_back(c.C3);
+			conditionBuffer.push_back(c.C5);
+			conditionBuffer.push_back(c.probeSemiangle * 1000);
+			conditionBuffer.push_back(c.probeXtilt * 1000);
+			conditionBuffer.push_back(c.probeYtilt * 1000);
+		}
+		conditions_attr.write(H5::PredType::NATIVE_DOUBLE, &conditionBuffer[0]);
+	}
+
 	metadata.close();
 };
 } // namespace Prismatic
@@ -506,48 +506,15 @@ void formatOutput_GPU_integrate(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION>
 		std::stringstream nameString;
 		nameString << "/4DSTEM_simulation/data/datacubes/CBED_array_depth" << Prismatic::getDigitString(currentSlice);
 		
-		// H5::Group dataGroup = pars.outputFile.openGroup(nameString.str());
+		// H5::Group dataGroup = pars.outputWriter->getFile().openGroup(nameString.str());
 		// H5::DataSet CBED_data = dataGroup.openDataSet("datacube");
 
 		hsize_t offset[4] = {ax,ay,0,0}; //order by ax, ay so that aligns with py4DSTEM
         PRISMATIC_FLOAT_PRECISION numFP = pars.meta.numFP;
         
-        if(pars.meta.crop4DOutput)
-        {
-            Prismatic::Array2D<PRISMATIC_FLOAT_PRECISION> finalImage = cropOutput(currentImage,pars);
-            hsize_t mdims[4] = {1,1,finalImage.get_dimi(),finalImage.get_dimj()};
-            Prismatic::writeDatacube4D(pars, &finalImage[0],mdims,offset,numFP,nameString.str());
-        }
-        else
-        {
-
-            if (pars.meta.algorithm == Prismatic::Algorithm::Multislice){
-                Prismatic::Array2D<PRISMATIC_FLOAT_PRECISION> finalImage = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-                    {{pars.psiProbeInit.get_dimj()/2,pars.psiProbeInit.get_dimi()/2}});
-                    {
-                        long offset_x = pars.psiProbeInit.get_dimi() / 4;
-                        long offset_y = pars.psiProbeInit.get_dimj() / 4;
-                        long ndimy = (long) pars.psiProbeInit.get_dimj();
-                        long ndimx = (long) pars.psiProbeInit.get_dimi();
-                        for (long y = 0; y < pars.psiProbeInit.get_dimj() / 2; ++y) {
-                            for (long x = 0; x < pars.psiProbeInit.get_dimi() / 2; ++x) {
-                                finalImage.at(y, x) = currentImage.at(((y - offset_y) % ndimy + ndimy) % ndimy,
-                                ((x - offset_x) % ndimx + ndimx) % ndimx);
-                            }
-                        }
-                    }
-                    
-                    //finalImage = fftshift2(finalImage);
-                    hsize_t mdims[4] = {1,1,pars.psiProbeInit.get_dimi()/2,pars.psiProbeInit.get_dimj()/2};
-                    Prismatic::writeDatacube4D(pars, &finalImage[0],mdims,offset,numFP,nameString.str());
-                    //finalImage.toMRC_f(section4DFilename.c_str());
-                }else{                     
-                    currentImage = fftshift2(currentImage);
-                    hsize_t mdims[4] = {1,1,pars.psiProbeInit.get_dimi(),pars.psiProbeInit.get_dimj()};
-                    Prismatic::writeDatacube4D(pars, &currentImage[0],mdims,offset,numFP,nameString.str());
-                    //currentImage.toMRC_f(section4DFilename.c_str());
-                }
-        }
+        Prismatic::Array2D<PRISMATIC_FLOAT_PRECISION> finalImage = Prismatic::get4DOutputFrame(currentImage, pars);
+        hsize_t mdims[4] = {1,1,finalImage.get_dimi(),finalImage.get_dimj()};
+        Prismatic::writeDatacube4D(pars, &finalImage[0],mdims,offset,numFP,nameString.str());
         // CBED_data.close();
         // dataGroup.close();
         // HDF5_gatekeeper.unlock();